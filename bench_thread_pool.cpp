@@ -0,0 +1,388 @@
+/**
+ * @file
+ * @brief Micro-benchmark of thread_pool.hpp.
+ *
+ * Each row of the CSV output is a repetition of a configuration.
+ *
+ * run:   producers keep submitting timestamps and consumers record
+ *        enqueue-to-dequeue latency. Throughput and latency are
+ *        measured for a period after a warmup.
+ * flush: a full queue is drained by flush(), then stop() and join().
+ */
+#include <vector>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+
+#include <cstdio>
+#include <cstdint>
+#include <cinttypes>
+#include <cstdlib>
+#include <cassert>
+
+#include <unistd.h>
+
+#include "util.hpp"
+#include "thread_pool.hpp"
+
+class Options
+{
+private:
+    std::string programName_;
+    std::string mode_;
+    std::string pool_;
+    std::vector<unsigned int> producers_;
+    std::vector<unsigned int> consumers_;
+    std::vector<unsigned int> queueSizes_;
+    std::vector<unsigned int> batchSizes_;
+    size_t periodMs_;
+    size_t warmupMs_;
+    size_t nReps_;
+    bool isShowHelp_;
+
+public:
+    Options(int argc, char* argv[])
+        : mode_("all")
+        , pool_("all")
+        , producers_({1, 2, 4})
+        , consumers_({1, 2, 4})
+        , queueSizes_({16, 256})
+        , batchSizes_({1})
+        , periodMs_(500)
+        , warmupMs_(100)
+        , nReps_(3)
+        , isShowHelp_(false) {
+
+        parse(argc, argv);
+
+        if (isShowHelp_) {
+            return;
+        }
+        checkAndThrow();
+    }
+
+    void showHelp() {
+
+        ::printf("usage: %s [option(s)]\n"
+                 "options: \n"
+                 "    -m mode: run, flush, or all (default all).\n"
+                 "    -k pool: queue, ws (work-stealing), or all (default all).\n"
+                 "    -P list: numbers of producers like 1,2,4.\n"
+                 "    -C list: numbers of consumers like 1,2,4.\n"
+                 "    -Q list: queue sizes like 16,256.\n"
+                 "    -B list: batch sizes of submit and dequeue like 1,16.\n"
+                 "    -p ms:   measurement period of each run in milliseconds.\n"
+                 "    -W ms:   warmup period of each run in milliseconds.\n"
+                 "    -n num:  number of repetitions.\n"
+                 "    -h:      show this help.\n"
+                 , programName_.c_str()
+            );
+    }
+
+    bool isRun() const { return mode_ == "run" || mode_ == "all"; }
+    bool isFlush() const { return mode_ == "flush" || mode_ == "all"; }
+    bool isQueuePool() const { return pool_ == "queue" || pool_ == "all"; }
+    bool isWorkStealingPool() const { return pool_ == "ws" || pool_ == "all"; }
+    const std::vector<unsigned int>& getProducers() const { return producers_; }
+    const std::vector<unsigned int>& getConsumers() const { return consumers_; }
+    const std::vector<unsigned int>& getQueueSizes() const { return queueSizes_; }
+    const std::vector<unsigned int>& getBatchSizes() const { return batchSizes_; }
+    size_t getPeriodMs() const { return periodMs_; }
+    size_t getWarmupMs() const { return warmupMs_; }
+    size_t getNReps() const { return nReps_; }
+    bool isShowHelp() const { return isShowHelp_; }
+
+private:
+    void parse(int argc, char* argv[]) {
+
+        programName_ = argv[0];
+
+        while (1) {
+            int c = ::getopt(argc, argv, "m:k:P:C:Q:B:p:W:n:h");
+
+            if (c < 0) { break; }
+
+            switch (c) {
+            case 'm': /* mode */
+                mode_ = optarg;
+                break;
+            case 'k': /* pool kind */
+                pool_ = optarg;
+                break;
+            case 'P': /* producers */
+                producers_ = parseList(optarg);
+                break;
+            case 'C': /* consumers */
+                consumers_ = parseList(optarg);
+                break;
+            case 'Q': /* queue sizes */
+                queueSizes_ = parseList(optarg);
+                break;
+            case 'B': /* batch sizes */
+                batchSizes_ = parseList(optarg);
+                break;
+            case 'p': /* period */
+                periodMs_ = ::atol(optarg);
+                break;
+            case 'W': /* warmup */
+                warmupMs_ = ::atol(optarg);
+                break;
+            case 'n': /* repetitions */
+                nReps_ = ::atol(optarg);
+                break;
+            case 'h': /* help */
+                isShowHelp_ = true;
+                break;
+            }
+        }
+    }
+
+    static std::vector<unsigned int> parseList(const char *s) {
+
+        std::vector<unsigned int> ret;
+        std::istringstream is(s);
+        std::string item;
+        while (std::getline(is, item, ',')) {
+            ret.push_back(::atoi(item.c_str()));
+        }
+        return ret;
+    }
+
+    void checkAndThrow() {
+
+        if (!isRun() && !isFlush()) {
+            throw std::runtime_error("mode (-m) must be run, flush, or all.");
+        }
+        if (!isQueuePool() && !isWorkStealingPool()) {
+            throw std::runtime_error("pool (-k) must be queue, ws, or all.");
+        }
+        auto hasZero = [](const std::vector<unsigned int>& v) {
+            return v.empty() || std::find(v.begin(), v.end(), 0U) != v.end();
+        };
+        if (hasZero(producers_) || hasZero(consumers_) ||
+            hasZero(queueSizes_) || hasZero(batchSizes_)) {
+            throw std::runtime_error("lists (-P, -C, -Q, -B) must be 1 or more.");
+        }
+        if (periodMs_ == 0 || nReps_ == 0) {
+            throw std::runtime_error("period (-p) and repetitions (-n) must be 1 or more.");
+        }
+    }
+};
+
+/**
+ * Monotonic time [nanosecond].
+ */
+static inline uint64_t getNanoTime()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Per-consumer data padded to avoid false sharing.
+ */
+struct alignas(64) ConsumerData
+{
+    std::atomic<uint64_t> count;
+    LatencyHistogram hist;
+
+    ConsumerData() : count(0), hist() {}
+};
+
+/**
+ * A configuration of a run.
+ */
+struct Config
+{
+    const char *pool;
+    unsigned int nProducers;
+    unsigned int nConsumers;
+    unsigned int queueSize;
+    unsigned int batchSize;
+};
+
+static void printHeader()
+{
+    ::printf("bench,pool,producers,consumers,queue,batch,rep,"
+             "ops,ops_per_sec,p50_us,p90_us,p99_us,p999_us,max_us,flush_us,stop_us\n");
+}
+
+static void printRow(const char *bench, const Config& cfg, size_t rep)
+{
+    ::printf("%s,%s,%u,%u,%u,%u,%zu,", bench, cfg.pool,
+             cfg.nProducers, cfg.nConsumers, cfg.queueSize, cfg.batchSize, rep);
+}
+
+/**
+ * Throughput and enqueue-to-dequeue latency.
+ * Base is the base class of ThreadPoolWithId.
+ */
+template<typename Base>
+void benchRun(const Options& opt, const Config& cfg, size_t rep)
+{
+    std::vector<ConsumerData> consumers(cfg.nConsumers);
+    std::atomic<bool> isMeasuring(false);
+
+    auto worker = [&](uint64_t t, unsigned int id) {
+        ConsumerData& c = consumers[id];
+        if (isMeasuring.load(std::memory_order_relaxed)) {
+            const uint64_t now = getNanoTime();
+            c.hist.add(static_cast<double>(now - t) / 1000000000.0);
+        }
+        c.count.fetch_add(1, std::memory_order_relaxed);
+    };
+    ThreadPoolWithId<uint64_t, Base, decltype(worker)> pool(
+        cfg.nConsumers, cfg.queueSize, worker, cfg.batchSize);
+
+    std::atomic<bool> shouldStop(false);
+    std::vector<std::thread> producers;
+    for (unsigned int i = 0; i < cfg.nProducers; i++) {
+        producers.emplace_back([&] {
+                std::vector<uint64_t> items(cfg.batchSize);
+                while (!shouldStop.load(std::memory_order_relaxed)) {
+                    const uint64_t now = getNanoTime();
+                    if (cfg.batchSize == 1) {
+                        if (!pool.submit(now)) { break; }
+                        continue;
+                    }
+                    std::fill(items.begin(), items.end(), now);
+                    if (pool.submitBatch(items.begin(), items.end()) < items.size()) {
+                        break;
+                    }
+                }
+            });
+    }
+
+    auto getCount = [&] {
+        uint64_t n = 0;
+        std::for_each(consumers.begin(), consumers.end(), [&](ConsumerData& c) {
+                n += c.count.load(std::memory_order_relaxed);
+            });
+        return n;
+    };
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(opt.getWarmupMs()));
+    isMeasuring.store(true);
+    const uint64_t count0 = getCount();
+    const uint64_t begin = getNanoTime();
+    std::this_thread::sleep_for(std::chrono::milliseconds(opt.getPeriodMs()));
+    const uint64_t count1 = getCount();
+    const uint64_t end = getNanoTime();
+    isMeasuring.store(false);
+
+    shouldStop.store(true);
+    pool.stop();
+    std::for_each(producers.begin(), producers.end(), [](std::thread& th) {
+            th.join();
+        });
+    pool.join();
+
+    LatencyHistogram hist;
+    std::for_each(consumers.begin(), consumers.end(), [&](ConsumerData& c) {
+            hist.merge(c.hist);
+        });
+    const uint64_t ops = count1 - count0;
+    const double period = static_cast<double>(end - begin) / 1000000000.0;
+    printRow("run", cfg, rep);
+    ::printf("%" PRIu64 ",%.0f,%.3f,%.3f,%.3f,%.3f,%.3f,,\n",
+             ops, static_cast<double>(ops) / period,
+             hist.getPercentile(50) * 1000000.0,
+             hist.getPercentile(90) * 1000000.0,
+             hist.getPercentile(99) * 1000000.0,
+             hist.getPercentile(99.9) * 1000000.0,
+             hist.getPercentile(100) * 1000000.0);
+    ::fflush(stdout);
+}
+
+/**
+ * Cost of flush() of a full queue, and stop() and join().
+ * Base is the base class of ThreadPoolWithId.
+ */
+template<typename Base>
+void benchFlush(const Options&, const Config& cfg, size_t rep)
+{
+    std::atomic<uint64_t> count(0);
+    auto worker = [&](uint64_t, unsigned int) {
+        count.fetch_add(1, std::memory_order_relaxed);
+    };
+    ThreadPoolWithId<uint64_t, Base, decltype(worker)> pool(
+        cfg.nConsumers, cfg.queueSize, worker, cfg.batchSize);
+
+    std::vector<uint64_t> items(cfg.queueSize, 0);
+    pool.submitBatch(items.begin(), items.end());
+
+    const uint64_t t0 = getNanoTime();
+    pool.flush();
+    const uint64_t t1 = getNanoTime();
+    pool.stop();
+    pool.join();
+    const uint64_t t2 = getNanoTime();
+
+    printRow("flush", cfg, rep);
+    ::printf("%u,,,,,,,%.3f,%.3f\n", cfg.queueSize,
+             static_cast<double>(t1 - t0) / 1000.0,
+             static_cast<double>(t2 - t1) / 1000.0);
+    ::fflush(stdout);
+}
+
+/**
+ * Run all configurations of a pool.
+ */
+template<typename Base>
+void benchPool(const Options& opt, const char *poolName)
+{
+    Config cfg;
+    cfg.pool = poolName;
+    for (unsigned int q : opt.getQueueSizes()) {
+        for (unsigned int b : opt.getBatchSizes()) {
+            for (unsigned int c : opt.getConsumers()) {
+                cfg.nConsumers = c;
+                cfg.queueSize = q;
+                cfg.batchSize = b;
+                if (opt.isRun()) {
+                    for (unsigned int p : opt.getProducers()) {
+                        cfg.nProducers = p;
+                        for (size_t rep = 0; rep < opt.getNReps(); rep++) {
+                            benchRun<Base>(opt, cfg, rep);
+                        }
+                    }
+                }
+                if (opt.isFlush()) {
+                    cfg.nProducers = 1;
+                    for (size_t rep = 0; rep < opt.getNReps(); rep++) {
+                        benchFlush<Base>(opt, cfg, rep);
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        Options opt(argc, argv);
+
+        if (opt.isShowHelp()) {
+            opt.showHelp();
+            return 0;
+        }
+        printHeader();
+        if (opt.isQueuePool()) {
+            benchPool<thread_pool::ThreadPoolBase<uint64_t> >(opt, "queue");
+        }
+        if (opt.isWorkStealingPool()) {
+            benchPool<thread_pool::WorkStealingThreadPoolBase<uint64_t> >(opt, "ws");
+        }
+    } catch (const std::runtime_error& e) {
+        ::printf("error: %s\n", e.what());
+    } catch (...) {
+        ::printf("caught another error.\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,252 @@
+/**
+ * @file
+ * @brief IO engines executing IOs for a workload.
+ *
+ * An engine is a class with the following members.
+ * Workloads are templated over the engine type,
+ * so there is no virtual call per IO.
+ *
+ *   size_t getQueueSize() const;
+ *     Maximum number of outstanding IOs.
+ *   void prepare(const IoSpec& spec, char* buf);
+ *     Prepare an IO. At most getQueueSize() IOs can be outstanding.
+ *   void submit();
+ *     Issue all prepared IOs.
+ *   IoResult reap();
+ *     Wait for an IO completed.
+ *   bool reapFor(double timeout, IoResult& res);
+ *     Wait for an IO completed with a timeout [second].
+ *     Returns false if timeout.
+ */
+#ifndef IO_ENGINE_HPP
+#define IO_ENGINE_HPP
+
+#define _FILE_OFFSET_BITS 64
+
+#include <deque>
+#include <cassert>
+
+#include "util.hpp"
+
+/**
+ * An IO to issue.
+ */
+struct IoSpec
+{
+    IoOp op;
+    off_t oft; /* [byte] */
+    size_t size; /* [byte] */
+    double due; /* unix time to issue [second]. 0 means as soon as possible. */
+    size_t depth; /* IOs of the worker in flight when issued including this, set by workloads. */
+};
+
+/**
+ * A completed IO.
+ */
+struct IoResult
+{
+    IoOp op;
+    off_t oft; /* [byte] */
+    size_t size; /* [byte] */
+    char *buf; /* buffer given to prepare() */
+    double beginTime; /* unix time [second] */
+    double endTime; /* unix time [second] */
+    size_t depth; /* given by IoSpec */
+};
+
+/**
+ * Synchronous engine.
+ * An IO is executed by submit() in the calling thread.
+ * Device is BlockDevice or MmapDevice.
+ */
+template<typename Device>
+class SyncEngine
+{
+private:
+    Device& dev_;
+    PageCacheProbe* probe_;
+    CacheHitStatistics* cacheStats_;
+    FaultStatistics* faultStats_;
+    IoSpec spec_;
+    char* buf_;
+    IoResult res_;
+
+public:
+    /**
+     * @probe page cache probe to classify reads, or nullptr.
+     * @cacheStats statistics of page cache hit and miss, or nullptr.
+     * @faultStats statistics to count page faults, or nullptr.
+     */
+    explicit SyncEngine(Device& dev, PageCacheProbe* probe = nullptr,
+                        CacheHitStatistics* cacheStats = nullptr,
+                        FaultStatistics* faultStats = nullptr)
+        : dev_(dev)
+        , probe_(probe)
+        , cacheStats_(cacheStats)
+        , faultStats_(faultStats)
+        , spec_()
+        , buf_(nullptr)
+        , res_() {
+
+        assert(probe_ == nullptr || cacheStats_ != nullptr);
+    }
+
+    size_t getQueueSize() const { return 1; }
+
+    void prepare(const IoSpec& spec, char* buf) {
+
+        spec_ = spec;
+        buf_ = buf;
+    }
+
+    void submit() {
+
+        const bool isProbed = (probe_ != nullptr && spec_.op == READ_OP);
+        const bool isHit = isProbed && probe_->isResident(spec_.oft, spec_.size);
+        PageFaults faultsBegin, faultsEnd;
+        if (faultStats_) { faultsBegin = PageFaults::get(); }
+
+        res_.op = spec_.op;
+        res_.oft = spec_.oft;
+        res_.size = spec_.size;
+        res_.buf = buf_;
+        res_.depth = spec_.depth;
+        res_.beginTime = getTime();
+        dev_.execIo(spec_.op, spec_.oft, spec_.size, buf_);
+        res_.endTime = getTime();
+
+        const double rt = res_.endTime - res_.beginTime;
+        if (faultStats_) {
+            faultsEnd = PageFaults::get();
+            faultStats_->updateRt(faultsBegin, faultsEnd, rt);
+        }
+        if (isProbed) { cacheStats_->updateRt(isHit, rt); }
+    }
+
+    IoResult reap() { return res_; }
+
+    bool reapFor(double, IoResult& res) {
+
+        res = res_;
+        return true;
+    }
+};
+
+/**
+ * Asynchronous engine with Aio.
+ * Discard and zero are not supported by aio, so they are executed
+ * synchronously by prepare() and returned by the next reap.
+ */
+class AioEngine
+{
+private:
+    BlockDevice& dev_;
+    const size_t queueSize_;
+    Aio aio_;
+    std::deque<IoResult> doneQ_;
+    bool isPhaseTracking_;
+    IoPhaseStatistics phaseStats_;
+
+public:
+    AioEngine(BlockDevice& dev, size_t queueSize)
+        : dev_(dev)
+        , queueSize_(queueSize)
+        , aio_(dev.getFd(), queueSize)
+        , doneQ_()
+        , isPhaseTracking_(false)
+        , phaseStats_() {
+
+        assert(queueSize_ > 0);
+    }
+
+    size_t getQueueSize() const { return queueSize_; }
+    Aio& getAio() { return aio_; }
+
+    /**
+     * Record latency of submit, device, and reap phases of each aio.
+     */
+    void setPhaseTracking() {
+
+        tscToSec(0); /* calibrate before the first IO. */
+        aio_.setPhaseTracking();
+        isPhaseTracking_ = true;
+    }
+
+    const IoPhaseStatistics& getPhaseStats() const { return phaseStats_; }
+
+    void prepare(const IoSpec& spec, char* buf) {
+
+        switch (spec.op) {
+        case READ_OP:
+            aio_.prepareRead(spec.oft, spec.size, buf, spec.depth);
+            return;
+        case WRITE_OP:
+            aio_.prepareWrite(spec.oft, spec.size, buf, spec.depth);
+            return;
+        default:
+            break;
+        }
+        IoResult res;
+        res.op = spec.op;
+        res.oft = spec.oft;
+        res.size = spec.size;
+        res.buf = buf;
+        res.depth = spec.depth;
+        res.beginTime = getTime();
+        dev_.execIo(spec.op, spec.oft, spec.size, buf);
+        res.endTime = getTime();
+        doneQ_.push_back(res);
+    }
+
+    void submit() { aio_.submit(); }
+
+    IoResult reap() {
+
+        if (!doneQ_.empty()) {
+            return popDone();
+        }
+        return toIoResult(aio_.waitOne());
+    }
+
+    bool reapFor(double timeout, IoResult& res) {
+
+        if (!doneQ_.empty()) {
+            res = popDone();
+            return true;
+        }
+        AioData* ptr = aio_.waitOneFor(timeout);
+        if (ptr == nullptr) {
+            return false;
+        }
+        res = toIoResult(ptr);
+        return true;
+    }
+
+private:
+    IoResult popDone() {
+
+        IoResult res = doneQ_.front();
+        doneQ_.pop_front();
+        return res;
+    }
+
+    IoResult toIoResult(const AioData* ptr) {
+
+        if (isPhaseTracking_) {
+            phaseStats_.updateRt(tscToSec(ptr->submitEndTsc - ptr->submitBeginTsc),
+                                 tscToSec(ptr->completeTsc - ptr->submitEndTsc),
+                                 tscToSec(ptr->reapTsc - ptr->completeTsc));
+        }
+        IoResult res;
+        res.op = ptr->isWrite ? WRITE_OP : READ_OP;
+        res.oft = ptr->oft;
+        res.size = ptr->size;
+        res.buf = ptr->buf;
+        res.depth = ptr->depth;
+        res.beginTime = ptr->beginTime;
+        res.endTime = ptr->endTime;
+        return res;
+    }
+};
+
+#endif /* IO_ENGINE_HPP */
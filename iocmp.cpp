@@ -0,0 +1,407 @@
+/**
+ * @file
+ * @brief Compare two result sets saved by iores -R.
+ *
+ * Throughput is compared with per-second IOPS samples of all the runs
+ * in a set: the delta of the means with a bootstrap confidence interval,
+ * and Mann-Whitney U test for significance.
+ * Percentiles are compared with merged histograms of the sets.
+ * Their bootstrap replicates draw the rank of the resampled percentile
+ * from its normal approximation, so that IOs are not re-read.
+ *
+ * Exit status is 1 if a regression beyond the threshold is significant,
+ * 2 on error, and 0 otherwise.
+ */
+#include <vector>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+
+#include <unistd.h>
+
+#include "ioreth.hpp"
+#include "util.hpp"
+#include "result.hpp"
+
+class Options
+{
+private:
+    std::string programName_;
+    std::vector<std::string> args_;
+    double threshold_; /* [%] */
+    double alpha_;
+    size_t nResamples_;
+    uint64_t seed_;
+    bool isShowVersion_;
+    bool isShowHelp_;
+
+public:
+    Options(int argc, char* argv[])
+        : args_()
+        , threshold_(5.0)
+        , alpha_(0.05)
+        , nResamples_(2000)
+        , seed_(1)
+        , isShowVersion_(false)
+        , isShowHelp_(false) {
+
+        parse(argc, argv);
+
+        if (isShowVersion_ || isShowHelp_) {
+            return;
+        }
+        checkAndThrow();
+    }
+
+    void showVersion() {
+
+        ::printf("iocmp version %s\n", IORETH_VERSION);
+    }
+
+    void showHelp() {
+
+        ::printf("usage: %s [option(s)] [baseline result file] [new result file]\n"
+                 "options: \n"
+                 "    -t pct:  regression threshold in percent (default 5).\n"
+                 "             lower IOPS or higher p50, p99, or p99.9 beyond it\n"
+                 "             is a regression if it is significant.\n"
+                 "    -a val:  significance level (default 0.05).\n"
+                 "    -n num:  number of bootstrap resamples (default 2000).\n"
+                 "    -S seed: seed of resampling (default 1).\n"
+                 "    -v:      show version.\n"
+                 "    -h:      show this help.\n"
+                 "exit status is 1 on regression, 2 on error, and 0 otherwise.\n"
+                 , programName_.c_str()
+            );
+    }
+
+    const std::vector<std::string>& getArgs() const { return args_; }
+    double getThreshold() const { return threshold_; }
+    double getAlpha() const { return alpha_; }
+    size_t getNresamples() const { return nResamples_; }
+    uint64_t getSeed() const { return seed_; }
+    bool isShowVersion() const { return isShowVersion_; }
+    bool isShowHelp() const { return isShowHelp_; }
+
+private:
+    void parse(int argc, char* argv[]) {
+
+        programName_ = argv[0];
+
+        while (1) {
+            int c = ::getopt(argc, argv, "t:a:n:S:vh");
+
+            if (c < 0) { break; }
+
+            switch (c) {
+            case 't': /* threshold */
+                threshold_ = ::atof(optarg);
+                break;
+            case 'a': /* significance level */
+                alpha_ = ::atof(optarg);
+                break;
+            case 'n': /* resamples */
+                nResamples_ = ::atol(optarg);
+                break;
+            case 'S': /* seed */
+                seed_ = ::strtoull(optarg, NULL, 10);
+                break;
+            case 'v': /* show version */
+                isShowVersion_ = true;
+                break;
+            case 'h': /* help */
+                isShowHelp_ = true;
+                break;
+            }
+        }
+
+        while (optind < argc) {
+            args_.push_back(argv[optind++]);
+        }
+    }
+
+    void checkAndThrow() {
+
+        if (args_.size() != 2) {
+            throw std::runtime_error("specify baseline and new result files.");
+        }
+        if (threshold_ < 0) {
+            throw std::runtime_error("threshold (-t) must not be negative.");
+        }
+        if (alpha_ <= 0 || alpha_ >= 1) {
+            throw std::runtime_error("significance level (-a) must be in (0, 1).");
+        }
+        if (nResamples_ < 100) {
+            throw std::runtime_error("resamples (-n) must be 100 or more.");
+        }
+    }
+};
+
+/**
+ * Runs of a result file merged.
+ */
+struct ResultSet
+{
+    size_t nRuns;
+    std::vector<double> iopsSamples;
+    LatencyHistogram hist;
+
+    /**
+     * Per-second IOPS of all the runs are the samples.
+     * The IOPS of each run is used instead if a run has no whole second.
+     */
+    explicit ResultSet(const std::vector<RunResult>& runs)
+        : nRuns(runs.size()), iopsSamples(), hist() {
+
+        for (const RunResult& r : runs) {
+            hist.merge(r.hist);
+            if (r.intervals.empty()) {
+                iopsSamples.push_back(r.getIops());
+                continue;
+            }
+            for (const IntervalSeries::Sample& s : r.intervals) {
+                iopsSamples.push_back(static_cast<double>(s.count));
+            }
+        }
+    }
+
+    void print(const char* name) const {
+
+        ::printf("%s runs %zu samples %zu nio %llu iops %.3f ",
+                 name, nRuns, iopsSamples.size(),
+                 static_cast<unsigned long long>(hist.getCount()), getMean(iopsSamples));
+        hist.print();
+    }
+
+    static double getMean(const std::vector<double>& v) {
+
+        if (v.empty()) { return 0.0; }
+        double total = 0;
+        for (double x : v) { total += x; }
+        return total / v.size();
+    }
+};
+
+/**
+ * Percentile of sorted values with linear interpolation.
+ * @p in [0, 1].
+ */
+double getQuantile(const std::vector<double>& sorted, double p)
+{
+    assert(!sorted.empty());
+    const double pos = p * (sorted.size() - 1);
+    const size_t i = static_cast<size_t>(pos);
+    if (i + 1 >= sorted.size()) { return sorted.back(); }
+    return sorted[i] + (sorted[i + 1] - sorted[i]) * (pos - i);
+}
+
+double getRelativeDelta(double base, double value)
+{
+    return base == 0 ? 0.0 : (value - base) / base * 100.0;
+}
+
+/**
+ * Two-sided Mann-Whitney U test with the normal approximation
+ * and tie correction.
+ * @z filled with the standardized U of b against a.
+ * RETURN:
+ *   p-value.
+ */
+double mannWhitney(const std::vector<double>& a, const std::vector<double>& b, double& z)
+{
+    const size_t n1 = a.size(), n2 = b.size(), n = n1 + n2;
+    z = 0;
+    if (n1 == 0 || n2 == 0) { return 1.0; }
+    std::vector<std::pair<double, bool> > v; /* (value, is b) */
+    for (double x : a) { v.push_back(std::make_pair(x, false)); }
+    for (double x : b) { v.push_back(std::make_pair(x, true)); }
+    std::sort(v.begin(), v.end());
+
+    double rankSum = 0; /* of b. */
+    double tieTerm = 0;
+    size_t i = 0;
+    while (i < n) {
+        size_t j = i;
+        while (j < n && v[j].first == v[i].first) { j++; }
+        const double rank = (i + 1 + j) / 2.0;
+        for (size_t k = i; k < j; k++) {
+            if (v[k].second) { rankSum += rank; }
+        }
+        const double t = j - i;
+        tieTerm += t * t * t - t;
+        i = j;
+    }
+    const double u = rankSum - n2 * (n2 + 1) / 2.0;
+    const double mean = n1 * n2 / 2.0;
+    const double var = n1 * n2 / 12.0 * ((n + 1) - tieTerm / (n * (n - 1.0)));
+    if (var <= 0) { return 1.0; }
+    z = (u - mean) / ::sqrt(var);
+    return ::erfc(::fabs(z) / ::sqrt(2.0));
+}
+
+/**
+ * Confidence interval of a delta [%].
+ */
+struct DeltaInterval
+{
+    double delta;
+    double lower;
+    double upper;
+
+    bool isAbove(double threshold) const { return lower > 0 && delta > threshold; }
+    bool isBelow(double threshold) const { return upper < 0 && delta < -threshold; }
+};
+
+/**
+ * Bootstrap the relative delta of mean IOPS.
+ */
+DeltaInterval bootstrapIops(const std::vector<double>& a, const std::vector<double>& b,
+                            const Options& opt, std::mt19937_64& rand)
+{
+    DeltaInterval ret;
+    ret.delta = getRelativeDelta(ResultSet::getMean(a), ResultSet::getMean(b));
+    ret.lower = ret.upper = ret.delta;
+    if (a.empty() || b.empty()) { return ret; }
+
+    std::uniform_int_distribution<size_t> distA(0, a.size() - 1), distB(0, b.size() - 1);
+    std::vector<double> deltas;
+    deltas.reserve(opt.getNresamples());
+    for (size_t i = 0; i < opt.getNresamples(); i++) {
+        double totalA = 0, totalB = 0;
+        for (size_t j = 0; j < a.size(); j++) { totalA += a[distA(rand)]; }
+        for (size_t j = 0; j < b.size(); j++) { totalB += b[distB(rand)]; }
+        deltas.push_back(getRelativeDelta(totalA / a.size(), totalB / b.size()));
+    }
+    std::sort(deltas.begin(), deltas.end());
+    ret.lower = getQuantile(deltas, opt.getAlpha() / 2);
+    ret.upper = getQuantile(deltas, 1 - opt.getAlpha() / 2);
+    return ret;
+}
+
+/**
+ * Resolution of LatencyHistogram [second].
+ * Latency below it is regarded as it to get a finite relative delta.
+ */
+const double LATENCY_RESOLUTION = 0.000000001;
+
+/**
+ * Resampled percentile of a histogram.
+ * The rank of the percentile of a resample of n IOs
+ * follows Binomial(n, p), approximated by the normal distribution.
+ * @p in [0, 100].
+ */
+double resamplePercentile(const LatencyHistogram& hist, double p, double z)
+{
+    const double n = static_cast<double>(hist.getCount());
+    const double q = p / 100.0;
+    double rank = n * q + z * ::sqrt(n * q * (1 - q));
+    rank = std::max(1.0, std::min(n, ::ceil(rank)));
+    return std::max(LATENCY_RESOLUTION, hist.getValueAtRank(static_cast<uint64_t>(rank)));
+}
+
+/**
+ * Bootstrap the relative delta of a percentile.
+ */
+DeltaInterval bootstrapPercentile(const LatencyHistogram& a, const LatencyHistogram& b,
+                                  double p, const Options& opt, std::mt19937_64& rand)
+{
+    DeltaInterval ret;
+    ret.delta = getRelativeDelta(std::max(LATENCY_RESOLUTION, a.getPercentile(p)),
+                                 std::max(LATENCY_RESOLUTION, b.getPercentile(p)));
+    ret.lower = ret.upper = ret.delta;
+    if (a.getCount() == 0 || b.getCount() == 0) { return ret; }
+
+    std::normal_distribution<double> normal;
+    std::vector<double> deltas;
+    deltas.reserve(opt.getNresamples());
+    for (size_t i = 0; i < opt.getNresamples(); i++) {
+        const double va = resamplePercentile(a, p, normal(rand));
+        const double vb = resamplePercentile(b, p, normal(rand));
+        deltas.push_back(getRelativeDelta(va, vb));
+    }
+    std::sort(deltas.begin(), deltas.end());
+    ret.lower = getQuantile(deltas, opt.getAlpha() / 2);
+    ret.upper = getQuantile(deltas, 1 - opt.getAlpha() / 2);
+    return ret;
+}
+
+/**
+ * RETURN:
+ *   true if a regression is found.
+ */
+bool compare(const Options& opt)
+{
+    const std::vector<RunResult> baseRuns = RunResult::load(opt.getArgs()[0]);
+    const std::vector<RunResult> newRuns = RunResult::load(opt.getArgs()[1]);
+    if (baseRuns.empty() || newRuns.empty()) {
+        throw std::runtime_error("no result in a file.");
+    }
+    const ResultSet base(baseRuns);
+    const ResultSet next(newRuns);
+    base.print("base");
+    next.print("new");
+
+    std::mt19937_64 rand(opt.getSeed());
+    const double threshold = opt.getThreshold();
+    bool isRegression = false;
+    bool isImprovement = false;
+
+    const DeltaInterval iops = bootstrapIops(base.iopsSamples, next.iopsSamples, opt, rand);
+    double z;
+    const double pValue = mannWhitney(base.iopsSamples, next.iopsSamples, z);
+    const bool isSignificant = pValue < opt.getAlpha();
+    ::printf("iops base %.3f new %.3f delta %.3f%% ci %.3f%% %.3f%% "
+             "mann-whitney z %.3f p %.06f\n",
+             ResultSet::getMean(base.iopsSamples), ResultSet::getMean(next.iopsSamples),
+             iops.delta, iops.lower, iops.upper, z, pValue);
+    isRegression |= isSignificant && iops.isBelow(threshold);
+    isImprovement |= isSignificant && iops.isAbove(threshold);
+
+    const double percentiles[] = {50, 99, 99.9};
+    for (double p : percentiles) {
+        const DeltaInterval d = bootstrapPercentile(base.hist, next.hist, p, opt, rand);
+        ::printf("p%g base %.06f new %.06f delta %.3f%% ci %.3f%% %.3f%%\n",
+                 p, base.hist.getPercentile(p), next.hist.getPercentile(p),
+                 d.delta, d.lower, d.upper);
+        isRegression |= d.isAbove(threshold);
+        isImprovement |= d.isBelow(threshold);
+    }
+
+    const char* verdict = "no-change";
+    if (isRegression) {
+        verdict = "regression";
+    } else if (isImprovement) {
+        verdict = "improvement";
+    }
+    ::printf("verdict %s threshold %.3f%% alpha %.3f\n", verdict, threshold, opt.getAlpha());
+    return isRegression;
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        Options opt(argc, argv);
+
+        if (opt.isShowVersion()) {
+            opt.showVersion();
+        } else if (opt.isShowHelp()) {
+            opt.showHelp();
+        } else if (compare(opt)) {
+            return 1;
+        }
+    } catch (const std::runtime_error& e) {
+        ::printf("error: %s\n", e.what());
+        return 2;
+    } catch (...) {
+        ::printf("caught another error.\n");
+        return 2;
+    }
+
+    return 0;
+}
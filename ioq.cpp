@@ -0,0 +1,303 @@
+/**
+ * @file
+ * @brief Query and aggregate a results store appended by iores and ioth -Q.
+ *
+ * The output is a table whose first line is a header starting with '#',
+ * the format made by scripts/analyze.sh and read by scripts/csvlike.py.
+ */
+#include <vector>
+#include <string>
+#include <sstream>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+
+#include <unistd.h>
+
+#include "ioreth.hpp"
+#include "store.hpp"
+
+class Options
+{
+private:
+    std::string programName_;
+    std::vector<std::string> args_;
+    std::vector<std::string> conds_;
+    std::vector<std::string> groupCols_;
+    std::vector<std::string> valueCols_;
+    std::string aggregate_;
+    bool isShowVersion_;
+    bool isShowHelp_;
+
+public:
+    Options(int argc, char* argv[])
+        : args_()
+        , conds_()
+        , groupCols_({"pattern", "mode", "nThreads", "queueSize", "blockSize"})
+        , valueCols_({"Bps", "iops"})
+        , aggregate_("avg")
+        , isShowVersion_(false)
+        , isShowHelp_(false) {
+
+        parse(argc, argv);
+
+        if (isShowVersion_ || isShowHelp_) {
+            return;
+        }
+        checkAndThrow();
+    }
+
+    void showVersion() {
+
+        ::printf("ioq version %s\n", IORETH_VERSION);
+    }
+
+    void showHelp() {
+
+        ::printf("usage: %s [option(s)] [results store directory]\n"
+                 "options: \n"
+                 "    -w c=v:  select runs whose column c is v like nThreads=4.\n"
+                 "             -w can be specified many times.\n"
+                 "    -g cols: columns to group by separated by comma.\n"
+                 "             default is pattern,mode,nThreads,queueSize,blockSize.\n"
+                 "    -c cols: columns to aggregate separated by comma.\n"
+                 "             default is Bps,iops.\n"
+                 "    -a func: avg, min, max, sum, stddev, or count (default avg).\n"
+                 "    -v:      show version.\n"
+                 "    -h:      show this help.\n"
+                 "columns:\n"
+                 "   ", programName_.c_str());
+        for (size_t i = 0; i < N_STORE_COLUMNS; i++) {
+            ::printf(" %s", STORE_COLUMNS[i].name);
+        }
+        ::printf("\n");
+    }
+
+    const std::vector<std::string>& getArgs() const { return args_; }
+    const std::vector<std::string>& getConds() const { return conds_; }
+    const std::vector<std::string>& getGroupCols() const { return groupCols_; }
+    const std::vector<std::string>& getValueCols() const { return valueCols_; }
+    const std::string& getAggregate() const { return aggregate_; }
+    bool isShowVersion() const { return isShowVersion_; }
+    bool isShowHelp() const { return isShowHelp_; }
+
+private:
+    void parse(int argc, char* argv[]) {
+
+        programName_ = argv[0];
+
+        while (1) {
+            int c = ::getopt(argc, argv, "w:g:c:a:vh");
+
+            if (c < 0) { break; }
+
+            switch (c) {
+            case 'w': /* condition */
+                conds_.push_back(optarg);
+                break;
+            case 'g': /* group columns */
+                groupCols_ = split(optarg);
+                break;
+            case 'c': /* value columns */
+                valueCols_ = split(optarg);
+                break;
+            case 'a': /* aggregate function */
+                aggregate_ = optarg;
+                break;
+            case 'v': /* show version */
+                isShowVersion_ = true;
+                break;
+            case 'h': /* help */
+                isShowHelp_ = true;
+                break;
+            }
+        }
+
+        while (optind < argc) {
+            args_.push_back(argv[optind++]);
+        }
+    }
+
+    static std::vector<std::string> split(const std::string& s) {
+
+        std::vector<std::string> v;
+        std::istringstream ss(s);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            if (!item.empty()) { v.push_back(item); }
+        }
+        return v;
+    }
+
+    void checkAndThrow() {
+
+        if (args_.size() != 1) {
+            throw std::runtime_error("specify a results store directory.");
+        }
+        if (valueCols_.empty()) {
+            throw std::runtime_error("specify columns to aggregate (-c).");
+        }
+        const char* funcs[] = {"avg", "min", "max", "sum", "stddev", "count"};
+        if (std::find(funcs, funcs + 6, aggregate_) == funcs + 6) {
+            throw std::runtime_error("unknown aggregate function (-a): " + aggregate_);
+        }
+    }
+};
+
+/**
+ * Aggregate of a column in a group.
+ */
+struct Aggregate
+{
+    size_t count;
+    double total;
+    double sq;
+    double min;
+    double max;
+
+    Aggregate()
+        : count(0), total(0), sq(0), min(0), max(0) {}
+
+    void add(double v) {
+
+        if (count == 0 || v < min) { min = v; }
+        if (count == 0 || v > max) { max = v; }
+        count++;
+        total += v;
+        sq += v * v;
+    }
+
+    double get(const std::string& func) const {
+
+        if (func == "min") { return min; }
+        if (func == "max") { return max; }
+        if (func == "sum") { return total; }
+        if (func == "count") { return count; }
+        const double avg = total / count;
+        if (func == "stddev") {
+            return count < 2 ? 0.0 : ::sqrt(std::max(0.0, (sq - avg * total) / (count - 1)));
+        }
+        return avg;
+    }
+};
+
+size_t getColumn(const std::string& name)
+{
+    const size_t col = ResultStore::findColumn(name);
+    if (col == N_STORE_COLUMNS) {
+        throw std::runtime_error("unknown column: " + name);
+    }
+    return col;
+}
+
+/**
+ * Count is an integer, and average and stddev are real numbers.
+ * min, max, and sum are formatted as the column.
+ */
+std::string formatAggregate(const std::string& func, size_t col, const Aggregate& agg)
+{
+    const double v = agg.get(func);
+    char buf[64];
+    if (func == "count") {
+        ::snprintf(buf, sizeof(buf), "%zu", agg.count);
+    } else if (func == "avg" || func == "stddev") {
+        ::snprintf(buf, sizeof(buf), "%.06f", v);
+    } else {
+        return ResultStore::format(col, v);
+    }
+    return buf;
+}
+
+void query(const Options& opt)
+{
+    if (::access(opt.getArgs()[0].c_str(), F_OK) < 0) {
+        throw std::runtime_error("no results store: " + opt.getArgs()[0]);
+    }
+    const ResultStore store(opt.getArgs()[0]);
+    const size_t nRows = store.getNrows();
+
+    /* Select rows. */
+    std::vector<bool> isSelected(nRows, true);
+    for (const std::string& cond : opt.getConds()) {
+        const size_t eq = cond.find('=');
+        if (eq == std::string::npos) {
+            throw std::runtime_error("invalid condition: " + cond);
+        }
+        const size_t col = getColumn(cond.substr(0, eq));
+        const double v = ResultStore::encode(col, cond.substr(eq + 1));
+        const std::vector<double> values = store.readColumn(col, nRows);
+        for (size_t i = 0; i < nRows; i++) {
+            if (values[i] != v) { isSelected[i] = false; }
+        }
+    }
+
+    /* Group rows. */
+    std::vector<size_t> groupCols, valueCols;
+    std::vector<std::vector<double> > groupValues, values;
+    for (const std::string& name : opt.getGroupCols()) {
+        groupCols.push_back(getColumn(name));
+        groupValues.push_back(store.readColumn(groupCols.back(), nRows));
+    }
+    for (const std::string& name : opt.getValueCols()) {
+        valueCols.push_back(getColumn(name));
+        values.push_back(store.readColumn(valueCols.back(), nRows));
+    }
+    std::map<std::vector<double>, std::vector<Aggregate> > groups;
+    for (size_t i = 0; i < nRows; i++) {
+        if (!isSelected[i]) { continue; }
+        std::vector<double> key;
+        for (const std::vector<double>& g : groupValues) { key.push_back(g[i]); }
+        std::vector<Aggregate>& aggs = groups[key];
+        aggs.resize(valueCols.size());
+        for (size_t j = 0; j < valueCols.size(); j++) {
+            aggs[j].add(values[j][i]);
+        }
+    }
+
+    /* Print the table. */
+    ::printf("#");
+    std::vector<std::string> names(opt.getGroupCols());
+    names.insert(names.end(), opt.getValueCols().begin(), opt.getValueCols().end());
+    for (size_t i = 0; i < names.size(); i++) {
+        ::printf(i == 0 ? "%s" : " %s", names[i].c_str());
+    }
+    ::printf("\n");
+    for (const auto& g : groups) {
+        for (size_t j = 0; j < groupCols.size(); j++) {
+            ::printf(j == 0 ? "%s" : " %s", ResultStore::format(groupCols[j], g.first[j]).c_str());
+        }
+        for (size_t j = 0; j < valueCols.size(); j++) {
+            ::printf(groupCols.empty() && j == 0 ? "%s" : " %s",
+                     formatAggregate(opt.getAggregate(), valueCols[j], g.second[j]).c_str());
+        }
+        ::printf("\n");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        Options opt(argc, argv);
+
+        if (opt.isShowVersion()) {
+            opt.showVersion();
+        } else if (opt.isShowHelp()) {
+            opt.showHelp();
+        } else {
+            query(opt);
+        }
+    } catch (const std::runtime_error& e) {
+        ::printf("error: %s\n", e.what());
+        return 1;
+    } catch (...) {
+        ::printf("caught another error.\n");
+        return 1;
+    }
+
+    return 0;
+}
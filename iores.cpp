@@ -15,6 +15,9 @@
 #include <algorithm>
 #include <future>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <memory>
 #include <exception>
 #include <limits>
 
@@ -26,14 +29,22 @@
 
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
 #include <fcntl.h>
 
 #include "ioreth.hpp"
 #include "util.hpp"
 #include "rand.hpp"
+#include "trace.hpp"
+#include "io_engine.hpp"
+#include "workload.hpp"
+#include "result.hpp"
+#include "store.hpp"
 
 class Options
 {
@@ -52,6 +63,58 @@ private:
     size_t nthreads_;
     size_t queueSize_;
 
+    std::string traceFile_;
+    std::string traceFormat_;
+    double speed_;
+
+    std::string opMix_;
+    size_t discardSize_;
+
+    bool isDirect_;
+    bool isDropCache_;
+
+    bool isMmap_;
+    std::string madvise_;
+    bool isPopulate_;
+    bool isMsync_;
+
+    bool isPoll_;
+    size_t pollBudget_;
+    bool isPhaseTracking_;
+
+    size_t nClients_;
+    size_t thinkTimeUs_;
+
+    size_t sloUs_;
+    size_t maxConcurrency_;
+
+    uint64_t seed_;
+    bool hasSeed_;
+    bool isPermutation_;
+
+    uint64_t windowBegin_;
+    uint64_t windowEnd_;
+    size_t misalign_;
+    IoWindow window_;
+
+    size_t nProcs_;
+    bool isCountCycles_;
+
+    bool isDiskStats_;
+    size_t diskInterval_;
+
+    std::string resultFile_;
+
+    size_t nRepeats_;
+    double repeatGap_;
+
+    std::string storeDir_;
+
+    std::string tailTrigger_;
+    size_t tailContext_;
+
+    size_t depthIntervalUs_;
+
 public:
     Options(int argc, char* argv[])
         : accessRange_(0)
@@ -64,9 +127,49 @@ public:
         , period_(0)
         , count_(0)
         , nthreads_(1)
-        , queueSize_(1) {
+        , queueSize_(1)
+        , traceFile_()
+        , traceFormat_()
+        , speed_(1.0)
+        , opMix_()
+        , discardSize_(0)
+        , isDirect_(true)
+        , isDropCache_(false)
+        , isMmap_(false)
+        , madvise_("normal")
+        , isPopulate_(false)
+        , isMsync_(false)
+        , isPoll_(false)
+        , pollBudget_(0)
+        , isPhaseTracking_(false)
+        , nClients_(0)
+        , thinkTimeUs_(0)
+        , sloUs_(0)
+        , maxConcurrency_(256)
+        , seed_(0)
+        , hasSeed_(false)
+        , isPermutation_(false)
+        , windowBegin_(0)
+        , windowEnd_(0)
+        , misalign_(0)
+        , window_(0, 0, 0)
+        , nProcs_(0)
+        , isCountCycles_(false)
+        , isDiskStats_(false)
+        , diskInterval_(0)
+        , resultFile_()
+        , nRepeats_(1)
+        , repeatGap_(0)
+        , storeDir_()
+        , tailTrigger_()
+        , tailContext_(16)
+        , depthIntervalUs_(0) {
 
         parse(argc, argv);
+        window_ = IoWindow(windowBegin_, windowEnd_, misalign_);
+        if (!hasSeed_) {
+            seed_ = getRandomSeed();
+        }
 
         if (isShowVersion_ || isShowHelp_) {
             return;
@@ -83,18 +186,109 @@ public:
 
         ::printf("usage: %s [option(s)] [file or device]\n"
                  "options: \n"
-                 "    -s size: access range in blocks.\n"
+                 "    -s size: access range in blocks from the window start.\n"
+                 "             every IO must fit in the window.\n"
                  "    -b size: blocksize in bytes.\n"
+                 "    -O oft:  start of the window to access in bytes.\n"
+                 "    -E oft:  end of the window to access in bytes.\n"
+                 "             default is the end of the device.\n"
+                 "    -A oft:  add oft bytes to each offset for misaligned IO.\n"
+                 "             it must be a multiple of the direct IO\n"
+                 "             alignment unless -B.\n"
                  "    -p secs: execute period in seconds.\n"
                  "    -c num:  number of IOs to execute.\n"
                  "             -p and -c is exclusive.\n"
+                 "    -u:      visit each block of the access range once\n"
+                 "             in a random permutation instead of\n"
+                 "             random IO with replacement.\n"
+                 "             the range is split among threads or -U threads,\n"
+                 "             and the run ends when it is covered\n"
+                 "             unless -p or -c is reached before.\n"
                  "    -w:      write instead read.\n"
                  "    -m:      read/write mix instead read.\n"
                  "             -w and -m is exclusive.\n"
+                 "    -o r:w:d:z: ratio of read, write, discard, and zero.\n"
+                 "             like 70:20:10:0. -w and -m are ignored.\n"
+                 "    -k size: discard and zero size in bytes.\n"
+                 "             default is the blocksize.\n"
+                 "             it must fit in the window, and by default\n"
+                 "             the access range ends where it still fits.\n"
                  "    -t num:  number of threads in parallel.\n"
                  "             if 0, use aio instead thread.\n"
                  "    -q size: queue size per thread.\n"
                  "             this is meaningfull with -t 0.\n"
+                 "    -N num:  fork num worker processes instead of threads.\n"
+                 "             each process runs a worker of -t 1 or -t 0,\n"
+                 "             and statistics are merged through shared memory.\n"
+                 "    -T file: replay a trace file instead of random IO.\n"
+                 "             -b is the block size of iolog format\n"
+                 "             and the maximum IO size.\n"
+                 "             -c limits the number of records and\n"
+                 "             -p limits the replay period.\n"
+                 "    -F fmt:  trace format: iolog, csv, or bin.\n"
+                 "             default is guessed by the file suffix.\n"
+                 "    -x rate: replay speed factor (default 1.0).\n"
+                 "             if 0, replay as fast as possible.\n"
+                 "    -B:      buffered IO instead of direct IO.\n"
+                 "             page cache residency is printed and\n"
+                 "             read latency is classified into hit and miss.\n"
+                 "    -d:      drop page cache of the target before run.\n"
+                 "             this is meaningfull with -B.\n"
+                 "    -M:      access the target through mmap instead of read/write.\n"
+                 "             page faults of each IO are counted.\n"
+                 "             this is not available with -t 0.\n"
+                 "    -a adv:  madvise advice with -M:\n"
+                 "             normal, random, sequential, or willneed.\n"
+                 "    -P:      map with MAP_POPULATE with -M.\n"
+                 "    -y:      call msync after each write with -M.\n"
+                 "    -U num:  number of closed-loop logical clients.\n"
+                 "             they are multiplexed on -t threads with aio,\n"
+                 "             and statistics of each client are kept.\n"
+                 "    -Z usec: mean think time of a client between IOs.\n"
+                 "             think times are exponentially distributed.\n"
+                 "    -l num:  busy-poll aio completions with -t 0 or -U.\n"
+                 "             num is the polls per wait before blocking.\n"
+                 "             if 0, never block.\n"
+                 "    -e:      show latency of submit, device, and reap phases\n"
+                 "             of each aio with -t 0 or -U.\n"
+                 "             an IO reaped without sleeping is regarded as\n"
+                 "             completed at the last reap that did not return it,\n"
+                 "             so device is a lower bound and reap an upper bound.\n"
+                 "    -K usec: search the saturation knee under a p99 SLO.\n"
+                 "             concurrency is doubled, then bisected.\n"
+                 "             it is the queue size with -t 0,\n"
+                 "             or the number of threads otherwise.\n"
+                 "             each point is measured for -p seconds\n"
+                 "             after a warmup of a second.\n"
+                 "    -L num:  maximum concurrency with -K (default 256).\n"
+                 "    -S seed: seed of random offsets to reproduce a run.\n"
+                 "             default is random, and printed.\n"
+                 "    -D sec:  sample block-layer statistics of the device\n"
+                 "             backing the target every sec seconds,\n"
+                 "             and at start and end of the run.\n"
+                 "             if 0, only at start and end.\n"
+                 "    -R file: append the result to file for iocmp.\n"
+                 "             repeated runs with a file make a result set.\n"
+                 "    -n num:  repeat the run num times (default 1).\n"
+                 "             repetition i uses seed -S plus i.\n"
+                 "             mean, stddev, and 95%% confidence interval\n"
+                 "             of the repetitions are printed,\n"
+                 "             and outliers are flagged with 5 repetitions or more.\n"
+                 "    -g secs: idle gap between repetitions in seconds.\n"
+                 "    -Q dir:  append the result of each run to the results store\n"
+                 "             in dir, which is queried by ioq.\n"
+                 "    -X trig: capture IOs slower than trig with the IOs\n"
+                 "             completed before them, and print them in time order.\n"
+                 "             trig is a threshold in usec like 200000,\n"
+                 "             or a running percentile of each worker like p99.9.\n"
+                 "             this is not available with -N or -K.\n"
+                 "    -Y num:  IOs of all workers recorded before each\n"
+                 "             captured IO with -X (default 16).\n"
+                 "    -I usec: sample the number of IOs in flight every usec,\n"
+                 "             and compare the mean with IOPS times mean latency\n"
+                 "             by Little's law. this is not available with -N or -K.\n"
+                 "    -C:      count CPU cycles of each worker by perf_event_open\n"
+                 "             if permitted.\n"
                  "    -r:      show response of each IO.\n"
                  "    -v:      show version.\n"
                  "    -h:      show this help.\n"
@@ -112,7 +306,117 @@ public:
     size_t getPeriod() const { return period_; }
     size_t getCount() const { return count_; }
     size_t getNthreads() const { return nthreads_; }
+    bool isProcessMode() const { return nProcs_ > 0; }
+    bool isCountCycles() const { return isCountCycles_; }
+    bool isDiskStats() const { return isDiskStats_; }
+    size_t getDiskInterval() const { return diskInterval_; }
+    const std::string& getResultFile() const { return resultFile_; }
+    size_t getNrepeats() const { return nRepeats_; }
+    double getRepeatGap() const { return repeatGap_; }
+    const std::string& getStoreDir() const { return storeDir_; }
+    bool isTailCapture() const { return !tailTrigger_.empty(); }
+    /**
+     * Threshold of -X [second], or 0 for a running percentile.
+     */
+    double getTailThreshold() const {
+        return tailTrigger_[0] == 'p' ? 0.0 : ::atof(tailTrigger_.c_str()) / 1000000.0;
+    }
+    double getTailPercentile() const {
+        return tailTrigger_[0] == 'p' ? ::atof(tailTrigger_.c_str() + 1) : 0.0;
+    }
+    size_t getTailContext() const { return tailContext_; }
+    bool isDepthTracking() const { return depthIntervalUs_ > 0; }
+    size_t getDepthInterval() const { return depthIntervalUs_; }
+    /**
+     * Number of IOs in flight the run is configured to keep.
+     */
+    size_t getTargetDepth() const {
+        if (nClients_ > 0) { return nClients_; }
+        return nthreads_ == 0 ? queueSize_ : nthreads_;
+    }
+    size_t getNprocs() const { return nProcs_; }
+    /**
+     * Number of workers sharing the access range.
+     */
+    size_t getNworkers() const {
+        return nProcs_ > 0 ? nProcs_ : std::max<size_t>(1, nthreads_);
+    }
     size_t getQueueSize() const { return queueSize_; }
+    bool isReplay() const { return !traceFile_.empty(); }
+    const std::string& getTraceFile() const { return traceFile_; }
+    TraceFormat getTraceFormat() const {
+        return traceFormat_.empty() ? guessTraceFormat(traceFile_)
+            : parseTraceFormat(traceFormat_);
+    }
+    double getSpeed() const { return speed_; }
+    OpMix getOpMix() const {
+        return opMix_.empty() ? OpMix(mode_) : OpMix(opMix_);
+    }
+    size_t getDiscardSize() const {
+        return discardSize_ == 0 ? blockSize_ : discardSize_;
+    }
+    /* The largest IO the op mix issues [byte]. */
+    size_t getMaxIoSize() const {
+        const OpMix opMix = getOpMix();
+        if (opMix.has(DISCARD_OP) || opMix.has(ZERO_OP)) {
+            return std::max(blockSize_, getDiscardSize());
+        }
+        return blockSize_;
+    }
+    bool isDirect() const { return isDirect_ && !isMmap_; }
+    bool isDropCache() const { return isDropCache_; }
+    bool isMmap() const { return isMmap_; }
+    int getMadvise() const { return parseMadvise(madvise_); }
+    bool isPopulate() const { return isPopulate_; }
+    bool isMsync() const { return isMsync_; }
+    bool isPoll() const { return isPoll_; }
+    size_t getPollBudget() const { return pollBudget_; }
+    bool isPhaseTracking() const { return isPhaseTracking_; }
+    bool isClientMode() const { return nClients_ > 0; }
+    size_t getNclients() const { return nClients_; }
+    double getThinkTime() const { return static_cast<double>(thinkTimeUs_) / 1000000.0; }
+    bool isKneeSearch() const { return sloUs_ > 0; }
+    double getSlo() const { return static_cast<double>(sloUs_) / 1000000.0; }
+    size_t getMaxConcurrency() const { return maxConcurrency_; }
+    uint64_t getSeed() const { return seed_; }
+    void setSeed(uint64_t seed) { seed_ = seed; }
+    bool isPermutation() const { return isPermutation_; }
+    const IoWindow& getWindow() const { return window_; }
+
+    /**
+     * Resolve and check the window for the target device.
+     */
+    void resolveWindow(const BlockDevice& bd) {
+
+        window_.resolve(bd, blockSize_, isDirect());
+        if (getMaxIoSize() > window_.getSize()) {
+            throw std::runtime_error("discard size (-k) exceeds the window.");
+        }
+        if (accessRange_ > 0 &&
+            (accessRange_ - 1) * blockSize_ + getMaxIoSize() > window_.getSize()) {
+            throw std::runtime_error("access range (-s) exceeds the window.");
+        }
+        const OpMix opMix = getOpMix();
+        const size_t lbs = bd.getLogicalBlockSize();
+        if ((opMix.has(DISCARD_OP) || opMix.has(ZERO_OP)) &&
+            (getDiscardSize() % lbs != 0 || blockSize_ % lbs != 0 ||
+             window_.getBase() % lbs != 0)) {
+            std::stringstream ss;
+            ss << "discard and zero require the discard size (-k), the blocksize (-b), "
+               << "and the window start aligned to the logical block size " << lbs << ".";
+            throw std::runtime_error(ss.str());
+        }
+    }
+
+    /**
+     * Access range in blocks from the window start.
+     * Any IO starting in the range fits in the window.
+     */
+    size_t getWindowAccessRange() const {
+
+        if (accessRange_ > 0) { return accessRange_; }
+        return (window_.getSize() - getMaxIoSize()) / blockSize_ + 1;
+    }
 
 private:
     void parse(int argc, char* argv[]) {
@@ -120,7 +424,7 @@ private:
         programName_ = argv[0];
         
         while (1) {
-            int c = ::getopt(argc, argv, "s:b:p:c:t:q:wmrvh");
+            int c = ::getopt(argc, argv, "s:b:p:c:t:q:T:F:x:o:k:a:l:U:Z:K:L:S:O:E:A:N:D:R:n:g:Q:X:Y:I:wmBdMPyeuCrvh");
 
             if (c < 0) { break; }
 
@@ -143,12 +447,111 @@ private:
             case 'm': /* mix */
                 mode_ = MIX_MODE;
                 break;
+            case 'o': /* op mix */
+                opMix_ = optarg;
+                break;
+            case 'k': /* discard size */
+                discardSize_ = ::atol(optarg);
+                break;
             case 't': /* nthreads */
                 nthreads_ = ::atol(optarg);
                 break;
             case 'q':
                 queueSize_ = ::atol(optarg);
                 break;
+            case 'T': /* trace file to replay */
+                traceFile_ = optarg;
+                break;
+            case 'F': /* trace format */
+                traceFormat_ = optarg;
+                break;
+            case 'x': /* replay speed */
+                speed_ = ::atof(optarg);
+                break;
+            case 'B': /* buffered IO */
+                isDirect_ = false;
+                break;
+            case 'd': /* drop page cache */
+                isDropCache_ = true;
+                break;
+            case 'M': /* mmap */
+                isMmap_ = true;
+                break;
+            case 'a': /* madvise advice */
+                madvise_ = optarg;
+                break;
+            case 'P': /* MAP_POPULATE */
+                isPopulate_ = true;
+                break;
+            case 'y': /* msync */
+                isMsync_ = true;
+                break;
+            case 'l': /* busy-poll */
+                isPoll_ = true;
+                pollBudget_ = ::atol(optarg);
+                break;
+            case 'e': /* latency phases */
+                isPhaseTracking_ = true;
+                break;
+            case 'U': /* logical clients */
+                nClients_ = ::atol(optarg);
+                break;
+            case 'Z': /* think time */
+                thinkTimeUs_ = ::atol(optarg);
+                break;
+            case 'K': /* latency SLO of knee search */
+                sloUs_ = ::atol(optarg);
+                break;
+            case 'L': /* max concurrency of knee search */
+                maxConcurrency_ = ::atol(optarg);
+                break;
+            case 'D': /* block-layer statistics */
+                isDiskStats_ = true;
+                diskInterval_ = ::atol(optarg);
+                break;
+            case 'R': /* result file */
+                resultFile_ = optarg;
+                break;
+            case 'n': /* repetitions */
+                nRepeats_ = ::atol(optarg);
+                break;
+            case 'g': /* gap between repetitions */
+                repeatGap_ = ::atof(optarg);
+                break;
+            case 'Q': /* results store */
+                storeDir_ = optarg;
+                break;
+            case 'X': /* tail capture trigger */
+                tailTrigger_ = optarg;
+                break;
+            case 'Y': /* tail capture context */
+                tailContext_ = ::atol(optarg);
+                break;
+            case 'I': /* depth tracking */
+                depthIntervalUs_ = ::atol(optarg);
+                break;
+            case 'C': /* count cycles */
+                isCountCycles_ = true;
+                break;
+            case 'N': /* worker processes */
+                nProcs_ = ::atol(optarg);
+                break;
+            case 'O': /* window start */
+                windowBegin_ = ::strtoull(optarg, NULL, 10);
+                break;
+            case 'E': /* window end */
+                windowEnd_ = ::strtoull(optarg, NULL, 10);
+                break;
+            case 'A': /* misalignment */
+                misalign_ = ::atol(optarg);
+                break;
+            case 'u': /* permutation */
+                isPermutation_ = true;
+                break;
+            case 'S': /* random seed */
+                seed_ = ::strtoull(optarg, NULL, 10);
+                hasSeed_ = true;
+                break;
             case 'r': /* show each response */
                 isShowEachResponse_ = true;
                 break;
@@ -171,9 +574,92 @@ private:
         if (args_.size() != 1 || blockSize_ == 0) {
             throw std::runtime_error("specify blocksize (-b), and device.");
         }
-        if (period_ == 0 && count_ == 0) {
+        if (period_ == 0 && count_ == 0 && traceFile_.empty() && !isPermutation_) {
             throw std::runtime_error("specify period (-p) or count (-c).");
         }
+        if (speed_ < 0) {
+            throw std::runtime_error("replay speed (-x) must not be negative.");
+        }
+        if (!traceFile_.empty()) {
+            getTraceFormat(); /* may throw. */
+        }
+        if (!opMix_.empty()) {
+            /* Open the device with write permission if required. */
+            mode_ = OpMix(opMix_).isReadOnly() ? READ_MODE : MIX_MODE;
+        }
+        if (isMmap_ && nthreads_ == 0) {
+            throw std::runtime_error("mmap (-M) is not available with -t 0.");
+        }
+        parseMadvise(madvise_); /* may throw. */
+        if (nClients_ > 0) {
+            if (nthreads_ == 0 || nClients_ < nthreads_) {
+                throw std::runtime_error("clients (-U) must be as many as threads (-t) or more.");
+            }
+            if (!traceFile_.empty() || isMmap_) {
+                throw std::runtime_error("clients (-U) is not available with -T or -M.");
+            }
+        }
+        if (sloUs_ > 0) {
+            if (period_ == 0) {
+                throw std::runtime_error("knee search (-K) requires period (-p).");
+            }
+            if (!traceFile_.empty() || isMmap_ || nClients_ > 0) {
+                throw std::runtime_error("knee search (-K) is not available with -T, -M, or -U.");
+            }
+            if (maxConcurrency_ == 0) {
+                throw std::runtime_error("max concurrency (-L) must be 1 or more.");
+            }
+        }
+        if (nProcs_ > 0) {
+            if (nthreads_ > 1) {
+                throw std::runtime_error("processes (-N) run a worker each with -t 1 or -t 0.");
+            }
+            if (!traceFile_.empty() || nClients_ > 0 || sloUs_ > 0 || isShowEachResponse_) {
+                throw std::runtime_error("processes (-N) are not available with -T, -U, -K, or -r.");
+            }
+            if (isMmap_ && nthreads_ == 0) {
+                throw std::runtime_error("mmap (-M) is not available with -t 0.");
+            }
+        }
+        if (nRepeats_ == 0) {
+            throw std::runtime_error("repetitions (-n) must be 1 or more.");
+        }
+        if (repeatGap_ < 0) {
+            throw std::runtime_error("repetition gap (-g) must not be negative.");
+        }
+        if (nRepeats_ > 1 && sloUs_ > 0) {
+            throw std::runtime_error("repetitions (-n) are not available with -K.");
+        }
+        if ((!resultFile_.empty() || !storeDir_.empty()) && sloUs_ > 0) {
+            throw std::runtime_error("results (-R and -Q) are not available with -K.");
+        }
+        if (!tailTrigger_.empty()) {
+            if (nProcs_ > 0 || sloUs_ > 0) {
+                throw std::runtime_error("tail capture (-X) is not available with -N or -K.");
+            }
+            const double p = getTailPercentile();
+            if (tailTrigger_[0] == 'p' ? !(0 < p && p < 100) : getTailThreshold() <= 0) {
+                throw std::runtime_error("tail capture (-X) must be usec or a percentile like p99.9.");
+            }
+            if (tailContext_ == 0) {
+                throw std::runtime_error("tail capture context (-Y) must be 1 or more.");
+            }
+        }
+        if (depthIntervalUs_ > 0 && (nProcs_ > 0 || sloUs_ > 0)) {
+            throw std::runtime_error("depth tracking (-I) is not available with -N or -K.");
+        }
+        if (isDiskStats_ && sloUs_ > 0) {
+            throw std::runtime_error("block-layer statistics (-D) are not available with -K.");
+        }
+        if (isPermutation_ && (!traceFile_.empty() || sloUs_ > 0)) {
+            throw std::runtime_error("permutation (-u) is not available with -T or -K.");
+        }
+        if (isPoll_ && nthreads_ != 0 && nClients_ == 0) {
+            throw std::runtime_error("busy-poll (-l) is available only with -t 0 or -U.");
+        }
+        if (isPhaseTracking_ && (sloUs_ > 0 || (nthreads_ != 0 && nClients_ == 0))) {
+            throw std::runtime_error("latency phases (-e) are available only with -t 0 or -U.");
+        }
         if (nthreads_ == 0 && queueSize_ == 0) {
             throw std::runtime_error("queue size (-q) must be 1 or more when -t 0.");
         }
@@ -181,165 +667,329 @@ private:
 };
 
 /**
- * Single-threaded io response benchmark.
+ * Block-layer statistics of the device backing the target,
+ * sampled at start and stop of a run, and each interval between them
+ * by a background thread.
  */
-class IoResponseBench
+class DiskMonitor
 {
 private:
-    const int threadId_;
-    BlockDevice& dev_;
-    size_t blockSize_;
-    size_t accessRange_;
-    void* bufV_;
-    char* buf_;
-    std::queue<IoLog>& rtQ_;
-    PerformanceStatistics& stat_;
-    bool isShowEachResponse_;
-    XorShift128 rand_;
+    const dev_t dev_;
+    const size_t interval_; /* [second] */
+    DiskStats begin_;
+    DiskStats end_;
+    double beginTime_;
+    double endTime_;
+    std::thread th_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool isStopped_;
 
-    std::mutex& mutex_; //shared among threads.
-    
 public:
     /**
-     * @param dev block device.
-     * @param bs block size.
-     * @param accessRange in blocks.
+     * @interval sampling interval [second]. 0 means no interval sampling.
      */
-    IoResponseBench(int threadId, BlockDevice& dev, size_t blockSize,
-                    size_t accessRange, std::queue<IoLog>& rtQ,
-                    PerformanceStatistics& stat,
-                    bool isShowEachResponse, std::mutex& mutex)
-        : threadId_(threadId)
-        , dev_(dev)
-        , blockSize_(blockSize)
-        , accessRange_(calcAccessRange(accessRange, blockSize, dev))
-        , bufV_(nullptr)
-        , buf_(nullptr)
-        , rtQ_(rtQ)
-        , stat_(stat)
-        , isShowEachResponse_(isShowEachResponse)
-        , rand_(getSeed())
-        , mutex_(mutex) {
-#if 0
-        ::printf("blockSize %zu accessRange %zu isShowEachResponse %d\n",
-                 blockSize_, accessRange_, isShowEachResponse_);
-#endif
-        size_t alignSize = 512;
-        while (alignSize < blockSize_) {
-            alignSize *= 2;
-        }
-        if(::posix_memalign(&bufV_, alignSize, blockSize_) != 0) {
-            throw std::runtime_error("posix_memalign failed");
-        }
-        buf_ = static_cast<char*>(bufV_);
-        
-        for (size_t i = 0; i < blockSize_; i++) {
-            buf_[i] = static_cast<char>(rand_.get(256));
-        }
-    }
-    ~IoResponseBench() {
+    DiskMonitor(dev_t dev, size_t interval)
+        : dev_(dev)
+        , interval_(interval)
+        , begin_()
+        , end_()
+        , beginTime_(0)
+        , endTime_(0)
+        , th_()
+        , mutex_()
+        , cv_()
+        , isStopped_(false) {}
 
-        ::free(bufV_);
-    }
-    void execNtimes(size_t n) {
+    ~DiskMonitor() noexcept {
 
-        for (size_t i = 0; i < n; i++) {
-            IoLog log = execBlockIO();
-            if (isShowEachResponse_) { rtQ_.push(log); }
-            stat_.updateRt(log.response);
+        try {
+            stop();
+        } catch (...) {
         }
-        putStat();
     }
-    void execNsecs(size_t n) {
 
-        double begin, end;
-        begin = getTime(); end = begin;
+    DiskMonitor(const DiskMonitor&) = delete;
+    DiskMonitor& operator=(const DiskMonitor&) = delete;
 
-        while (end - begin < static_cast<double>(n)) {
+    void start() {
 
-            IoLog log = execBlockIO();
-            if (isShowEachResponse_) { rtQ_.push(log); }
-            stat_.updateRt(log.response);
-            end = getTime();
+        if (!DiskStats::get(dev_, begin_)) {
+            throw std::runtime_error("failed to read block-layer statistics.");
+        }
+        beginTime_ = getTime();
+        endTime_ = 0;
+        isStopped_ = false;
+        if (interval_ > 0) {
+            th_ = std::thread([this] { sampleEachInterval(); });
         }
-        putStat();
     }
-    
-private:
-    /**
-     * @return response time.
-     */
-    IoLog execBlockIO() {
-        
-        double begin, end;
-        size_t blockId = rand_.get(accessRange_);
-        size_t oft = blockId * blockSize_;
-        begin = getTime();
-        bool isWrite = false;
-        
-        switch(dev_.getMode()) {
-        case READ_MODE:  isWrite = false; break;
-        case WRITE_MODE: isWrite = true; break;
-        case MIX_MODE:   isWrite = (rand_.get(2) == 0); break;
+
+    void stop() {
+
+        if (th_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lk(mutex_);
+                isStopped_ = true;
+            }
+            cv_.notify_one();
+            th_.join();
         }
-        
-        if (isWrite) {
-            dev_.write(oft, blockSize_, buf_);
-        } else {
-            dev_.read(oft, blockSize_, buf_);
+        if (beginTime_ > 0 && endTime_ == 0) {
+            DiskStats::get(dev_, end_);
+            endTime_ = getTime();
         }
-        end = getTime();
-        return IoLog(threadId_, isWrite, blockId, begin, end - begin);
     }
 
-    void putStat() const {
-        std::lock_guard<std::mutex> lk(mutex_);
+    /**
+     * Print statistics of the run next to the application view.
+     * @stat latency observed by the application.
+     */
+    void print(const PerformanceStatistics& stat) const {
 
-        ::printf("id %d ", threadId_);
-        stat_.print();
+        const DiskStats d = end_ - begin_;
+        printDiskStats("disk", dev_, d, endTime_ - beginTime_);
+        const double app = stat.getCount() == 0 ? 0.0 : stat.getAverage();
+        ::printf("disk latency app %.06f device %.06f gap %.06f\n",
+                 app, d.getAwait(), app - d.getAwait());
     }
 
-    uint32_t getSeed() const {
+private:
+    void sampleEachInterval() {
 
-        Rand<uint32_t, std::uniform_int_distribution<uint32_t> >
-            rand(0, std::numeric_limits<uint32_t>::max());
-        return rand.get();
+        DiskStats prev = begin_;
+        double prevTime = beginTime_;
+        std::unique_lock<std::mutex> lk(mutex_);
+        while (!cv_.wait_for(lk, std::chrono::seconds(interval_), [this] { return isStopped_; })) {
+            DiskStats cur;
+            if (!DiskStats::get(dev_, cur)) { continue; }
+            const double curTime = getTime();
+            printDiskStats("disk-interval", dev_, cur - prev, curTime - prevTime);
+            prev = cur;
+            prevTime = curTime;
+        }
     }
 };
 
-void do_work(int threadId, const Options& opt,
-             std::queue<IoLog>& rtQ, PerformanceStatistics& stat,
-             std::mutex& mutex)
+/**
+ * Create a monitor of the device backing the target if -D is specified.
+ * @return nullptr if not specified or the device has no statistics.
+ */
+std::unique_ptr<DiskMonitor> createDiskMonitor(const Options& opt, dev_t dev)
 {
-    const bool isDirect = true;
+    if (!opt.isDiskStats()) {
+        return nullptr;
+    }
+    DiskStats st;
+    if (!DiskStats::get(dev, st)) {
+        ::printf("disk not available\n");
+        return nullptr;
+    }
+    return std::unique_ptr<DiskMonitor>(new DiskMonitor(dev, opt.getDiskInterval()));
+}
 
-    BlockDevice bd(opt.getArgs()[0], opt.getMode(), isDirect);
-    
-    IoResponseBench bench(threadId, bd, opt.getBlockSize(), opt.getAccessRange(),
-                          rtQ, stat, opt.isShowEachResponse(), mutex);
+/**
+ * Results of a worker.
+ */
+struct WorkerResult
+{
+    IoRecorder recorder;
+    CacheHitStatistics cacheStats;
+    FaultStatistics faultStats;
+    IoPhaseStatistics phaseStats;
+    WorkerCpu cpu;
+    size_t nSkipped;
+
+    WorkerResult(unsigned int threadId, const Options& opt)
+        : recorder(threadId, opt.getBlockSize(), opt.isShowEachResponse())
+        , cacheStats()
+        , faultStats()
+        , phaseStats()
+        , cpu()
+        , nSkipped(0) {}
+};
+
+/**
+ * Run a worker and measure CPU usage of the calling thread.
+ */
+template<typename F>
+void measure_worker_cpu(const Options& opt, WorkerResult& result, F f)
+{
+    std::unique_ptr<CycleCounter> counter;
+    if (opt.isCountCycles()) {
+        counter.reset(new CycleCounter());
+    }
+    const bool hasCycles = counter && counter->isAvailable();
+    const uint64_t cycles = hasCycles ? counter->get() : 0;
+    const CpuTime cpu = CpuTime::get(RUSAGE_THREAD);
+    f();
+    result.cpu.cpu = CpuTime::get(RUSAGE_THREAD) - cpu;
+    if (hasCycles) {
+        result.cpu.cycles = counter->get() - cycles;
+        result.cpu.hasCycles = true;
+    }
+    result.cpu.nMigrations = result.recorder.getNMigrations();
+}
+
+/**
+ * Print CPU usage of each worker and CPU cost of a run.
+ * @cpu consumed by the run.
+ * @nio number of IOs.
+ * @totalSize read and written [byte].
+ * @period elapsed time [second].
+ */
+void printCpuCost(const Options& opt, const std::vector<WorkerCpu>& workers, const CpuTime& cpu,
+                  size_t nio, size_t totalSize, double period)
+{
+    printWorkerCpuCost(workers, cpu, nio, totalSize, period);
+    if (!opt.isCountCycles()) { return; }
+    uint64_t cycles = 0;
+    bool hasCycles = false;
+    for (const WorkerCpu& w : workers) {
+        cycles += w.cycles;
+        hasCycles |= w.hasCycles;
+    }
+    if (hasCycles) {
+        ::printf("cycles %llu per-io %.1f\n", static_cast<unsigned long long>(cycles),
+                 nio == 0 ? 0.0 : static_cast<double>(cycles) / nio);
+    } else {
+        ::printf("cycles not available\n");
+    }
+}
+
+/**
+ * Random access pattern of a worker in the window.
+ * @stream distinct for each worker.
+ */
+RandomPattern createRandomPattern(const Options& opt, unsigned int stream)
+{
+    return RandomPattern(opt.getBlockSize(), opt.getWindowAccessRange(),
+                         opt.getWindow().getSize(), opt.getOpMix(), opt.getDiscardSize(),
+                         opt.getSeed(), stream);
+}
+
+/**
+ * Permutation access pattern of a worker in the window.
+ * @workerId in [0, number of workers).
+ */
+PermutationPattern createPermutationPattern(const Options& opt, unsigned int workerId)
+{
+    return PermutationPattern(opt.getBlockSize(), opt.getWindowAccessRange(),
+                              opt.getWindow().getSize(), opt.getOpMix(), opt.getDiscardSize(),
+                              opt.getSeed(), workerId, opt.getNworkers());
+}
+
+/**
+ * Run a workload in the window
+ * until the period, the count, or the pattern is exhausted.
+ */
+template<typename Engine, typename Pattern>
+void exec_pattern(const Options& opt, Engine& engine, Pattern& pattern, IoRecorder& recorder)
+{
+    WindowPattern<Pattern> windowPattern(pattern, opt.getWindow());
+    IoWorkload<Engine, WindowPattern<Pattern> > workload(
+        engine, windowPattern, recorder, opt.getBlockSize(), opt.getSeed());
     if (opt.getPeriod() > 0) {
-        bench.execNsecs(opt.getPeriod());
+        workload.execNsecs(opt.getPeriod());
     } else {
-        bench.execNtimes(opt.getCount());
+        workload.execNtimes(opt.getCount());
     }
 }
 
-void worker_start(std::vector<std::future<void> >& workers, int n, const Options& opt,
-                  std::vector<std::queue<IoLog> >& rtQs,
-                  std::vector<PerformanceStatistics>& stats,
-                  std::mutex& mutex)
+/**
+ * Run a workload of random access, or trace replay if reader is not null.
+ *
+ * @beginTime unix time when the first trace record is issued [second].
+ */
+template<typename Engine>
+void exec_workload(const Options& opt, Engine& engine,
+                   WorkerResult& result, TraceReader* reader, double beginTime)
 {
-    rtQs.resize(n);
-    stats.resize(n);
-    for (int i = 0; i < n; i++) {
+    if (reader) {
+        TracePattern pattern(*reader, opt.getBlockSize(), opt.getWindow().getSize(),
+                             beginTime, opt.getSpeed());
+        WindowPattern<TracePattern> windowPattern(pattern, opt.getWindow());
+        IoWorkload<Engine, WindowPattern<TracePattern> > workload(
+            engine, windowPattern, result.recorder, opt.getBlockSize(), opt.getSeed());
+        workload.exec(0, opt.getPeriod());
+        result.nSkipped = pattern.getNSkipped();
+        return;
+    }
 
-        std::future<void> f = std::async(
-            std::launch::async, do_work, i, std::ref(opt), std::ref(rtQs[i]),
-            std::ref(stats[i]), std::ref(mutex));
-        workers.push_back(std::move(f));
+    const unsigned int id = result.recorder.getThreadId();
+    if (opt.isPermutation()) {
+        PermutationPattern pattern = createPermutationPattern(opt, id);
+        exec_pattern(opt, engine, pattern, result.recorder);
+    } else {
+        RandomPattern pattern = createRandomPattern(opt, id);
+        exec_pattern(opt, engine, pattern, result.recorder);
     }
 }
 
+/**
+ * Run a worker with a synchronous engine.
+ * @start called after the target is opened and before the first IO.
+ */
+template<typename Start>
+void run_sync_worker(const Options& opt, WorkerResult& result,
+                     TraceReader* reader, double beginTime, Start start)
+{
+    if (opt.isMmap()) {
+        MmapDevice md(opt.getArgs()[0], opt.getMode(), opt.getMadvise(),
+                      opt.isPopulate(), opt.isMsync());
+        SyncEngine<MmapDevice> engine(md, nullptr, nullptr, &result.faultStats);
+        start();
+        exec_workload(opt, engine, result, reader, beginTime);
+    } else {
+        BlockDevice bd(opt.getArgs()[0], opt.getMode(), opt.isDirect());
+        std::unique_ptr<PageCacheProbe> probe;
+        if (!opt.isDirect()) {
+            probe.reset(new PageCacheProbe(bd));
+        }
+        SyncEngine<BlockDevice> engine(bd, probe.get(), &result.cacheStats);
+        start();
+        exec_workload(opt, engine, result, reader, beginTime);
+    }
+}
+
+void do_work(const Options& opt, WorkerResult& result,
+             TraceReader* reader, double beginTime, std::mutex& mutex)
+{
+    measure_worker_cpu(opt, result, [&] {
+            run_sync_worker(opt, result, reader, beginTime, [] {});
+        });
+
+    std::lock_guard<std::mutex> lk(mutex);
+    ::printf("id %u ", result.recorder.getThreadId());
+    result.recorder.getStat().print();
+}
+
+/**
+ * Drop page cache if required, and print page cache residency
+ * of the access range. This does nothing for direct IO.
+ * @when "before" or "after". Page cache is dropped only before.
+ */
+void checkPageCache(const Options& opt, const char* when)
+{
+    if (opt.isDirect()) { return; }
+
+    const bool shouldDrop = opt.isDropCache() && ::strcmp(when, "before") == 0;
+    ::checkPageCache(opt.getArgs()[0], when, shouldDrop, opt.getWindow().getBase(),
+                     opt.getWindowAccessRange() * opt.getBlockSize());
+}
+
+/**
+ * Create a trace reader if replay.
+ */
+TraceReader* createTraceReader(const Options& opt)
+{
+    if (!opt.isReplay()) {
+        return nullptr;
+    }
+    return new TraceReader(opt.getTraceFile(), opt.getTraceFormat(),
+                           opt.getBlockSize(), opt.getCount());
+}
+
 void worker_join(std::vector<std::future<void> >& workers)
 {
     std::for_each(workers.begin(), workers.end(),
@@ -355,215 +1005,728 @@ void pop_and_show_logQ(std::queue<IoLog>& logQ)
     }
 }
 
-void execThreadExperiment(const Options& opt)
+/**
+ * Make the result of a run, and append it to the result file
+ * if -R is specified and to the results store if -Q is specified.
+ * @intervals per-second samples, or empty.
+ * @stat latency of the run.
+ * @period elapsed time [second].
+ */
+RunResult saveResult(const Options& opt, const IntervalSeries& intervals,
+                     const LatencyHistogram& hist, const PerformanceStatistics& stat,
+                     size_t totalSize, double period)
+{
+    RunResult r;
+    if (opt.isReplay()) {
+        r.pattern = "trace";
+    } else if (opt.isPermutation()) {
+        r.pattern = "perm";
+    } else {
+        r.pattern = "rnd";
+    }
+    switch (opt.getMode()) {
+    case READ_MODE: r.mode = "read"; break;
+    case WRITE_MODE: r.mode = "write"; break;
+    default: r.mode = "mix"; break;
+    }
+    r.nThreads = opt.getNthreads();
+    r.queueSize = opt.getQueueSize();
+    r.blockSize = opt.getBlockSize();
+    r.seed = opt.isReplay() ? 0 : opt.getSeed();
+    r.time = static_cast<uint64_t>(getTime());
+    r.nio = stat.getCount();
+    r.totalSize = totalSize;
+    r.period = period;
+    r.response = stat.getCount() == 0 ? 0.0 : stat.getAverage();
+    r.intervals = intervals.getWholeSamples();
+    r.hist = hist;
+    if (!opt.getResultFile().empty()) {
+        r.append(opt.getResultFile());
+    }
+    if (!opt.getStoreDir().empty()) {
+        ResultStore(opt.getStoreDir()).append(r);
+    }
+    return r;
+}
+
+/**
+ * At most this number of the slowest outliers are kept for each worker.
+ */
+const size_t MAX_TAIL_EVENTS = 1000;
+
+/**
+ * Create a tail capture shared by the workers if -X is specified.
+ */
+std::unique_ptr<TailCapture> createTailCapture(const Options& opt,
+                                               std::vector<WorkerResult>& results)
+{
+    std::unique_ptr<TailCapture> tail;
+    if (!opt.isTailCapture()) { return tail; }
+    tail.reset(new TailCapture(results.size(), opt.getTailThreshold(),
+                               opt.getTailPercentile(), opt.getTailContext(),
+                               MAX_TAIL_EVENTS));
+    for (WorkerResult& r : results) {
+        r.recorder.setTailCapture(tail.get());
+    }
+    return tail;
+}
+
+/**
+ * Create a depth tracker shared by the workers if -I is specified.
+ */
+std::unique_ptr<DepthTracker> createDepthTracker(const Options& opt,
+                                                 std::vector<WorkerResult>& results)
+{
+    std::unique_ptr<DepthTracker> depth;
+    if (!opt.isDepthTracking()) { return depth; }
+    depth.reset(new DepthTracker(results.size(), opt.getDepthInterval()));
+    for (WorkerResult& r : results) {
+        r.recorder.setDepthTracker(depth.get());
+    }
+    return depth;
+}
+
+/**
+ * Print logs and merged statistics of workers.
+ * @periodInSec Elapsed time [second].
+ * @cpu consumed by the process during the run.
+ * @disk block-layer statistics of the run, or nullptr.
+ * @tail outliers of the run, or nullptr.
+ * @depth IOs in flight during the run, or nullptr.
+ */
+RunResult printResults(const Options& opt, std::vector<WorkerResult>& results,
+                       double periodInSec, const CpuTime& cpu, const DiskMonitor* disk,
+                       const TailCapture* tail, const DepthTracker* depth)
+{
+    std::for_each(results.begin(), results.end(), [](WorkerResult& r) {
+            pop_and_show_logQ(r.recorder.getLogQueue());
+        });
+
+    std::vector<IoRecorder> recorders;
+    LatencyHistogram hist;
+    IntervalSeries intervals;
+    CacheHitStatistics cacheStat;
+    FaultStatistics faultStat;
+    IoPhaseStatistics phaseStat;
+    std::vector<WorkerCpu> cpus;
+    size_t nSkipped = 0;
+    std::for_each(results.begin(), results.end(), [&](WorkerResult& r) {
+            recorders.push_back(r.recorder);
+            hist.merge(r.recorder.getHist());
+            intervals.merge(r.recorder.getIntervals());
+            cpus.push_back(r.cpu);
+            cacheStat.merge(r.cacheStats);
+            faultStat.merge(r.faultStats);
+            phaseStat.merge(r.phaseStats);
+            nSkipped += r.nSkipped;
+        });
+    PerformanceStatistics stat, lagStat;
+    OpStatistics opStat;
+    size_t totalSize;
+    mergeRecorders(recorders.begin(), recorders.end(), stat, opStat, lagStat, totalSize);
+
+    if (opt.getNthreads() > 0) {
+        ::printf("---------------\n");
+    }
+    ::printf("all ");
+    stat.print();
+    opStat.print();
+    if (!opt.isDirect()) {
+        cacheStat.print();
+    }
+    if (opt.isMmap()) {
+        faultStat.print();
+    }
+    if (opt.isPhaseTracking()) {
+        phaseStat.print();
+    }
+    if (opt.isReplay()) {
+        ::printf("lag ");
+        lagStat.print();
+        ::printf("skipped %zu\n", nSkipped);
+    }
+    printThroughputInBytes(totalSize, stat.getCount(), periodInSec);
+    printCpuCost(opt, cpus, cpu, stat.getCount(), totalSize, periodInSec);
+    if (disk) {
+        disk->print(stat);
+    }
+    if (depth) {
+        depth->print(stat.getCount(), stat.getCount() == 0 ? 0.0 : stat.getAverage(),
+                     periodInSec, opt.getTargetDepth());
+    }
+    if (tail) {
+        tail->print();
+    }
+    return saveResult(opt, intervals, hist, stat, totalSize, periodInSec);
+}
+
+RunResult execThreadExperiment(const Options& opt, DiskMonitor* disk)
 {
     const size_t nthreads = opt.getNthreads();
     assert(nthreads > 0);
 
-    std::vector<std::queue<IoLog> > logQs;
-    std::vector<PerformanceStatistics> stats;
+    std::unique_ptr<TraceReader> reader(createTraceReader(opt));
+    std::vector<WorkerResult> results;
+    for (size_t i = 0; i < nthreads; i++) {
+        results.push_back(WorkerResult(i, opt));
+    }
+    std::unique_ptr<TailCapture> tail = createTailCapture(opt, results);
+    std::unique_ptr<DepthTracker> depth = createDepthTracker(opt, results);
     
     std::vector<std::future<void> > workers;
     double begin, end;
     std::mutex mutex;
     
+    checkPageCache(opt, "before");
+    if (disk) { disk->start(); }
+    if (depth) { depth->start(); }
+    const CpuTime cpu = CpuTime::get();
     begin = getTime();
-    worker_start(workers, nthreads, opt, logQs, stats, mutex);
+    for (size_t i = 0; i < nthreads; i++) {
+        workers.push_back(std::async(std::launch::async, [&, i] {
+                    do_work(opt, results[i], reader.get(), begin, mutex);
+                }));
+    }
     worker_join(workers);
     end = getTime();
+    const CpuTime cpuUsed = CpuTime::get() - cpu;
+    if (depth) { depth->stop(); }
+    if (disk) { disk->stop(); }
+    checkPageCache(opt, "after");
 
-    assert(logQs.size() == nthreads);
-    std::for_each(logQs.begin(), logQs.end(), pop_and_show_logQ);
+    return printResults(opt, results, end - begin, cpuUsed, disk, tail.get(), depth.get());
+}
 
-    PerformanceStatistics stat = mergeStats(stats.begin(), stats.end());
-    ::printf("---------------\n"
-             "all ");
-    stat.print();
-    printThroughput(opt.getBlockSize(), stat.getCount(), end - begin);
+RunResult execAioExperiment(const Options& opt, DiskMonitor* disk)
+{
+    assert(opt.getNthreads() == 0);
+    const size_t queueSize = opt.getQueueSize();
+    assert(queueSize > 0);
+    
+    std::unique_ptr<TraceReader> reader(createTraceReader(opt));
+    BlockDevice bd(opt.getArgs()[0], opt.getMode(), opt.isDirect());
+    AioEngine engine(bd, queueSize);
+    if (opt.isPoll()) {
+        engine.getAio().setPolling(opt.getPollBudget());
+    }
+    if (opt.isPhaseTracking()) {
+        engine.setPhaseTracking();
+    }
+    std::vector<WorkerResult> results(1, WorkerResult(0, opt));
+    std::unique_ptr<TailCapture> tail = createTailCapture(opt, results);
+    std::unique_ptr<DepthTracker> depth = createDepthTracker(opt, results);
+    
+    double begin, end;
+    checkPageCache(opt, "before");
+    if (disk) { disk->start(); }
+    if (depth) { depth->start(); }
+    const CpuTime cpu = CpuTime::get();
+    begin = getTime();
+    measure_worker_cpu(opt, results[0], [&] {
+            exec_workload(opt, engine, results[0], reader.get(), begin);
+        });
+    end = getTime();
+    const CpuTime cpuUsed = CpuTime::get() - cpu;
+    if (depth) { depth->stop(); }
+    if (disk) { disk->stop(); }
+    results[0].phaseStats = engine.getPhaseStats();
+    checkPageCache(opt, "after");
+
+    const RunResult ret = printResults(opt, results, end - begin, cpuUsed, disk, tail.get(), depth.get());
+    printPollStatistics(engine.getAio());
+    return ret;
 }
 
 /**
- * Io response bench with aio.
+ * @clients filled with statistics of the clients.
  */
-class AioResponseBench
+template<typename Pattern>
+void exec_clients(const Options& opt, AioEngine& engine, Pattern& pattern,
+                  WorkerResult& result, size_t first, size_t nClients, uint64_t stream,
+                  std::vector<ClientStatistics>& clients)
 {
-private:
-    const BlockDevice& dev_;
-    const size_t blockSize_;
-    const size_t queueSize_;
-    const size_t accessRange_;
-    const bool isShowEachResponse_;
-    const Mode mode_;
-    
-    BlockBuffer bb_;
-    Rand<size_t, std::uniform_int_distribution<size_t> > rand_;
-    std::queue<IoLog> logQ_;
-    PerformanceStatistics stat_;
-    Aio aio_;
-    
+    WindowPattern<Pattern> windowPattern(pattern, opt.getWindow());
+    ClientReactor<AioEngine, WindowPattern<Pattern> > reactor(
+        engine, windowPattern, result.recorder, first, nClients,
+        opt.getThinkTime(), opt.getBlockSize(), opt.getSeed(), stream);
+    reactor.exec(opt.getPeriod() > 0 ? 0 : opt.getCount(), opt.getPeriod());
+    clients = reactor.getClients();
+}
 
-public:
-    AioResponseBench(const BlockDevice& dev, size_t blockSize, size_t queueSize,
-                     size_t accessRange, bool isShowEachResponse)
-        : dev_(dev)
-        , blockSize_(blockSize)
-        , queueSize_(queueSize)
-        , accessRange_(calcAccessRange(accessRange, blockSize, dev))
-        , isShowEachResponse_(isShowEachResponse)
-        , mode_(dev.getMode())
-        , bb_(queueSize * 2, blockSize)
-        , rand_(0, std::numeric_limits<size_t>::max())
-        , logQ_()
-        , stat_()
-        , aio_(dev.getFd(), queueSize) {
-
-        assert(blockSize_ % 512 == 0);
-        assert(queueSize_ > 0);
-        assert(accessRange_ > 0);
-    }        
-    
-    void execNtimes(size_t nTimes) {
+/**
+ * Run logical clients of a reactor thread.
+ * @reactorId reactor id starting from 0.
+ * @clients filled with statistics of the clients.
+ */
+void do_client_work(const Options& opt, unsigned int reactorId, WorkerResult& result,
+                    std::vector<ClientStatistics>& clients, std::mutex& mutex)
+{
+    const size_t nReactors = opt.getNthreads();
+    const size_t first = opt.getNclients() * reactorId / nReactors;
+    const size_t nClients = opt.getNclients() * (reactorId + 1) / nReactors - first;
+    /* Patterns use streams [0, nReactors). */
+    const uint64_t stream = nReactors + reactorId;
 
-        size_t pending = 0;
-        size_t c = 0;
+    BlockDevice bd(opt.getArgs()[0], opt.getMode(), opt.isDirect());
+    AioEngine engine(bd, nClients);
+    if (opt.isPoll()) {
+        engine.getAio().setPolling(opt.getPollBudget());
+    }
+    if (opt.isPhaseTracking()) {
+        engine.setPhaseTracking();
+    }
+    measure_worker_cpu(opt, result, [&] {
+            if (opt.isPermutation()) {
+                PermutationPattern pattern = createPermutationPattern(opt, reactorId);
+                exec_clients(opt, engine, pattern, result, first, nClients, stream, clients);
+            } else {
+                RandomPattern pattern = createRandomPattern(opt, reactorId);
+                exec_clients(opt, engine, pattern, result, first, nClients, stream, clients);
+            }
+        });
+    result.phaseStats = engine.getPhaseStats();
 
-        // Fill the queue.
-        while (pending < queueSize_ && c < nTimes) {
-            prepareIo(bb_.next());
-            pending++;
-            c++;
-        }
-        aio_.submit();
-        // Wait and fill.
-        while (c < nTimes) {
-            assert(pending == queueSize_);
+    std::lock_guard<std::mutex> lk(mutex);
+    ::printf("id %u ", result.recorder.getThreadId());
+    result.recorder.getStat().print();
+}
 
-            waitAnIo();
-            pending--;
+/**
+ * Many logical clients multiplexed on reactor threads.
+ */
+RunResult execClientExperiment(const Options& opt, DiskMonitor* disk)
+{
+    const size_t nthreads = opt.getNthreads();
+    assert(nthreads > 0);
 
-            prepareIo(bb_.next()); 
-            pending++;
-            c++;
-            aio_.submit();
-        }
-        // Wait remaining.
-        while (pending > 0) {
-            waitAnIo();
-            pending--;
-        }
+    std::vector<WorkerResult> results;
+    for (size_t i = 0; i < nthreads; i++) {
+        results.push_back(WorkerResult(i, opt));
     }
+    std::unique_ptr<TailCapture> tail = createTailCapture(opt, results);
+    std::unique_ptr<DepthTracker> depth = createDepthTracker(opt, results);
+    std::vector<std::vector<ClientStatistics> > clients(nthreads);
 
-    void execNsecs(size_t nSecs) {
+    std::vector<std::future<void> > workers;
+    double begin, end;
+    std::mutex mutex;
 
-        double begin, end;
-        begin = getTime(); end = begin;
+    checkPageCache(opt, "before");
+    if (disk) { disk->start(); }
+    if (depth) { depth->start(); }
+    const CpuTime cpu = CpuTime::get();
+    begin = getTime();
+    for (size_t i = 0; i < nthreads; i++) {
+        workers.push_back(std::async(std::launch::async, [&, i] {
+                    do_client_work(opt, i, results[i], clients[i], mutex);
+                }));
+    }
+    worker_join(workers);
+    end = getTime();
+    const CpuTime cpuUsed = CpuTime::get() - cpu;
+    if (depth) { depth->stop(); }
+    if (disk) { disk->stop(); }
+    checkPageCache(opt, "after");
 
-        size_t pending = 0;
+    const RunResult ret = printResults(opt, results, end - begin, cpuUsed, disk, tail.get(), depth.get());
 
-        // Fill the queue.
-        while (pending < queueSize_) {
-            prepareIo(bb_.next());
-            pending++;
-        }
-        aio_.submit();
-        // Wait and fill.
-        while (end - begin < static_cast<double>(nSecs)) {
-            assert(pending == queueSize_);
+    std::vector<ClientStatistics> all;
+    std::for_each(clients.begin(), clients.end(), [&](std::vector<ClientStatistics>& v) {
+            all.insert(all.end(), v.begin(), v.end());
+        });
+    if (opt.isShowEachResponse()) {
+        std::for_each(all.begin(), all.end(), [](const ClientStatistics& c) { c.print(); });
+    }
+    printClientSummary(all.begin(), all.end());
+    return ret;
+}
 
-            end = waitAnIo();
-            pending--;
+/**
+ * Results of a worker process placed in shared memory.
+ * Members have no pointer, so the parent can read them.
+ */
+struct SharedResult
+{
+    PerformanceStatistics stat;
+    OpStatistics opStats;
+    LatencyHistogram hist;
+    CacheHitStatistics cacheStats;
+    FaultStatistics faultStats;
+    IoPhaseStatistics phaseStats;
+    WorkerCpu cpu;
+    size_t totalSize;
+    bool isOk;
+    char error[256];
+};
 
-            prepareIo(bb_.next()); 
-            pending++;
-            aio_.submit();
-        }
-        // Wait pending.
-        while (pending > 0) {
-            waitAnIo();
-            pending--;
-        }
+/**
+ * Run a worker in a child process.
+ * The first IO is issued after all the workers get ready
+ * and the parent releases the gate.
+ */
+void do_process_work(const Options& opt, unsigned int id,
+                     SharedResult& shared, StartGate& gate)
+{
+    bool isStarted = false;
+    auto start = [&] {
+        isStarted = true;
+        gate.notifyReady();
+        gate.waitGo();
+    };
+    WorkerResult result(id, opt);
+    try {
+        measure_worker_cpu(opt, result, [&] {
+                if (opt.getNthreads() == 0) {
+                    BlockDevice bd(opt.getArgs()[0], opt.getMode(), opt.isDirect());
+                    AioEngine engine(bd, opt.getQueueSize());
+                    if (opt.isPoll()) {
+                        engine.getAio().setPolling(opt.getPollBudget());
+                    }
+                    if (opt.isPhaseTracking()) {
+                        engine.setPhaseTracking();
+                    }
+                    start();
+                    exec_workload(opt, engine, result, nullptr, 0);
+                    result.phaseStats = engine.getPhaseStats();
+                } else {
+                    run_sync_worker(opt, result, nullptr, 0, start);
+                }
+            });
+        shared.isOk = true;
+    } catch (const std::exception& e) {
+        ::snprintf(shared.error, sizeof(shared.error), "%s", e.what());
+    } catch (...) {
+        ::snprintf(shared.error, sizeof(shared.error), "unknown error");
     }
+    if (!isStarted) {
+        /* The parent reports the error after the others finish. */
+        gate.notifyReady();
+    }
+    shared.stat = result.recorder.getStat();
+    shared.opStats = result.recorder.getOpStats();
+    shared.hist = result.recorder.getHist();
+    shared.cacheStats = result.cacheStats;
+    shared.faultStats = result.faultStats;
+    shared.phaseStats = result.phaseStats;
+    shared.cpu = result.cpu;
+    shared.totalSize = result.recorder.getTotalSize();
+}
 
-    PerformanceStatistics& getStat() { return stat_; }
-    std::queue<IoLog>& getIoLogQueue() { return logQ_; }
-    
-private:
-    bool decideIsWrite() {
+/**
+ * Kill and reap worker processes.
+ */
+void killWorkers(const std::vector<pid_t>& pids)
+{
+    for (pid_t pid : pids) { ::kill(pid, SIGKILL); }
+    for (pid_t pid : pids) { ::waitpid(pid, NULL, 0); }
+}
 
-        bool isWrite = false;
-        
-        switch(mode_) {
-        case READ_MODE:
-            isWrite = false;
-            break;
-        case WRITE_MODE:
-            isWrite = true;
-            break;
-        case MIX_MODE:
-            isWrite = rand_.get(2) == 0;
-            break;
-        default:
-            assert(false);
-        }
-        return isWrite;
+/**
+ * Fork worker processes and merge their statistics.
+ * This shows the cost of process isolation compared with threads.
+ */
+RunResult execProcessExperiment(const Options& opt, DiskMonitor* disk)
+{
+    const size_t nprocs = opt.getNprocs();
+    assert(nprocs > 0);
+
+    SharedMemory resultMem(sizeof(SharedResult) * nprocs);
+    SharedResult* shared = static_cast<SharedResult*>(resultMem.get());
+    for (size_t i = 0; i < nprocs; i++) {
+        new (&shared[i]) SharedResult();
+        shared[i].isOk = false;
     }
-    
-    void prepareIo(char *buf) {
+    StartGate gate;
 
-        size_t blockId = rand_.get(accessRange_);
-        
-        if (decideIsWrite()) {
-            aio_.prepareWrite(blockId * blockSize_, blockSize_, buf);
-        } else {
-            aio_.prepareRead(blockId * blockSize_, blockSize_, buf);
+    checkPageCache(opt, "before");
+    ::fflush(stdout);
+    const CpuTime cpu = CpuTime::get(RUSAGE_CHILDREN);
+    std::vector<pid_t> pids;
+    for (size_t i = 0; i < nprocs; i++) {
+        pid_t pid = ::fork();
+        if (pid < 0) {
+            std::string e("fork failed: ");
+            e += ::strerror(errno);
+            killWorkers(pids);
+            throw std::runtime_error(e);
+        }
+        if (pid == 0) {
+            gate.enterChild();
+            do_process_work(opt, i, shared[i], gate);
+            ::_exit(0);
         }
+        pids.push_back(pid);
     }
-
-    double waitAnIo() {
-
-        auto* ptr = aio_.waitOne();
-        auto log = toIoLog(ptr);
-        stat_.updateRt(log.response);
-        if (isShowEachResponse_) {
-            logQ_.push(log);
+    if (!gate.waitReady(nprocs)) {
+        killWorkers(pids);
+        throw std::runtime_error("a worker process exited before it got ready.");
+    }
+    if (disk) {
+        try {
+            disk->start();
+        } catch (...) {
+            killWorkers(pids);
+            throw;
         }
-        return ptr->endTime;
     }
-    
-    IoLog toIoLog(AioData *ptr) {
+    gate.release();
+    const double begin = getTime();
+    std::for_each(pids.begin(), pids.end(), [](pid_t pid) { ::waitpid(pid, NULL, 0); });
+    const double end = getTime();
+    const CpuTime cpuUsed = CpuTime::get(RUSAGE_CHILDREN) - cpu;
+    if (disk) { disk->stop(); }
+    checkPageCache(opt, "after");
 
-        return IoLog(0, ptr->isWrite, ptr->oft / ptr->size,
-                     ptr->beginTime, ptr->endTime - ptr->beginTime);
+    std::vector<PerformanceStatistics> stats;
+    std::vector<OpStatistics> opStatsV;
+    LatencyHistogram hist;
+    CacheHitStatistics cacheStat;
+    FaultStatistics faultStat;
+    IoPhaseStatistics phaseStat;
+    std::vector<WorkerCpu> cpus;
+    size_t totalSize = 0;
+    for (size_t i = 0; i < nprocs; i++) {
+        if (!shared[i].isOk) {
+            throw std::runtime_error(shared[i].error);
+        }
+        ::printf("proc %zu ", i);
+        shared[i].stat.print();
+        stats.push_back(shared[i].stat);
+        opStatsV.push_back(shared[i].opStats);
+        hist.merge(shared[i].hist);
+        cacheStat.merge(shared[i].cacheStats);
+        faultStat.merge(shared[i].faultStats);
+        phaseStat.merge(shared[i].phaseStats);
+        cpus.push_back(shared[i].cpu);
+        totalSize += shared[i].totalSize;
+    }
+    PerformanceStatistics stat = mergeStats(stats.begin(), stats.end());
+    ::printf("---------------\n");
+    ::printf("all ");
+    stat.print();
+    mergeOpStats(opStatsV.begin(), opStatsV.end()).print();
+    ::printf("latency ");
+    hist.print();
+    if (!opt.isDirect()) {
+        cacheStat.print();
+    }
+    if (opt.isMmap()) {
+        faultStat.print();
     }
+    if (opt.isPhaseTracking()) {
+        phaseStat.print();
+    }
+    printThroughputInBytes(totalSize, stat.getCount(), end - begin);
+    printCpuCost(opt, cpus, cpuUsed, stat.getCount(), totalSize, end - begin);
+    if (disk) {
+        disk->print(stat);
+    }
+    return saveResult(opt, IntervalSeries(), hist, stat, totalSize, end - begin);
+}
+
+/**
+ * A point of the throughput/latency curve.
+ */
+struct KneePoint
+{
+    size_t concurrency;
+    double iops;
+    double throughput; /* [byte/second] */
+    double avg; /* [second] */
+    double p50; /* [second] */
+    double p99; /* [second] */
 };
 
-void execAioExperiment(const Options& opt)
+/**
+ * Warmup period before each point is measured [second].
+ */
+const size_t KNEE_WARMUP_PERIOD = 1;
+
+/**
+ * Run random IOs for a period.
+ * @nSecs period [second].
+ */
+template<typename Engine>
+void exec_random(const Options& opt, Engine& engine, RandomPattern& pattern,
+                 IoRecorder& recorder, size_t nSecs)
 {
-    assert(opt.getNthreads() == 0);
-    const size_t queueSize = opt.getQueueSize();
-    assert(queueSize > 0);
-    
-    const bool isDirect = true;
-    BlockDevice bd(opt.getArgs()[0], opt.getMode(), isDirect);
-    
-    AioResponseBench bench(bd, opt.getBlockSize(), opt.getQueueSize(),
-                           opt.getAccessRange(),
-                           opt.isShowEachResponse());
-    
-    double begin, end;
+    WindowPattern<RandomPattern> windowPattern(pattern, opt.getWindow());
+    IoWorkload<Engine, WindowPattern<RandomPattern> > workload(
+        engine, windowPattern, recorder, opt.getBlockSize(), opt.getSeed());
+    workload.execNsecs(nSecs);
+}
+
+/**
+ * Measure random IOs in a window after warmup.
+ * @recorder filled with IOs in the window.
+ * @begin @end the window [unix time].
+ */
+template<typename Engine>
+void exec_knee_window(const Options& opt, Engine& engine,
+                      IoRecorder& recorder, double& begin, double& end)
+{
+    RandomPattern pattern = createRandomPattern(opt, recorder.getThreadId());
+    IoRecorder warmup(recorder.getThreadId(), opt.getBlockSize(), false);
+    exec_random(opt, engine, pattern, warmup, KNEE_WARMUP_PERIOD);
     begin = getTime();
-    if (opt.getPeriod() > 0) {
-        bench.execNsecs(opt.getPeriod());
-    } else {
-        bench.execNtimes(opt.getCount());
-    }
+    exec_random(opt, engine, pattern, recorder, opt.getPeriod());
     end = getTime();
+}
 
-    pop_and_show_logQ(bench.getIoLogQueue());
-    auto& stat = bench.getStat();
-    ::printf("all ");
-    stat.print();
-    printThroughput(opt.getBlockSize(), stat.getCount(), end - begin);
+/**
+ * @queueSize aio queue size, or 0 to use synchronous IO.
+ */
+void do_knee_work(const Options& opt, size_t queueSize, IoRecorder& recorder,
+                  double& begin, double& end)
+{
+    BlockDevice bd(opt.getArgs()[0], opt.getMode(), opt.isDirect());
+    if (queueSize == 0) {
+        SyncEngine<BlockDevice> engine(bd);
+        exec_knee_window(opt, engine, recorder, begin, end);
+        return;
+    }
+    AioEngine engine(bd, queueSize);
+    if (opt.isPoll()) {
+        engine.getAio().setPolling(opt.getPollBudget());
+    }
+    exec_knee_window(opt, engine, recorder, begin, end);
+}
+
+/**
+ * @concurrency queue size with -t 0, or number of threads.
+ */
+KneePoint measureKneePoint(const Options& opt, size_t concurrency)
+{
+    const bool isAio = (opt.getNthreads() == 0);
+    const size_t nthreads = isAio ? 1 : concurrency;
+    std::vector<IoRecorder> recorders;
+    for (size_t i = 0; i < nthreads; i++) {
+        recorders.push_back(IoRecorder(i, opt.getBlockSize(), false));
+    }
+    std::vector<double> begins(nthreads), ends(nthreads);
+
+    std::vector<std::future<void> > workers;
+    for (size_t i = 0; i < nthreads; i++) {
+        workers.push_back(std::async(std::launch::async, [&, i] {
+                    do_knee_work(opt, isAio ? concurrency : 0,
+                                 recorders[i], begins[i], ends[i]);
+                }));
+    }
+    worker_join(workers);
+
+    PerformanceStatistics stat, lagStat;
+    OpStatistics opStat;
+    size_t totalSize;
+    mergeRecorders(recorders.begin(), recorders.end(), stat, opStat, lagStat, totalSize);
+    LatencyHistogram hist;
+    std::for_each(recorders.begin(), recorders.end(),
+                  [&](const IoRecorder& r) { hist.merge(r.getHist()); });
+    const double period = *std::max_element(ends.begin(), ends.end())
+        - *std::min_element(begins.begin(), begins.end());
+
+    KneePoint p;
+    p.concurrency = concurrency;
+    p.iops = static_cast<double>(stat.getCount()) / period;
+    p.throughput = static_cast<double>(totalSize) / period;
+    p.avg = stat.getAverage();
+    p.p50 = hist.getPercentile(50);
+    p.p99 = hist.getPercentile(99);
+    return p;
+}
+
+/**
+ * Search the largest concurrency whose p99 response time meets the SLO.
+ * Concurrency is doubled until the SLO is violated or the maximum is reached,
+ * then bisected between the last point met and the first point violated.
+ */
+void execKneeSearch(const Options& opt)
+{
+    const double slo = opt.getSlo();
+    const size_t maxConcurrency = opt.getMaxConcurrency();
+    std::vector<KneePoint> points;
+    auto isMet = [&](size_t concurrency) {
+        points.push_back(measureKneePoint(opt, concurrency));
+        return points.back().p99 <= slo;
+    };
+
+    size_t good = 0, bad = 0;
+    size_t c = 1;
+    while (true) {
+        if (!isMet(c)) {
+            bad = c;
+            break;
+        }
+        good = c;
+        if (c >= maxConcurrency) { break; }
+        c = std::min(c * 2, maxConcurrency);
+    }
+    if (good > 0 && bad > 0) {
+        while (bad - good > 1) {
+            const size_t mid = good + (bad - good) / 2;
+            if (isMet(mid)) {
+                good = mid;
+            } else {
+                bad = mid;
+            }
+        }
+    }
+
+    std::sort(points.begin(), points.end(), [](const KneePoint& a, const KneePoint& b) {
+            return a.concurrency < b.concurrency;
+        });
+    std::for_each(points.begin(), points.end(), [&](const KneePoint& p) {
+            ::printf("curve concurrency %zu iops %.3f throughput %.3f avg %.06f "
+                     "p50 %.06f p99 %.06f %s\n",
+                     p.concurrency, p.iops, p.throughput, p.avg, p.p50, p.p99,
+                     p.p99 <= slo ? "met" : "violated");
+        });
+    if (good == 0) {
+        ::printf("knee none slo %.06f\n", slo);
+        return;
+    }
+    const KneePoint& knee = *std::find_if(
+        points.begin(), points.end(),
+        [&](const KneePoint& p) { return p.concurrency == good; });
+    ::printf("knee concurrency %zu iops %.3f throughput %.3f avg %.06f p99 %.06f slo %.06f\n",
+             knee.concurrency, knee.iops, knee.throughput, knee.avg, knee.p99, slo);
+}
+
+/**
+ * Run the experiment -n times with -g idle gaps.
+ */
+void execRepetitions(const Options& opt, DiskMonitor* disk)
+{
+    std::vector<RunResult> runs;
+    for (size_t i = 0; i < opt.getNrepeats(); i++) {
+        if (i > 0) {
+            sleepUntil(getTime() + opt.getRepeatGap());
+        }
+        /* Each repetition accesses different offsets,
+           so it does not hit caches warmed by the previous ones.
+           Repetition i is reproduced by -S with its seed. */
+        Options rep(opt);
+        rep.setSeed(opt.getSeed() + i);
+        if (opt.getNrepeats() > 1) {
+            ::printf("repetition %zu", i);
+            if (!opt.isReplay()) {
+                ::printf(" seed %llu", static_cast<unsigned long long>(rep.getSeed()));
+            }
+            ::printf("\n");
+        }
+        if (rep.isClientMode()) {
+            runs.push_back(execClientExperiment(rep, disk));
+        } else if (rep.isProcessMode()) {
+            runs.push_back(execProcessExperiment(rep, disk));
+        } else if (rep.getNthreads() == 0) {
+            runs.push_back(execAioExperiment(rep, disk));
+        } else {
+            runs.push_back(execThreadExperiment(rep, disk));
+        }
+    }
+    if (runs.size() > 1) {
+        ::printf("---------------\n");
+        printRepetitions(runs);
+    }
 }
 
 int main(int argc, char* argv[])
@@ -576,10 +1739,20 @@ int main(int argc, char* argv[])
         } else if (opt.isShowHelp()) {
             opt.showHelp();
         } else {
-            if (opt.getNthreads() == 0) {
-                execAioExperiment(opt);
+            std::unique_ptr<DiskMonitor> disk;
+            {
+                BlockDevice bd(opt.getArgs()[0], READ_MODE, opt.isDirect());
+                printBlockSizes(bd);
+                opt.resolveWindow(bd);
+                disk = createDiskMonitor(opt, bd.getBackingDevice());
+            }
+            if (!opt.isReplay()) {
+                ::printf("seed %llu\n", static_cast<unsigned long long>(opt.getSeed()));
+            }
+            if (opt.isKneeSearch()) {
+                execKneeSearch(opt);
             } else {
-                execThreadExperiment(opt);
+                execRepetitions(opt, disk.get());
             }
         }
     } catch (const std::runtime_error& e) {
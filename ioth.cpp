@@ -18,6 +18,8 @@
 #include <mutex>
 #include <memory>
 #include <chrono>
+#include <atomic>
+#include <cmath>
 
 #include <cstdio>
 #include <cassert>
@@ -35,6 +37,11 @@
 #include "ioreth.hpp"
 #include "util.hpp"
 #include "thread_pool.hpp"
+#include "rand.hpp"
+#include "io_engine.hpp"
+#include "workload.hpp"
+#include "result.hpp"
+#include "store.hpp"
 
 /**
  * Parse commane-line arguments as options.
@@ -55,6 +62,31 @@ private:
     size_t count_;
     size_t nthreads_;
     size_t queueSize_;
+    bool isDirect_;
+    bool isDropCache_;
+    bool isPoll_;
+    size_t pollBudget_;
+
+    bool isPrecondition_;
+    size_t nRandomPasses_;
+    size_t randomBlockSize_;
+    size_t flatPct_;
+    uint64_t seed_;
+    bool hasSeed_;
+
+    uint64_t windowBegin_;
+    uint64_t windowEnd_;
+    size_t misalign_;
+    IoWindow window_;
+
+    size_t nRepeats_;
+    double repeatGap_;
+
+    std::string storeDir_;
+
+    size_t depthIntervalUs_;
+
+    size_t dequeueBatchSize_;
 
 public:
     Options(int argc, char* argv[])
@@ -68,9 +100,32 @@ public:
         , period_(0)
         , count_(0)
         , nthreads_(1)
-        , queueSize_(1) {
+        , queueSize_(1)
+        , isDirect_(true)
+        , isDropCache_(false)
+        , isPoll_(false)
+        , pollBudget_(0)
+        , isPrecondition_(false)
+        , nRandomPasses_(0)
+        , randomBlockSize_(0)
+        , flatPct_(5)
+        , seed_(0)
+        , hasSeed_(false)
+        , windowBegin_(0)
+        , windowEnd_(0)
+        , misalign_(0)
+        , window_(0, 0, 0)
+        , nRepeats_(1)
+        , repeatGap_(0)
+        , storeDir_()
+        , depthIntervalUs_(0)
+        , dequeueBatchSize_(1) {
 
         parse(argc, argv);
+        window_ = IoWindow(windowBegin_, windowEnd_, misalign_);
+        if (!hasSeed_) {
+            seed_ = getRandomSeed();
+        }
 
         if (isShowVersion_ || isShowHelp_) {
             return;
@@ -87,8 +142,14 @@ public:
 
         ::printf("usage: %s [option(s)] [file or device]\n"
                  "options: \n"
-                 "    -s off:  start offset in blocks.\n"
+                 "    -s off:  start offset in blocks from the window start.\n"
                  "    -b size: blocksize in bytes.\n"
+                 "    -O oft:  start of the window to access in bytes.\n"
+                 "    -E oft:  end of the window to access in bytes.\n"
+                 "             default is the end of the device.\n"
+                 "    -A oft:  add oft bytes to each offset for misaligned IO.\n"
+                 "             it must be a multiple of the direct IO\n"
+                 "             alignment unless -B.\n"
                  "    -p secs: execute period in seconds.\n"
                  "    -c num:  number of IOs to execute.\n"
                  "             -p and -c is exclusive.\n"
@@ -96,6 +157,41 @@ public:
                  "    -t num:  number of threads in parallel.\n"
                  "             if 0, use aio instead thread.\n"
                  "    -q size: queue size.\n"
+                 "    -j num:  each thread takes up to num blocks\n"
+                 "             from the queue at once (default 1).\n"
+                 "             consecutive blocks go to the same thread,\n"
+                 "             so the device sees a stream per thread.\n"
+                 "    -B:      buffered IO instead of direct IO.\n"
+                 "             page cache residency is printed.\n"
+                 "    -d:      drop page cache of the target before run.\n"
+                 "             this is meaningfull with -B.\n"
+                 "    -l num:  busy-poll aio completions with -t 0 or -W.\n"
+                 "             num is the polls per wait before blocking.\n"
+                 "             if 0, never block.\n"
+                 "    -W:      precondition the whole window by writing it.\n"
+                 "             each of -t threads (1 with -t 0) writes its part\n"
+                 "             sequentially with aio of -q depth.\n"
+                 "             progress is printed every second.\n"
+                 "    -R num:  random write passes after the sequential pass with -W.\n"
+                 "             each pass writes every block once in a random order.\n"
+                 "    -k size: blocksize of random passes in bytes (default -b).\n"
+                 "    -f pct:  stop random passes when throughput changes\n"
+                 "             less than pct percent from the previous pass.\n"
+                 "             default is 5. if 0, run all passes.\n"
+                 "    -S seed: seed of the random passes to reproduce a layout.\n"
+                 "             default is random, and it is printed.\n"
+                 "    -n num:  repeat the run num times (default 1).\n"
+                 "             each repetition reads the same blocks sequentially,\n"
+                 "             so use -d with -B not to read the page cache.\n"
+                 "             mean, stddev, and 95%% confidence interval\n"
+                 "             of the repetitions are printed,\n"
+                 "             and outliers are flagged with 5 repetitions or more.\n"
+                 "    -g secs: idle gap between repetitions in seconds.\n"
+                 "    -Q dir:  append the result of each run to the results store\n"
+                 "             in dir, which is queried by ioq.\n"
+                 "    -I usec: sample the number of IOs in flight every usec,\n"
+                 "             and compare the mean with IOPS times mean latency\n"
+                 "             by Little's law. this is not available with -W.\n"
                  "    -r:      show response of each IO.\n"
                  "    -v:      show version.\n"
                  "    -h:      show this help.\n"
@@ -114,6 +210,50 @@ public:
     size_t getCount() const { return count_; }
     size_t getNthreads() const { return nthreads_; }
     size_t getQueueSize() const { return queueSize_; }
+    size_t getDequeueBatchSize() const { return dequeueBatchSize_; }
+    bool isDirect() const { return isDirect_; }
+    bool isDropCache() const { return isDropCache_; }
+    bool isPoll() const { return isPoll_; }
+    size_t getPollBudget() const { return pollBudget_; }
+    bool isPrecondition() const { return isPrecondition_; }
+    size_t getNrandomPasses() const { return nRandomPasses_; }
+    uint64_t getSeed() const { return seed_; }
+    size_t getRandomBlockSize() const {
+        return randomBlockSize_ == 0 ? blockSize_ : randomBlockSize_;
+    }
+    double getFlatRatio() const { return static_cast<double>(flatPct_) / 100.0; }
+    const IoWindow& getWindow() const { return window_; }
+    size_t getNrepeats() const { return nRepeats_; }
+    double getRepeatGap() const { return repeatGap_; }
+    const std::string& getStoreDir() const { return storeDir_; }
+    bool isDepthTracking() const { return depthIntervalUs_ > 0; }
+    size_t getDepthInterval() const { return depthIntervalUs_; }
+    /**
+     * Number of IOs in flight the run is configured to keep.
+     * The queue of the thread pool is not in flight.
+     */
+    size_t getTargetDepth() const { return nthreads_ == 0 ? queueSize_ : nthreads_; }
+
+    /**
+     * Resolve and check the window for the target device.
+     */
+    void resolveWindow(const BlockDevice& bd) {
+
+        window_.resolve(bd, blockSize_, isDirect_);
+        if (startBlockId_ >= window_.getSize() / blockSize_) {
+            throw std::runtime_error("start block id (-s) must be in the window.");
+        }
+        if (isPrecondition_) {
+            window_.resolve(bd, getRandomBlockSize(), isDirect_);
+            const size_t lbs = bd.getLogicalBlockSize();
+            if (getRandomBlockSize() % lbs != 0) {
+                std::stringstream ss;
+                ss << "random blocksize (-k) must be a multiple of the logical block size "
+                   << lbs << ".";
+                throw std::runtime_error(ss.str());
+            }
+        }
+    }
 
 private:
     void parse(int argc, char* argv[]) {
@@ -121,7 +261,7 @@ private:
         programName_ = argv[0];
         
         while (1) {
-            int c = ::getopt(argc, argv, "s:b:p:c:t:q:wrvh");
+            int c = ::getopt(argc, argv, "s:b:p:c:t:q:j:l:R:k:f:S:O:E:A:n:g:Q:I:wWBdrvh");
 
             if (c < 0) { break; }
 
@@ -147,6 +287,57 @@ private:
             case 'q': /* queueSize */
                 queueSize_ = ::atol(optarg);
                 break;
+            case 'j': /* dequeue batch size */
+                dequeueBatchSize_ = ::atol(optarg);
+                break;
+            case 'B': /* buffered IO */
+                isDirect_ = false;
+                break;
+            case 'd': /* drop page cache */
+                isDropCache_ = true;
+                break;
+            case 'l': /* busy-poll */
+                isPoll_ = true;
+                pollBudget_ = ::atol(optarg);
+                break;
+            case 'O': /* window start */
+                windowBegin_ = ::strtoull(optarg, NULL, 10);
+                break;
+            case 'E': /* window end */
+                windowEnd_ = ::strtoull(optarg, NULL, 10);
+                break;
+            case 'A': /* misalignment */
+                misalign_ = ::atol(optarg);
+                break;
+            case 'W': /* precondition */
+                isPrecondition_ = true;
+                mode_ = WRITE_MODE;
+                break;
+            case 'R': /* random passes */
+                nRandomPasses_ = ::atol(optarg);
+                break;
+            case 'k': /* random blocksize */
+                randomBlockSize_ = ::atol(optarg);
+                break;
+            case 'f': /* flat threshold */
+                flatPct_ = ::atol(optarg);
+                break;
+            case 'S': /* random seed */
+                seed_ = ::strtoull(optarg, NULL, 10);
+                hasSeed_ = true;
+                break;
+            case 'n': /* repetitions */
+                nRepeats_ = ::atol(optarg);
+                break;
+            case 'g': /* gap between repetitions */
+                repeatGap_ = ::atof(optarg);
+                break;
+            case 'Q': /* results store */
+                storeDir_ = optarg;
+                break;
+            case 'I': /* depth tracking */
+                depthIntervalUs_ = ::atol(optarg);
+                break;
             case 'r': /* show each response */
                 isShowEachResponse_ = true;
                 break;
@@ -169,15 +360,48 @@ private:
         if (args_.size() != 1 || blockSize_ == 0) {
             throw std::runtime_error("specify blocksize (-b), and device.");
         }
-        if (period_ == 0 && count_ == 0) {
+        if (period_ == 0 && count_ == 0 && !isPrecondition_) {
             throw std::runtime_error("specify period (-p) or count (-c).");
         }
+        if (isPoll_ && nthreads_ != 0 && !isPrecondition_) {
+            throw std::runtime_error("busy-poll (-l) is available only with -t 0.");
+        }
         if (queueSize_ == 0) {
             throw std::runtime_error("queue size (-q) must be 1 or more.");
         }
+        if (dequeueBatchSize_ == 0) {
+            throw std::runtime_error("dequeue batch size (-j) must be 1 or more.");
+        }
+        if (nRepeats_ == 0) {
+            throw std::runtime_error("repetitions (-n) must be 1 or more.");
+        }
+        if (repeatGap_ < 0) {
+            throw std::runtime_error("repetition gap (-g) must not be negative.");
+        }
+        if (nRepeats_ > 1 && isPrecondition_) {
+            throw std::runtime_error("repetitions (-n) are not available with -W.");
+        }
+        if (depthIntervalUs_ > 0 && isPrecondition_) {
+            throw std::runtime_error("depth tracking (-I) is not available with -W.");
+        }
     }
 };
 
+/**
+ * Drop page cache if required, and print page cache residency
+ * from the start block to the end of the window. This does nothing for direct IO.
+ * @when "before" or "after". Page cache is dropped only before.
+ */
+void checkPageCache(const Options& opt, const char* when)
+{
+    if (opt.isDirect()) { return; }
+
+    const bool shouldDrop = opt.isDropCache() && ::strcmp(when, "before") == 0;
+    const uint64_t oft = opt.getWindow().getBase() + opt.getStartBlockId() * opt.getBlockSize();
+    ::checkPageCache(opt.getArgs()[0], when, shouldDrop, oft,
+                     oft < opt.getWindow().getEnd() ? opt.getWindow().getEnd() - oft : 0);
+}
+
 /**
  * IO throughptu benchmark.
  * This is mutli-threaded.
@@ -192,6 +416,9 @@ private:
     const unsigned int nThreads_;
     const unsigned queueSize_;
     const bool isShowEachResponse_;
+    const bool isDirect_;
+    const IoWindow window_;
+    const unsigned int dequeueBatchSize_;
     size_t maxBlockId_;
     
     class ThreadLocalData
@@ -199,14 +426,17 @@ private:
     private:
         char *buf_;
         BlockDevice bd_;
-        std::queue<IoLog> logQ_;
         size_t blockSize_;
-        PerformanceStatistics stat_;
+        IoRecorder recorder_;
+        CpuTime cpu_;
 
     public:
-        ThreadLocalData(BlockDevice&& bd, size_t blockSize)
+        ThreadLocalData(BlockDevice&& bd, size_t blockSize,
+                        unsigned int threadId, bool isShowEachResponse)
             : bd_(std::move(bd))
-            , blockSize_(blockSize) {
+            , blockSize_(blockSize)
+            , recorder_(threadId, blockSize, isShowEachResponse)
+            , cpu_() {
 
             size_t alignSize = 512;
             while (alignSize < blockSize) {
@@ -219,9 +449,9 @@ private:
         explicit ThreadLocalData(ThreadLocalData&& rhs)
             : buf_(rhs.buf_)
             , bd_(std::move(rhs.bd_))
-            , logQ_(std::move(rhs.logQ_))
             , blockSize_(rhs.blockSize_)
-            , stat_(rhs.stat_) {
+            , recorder_(std::move(rhs.recorder_))
+            , cpu_(rhs.cpu_) {
 
             rhs.buf_ = nullptr;
         }
@@ -229,9 +459,9 @@ private:
 
             buf_ = rhs.buf_; rhs.buf_ = nullptr;
             bd_ = std::move(rhs.bd_);
-            logQ_ = std::move(rhs.logQ_);
             blockSize_ = rhs.blockSize_;
-            stat_ = rhs.stat_;
+            recorder_ = std::move(rhs.recorder_);
+            cpu_ = rhs.cpu_;
             return *this;
         }
         
@@ -240,8 +470,10 @@ private:
         BlockDevice& getBlockDevice() { return bd_; }
         size_t getBlockDeviceSize() const { return bd_.getDeviceSize() / blockSize_; }
         char* getBuffer() { return buf_; }
-        std::queue<IoLog>& getLogQueue() { return logQ_; }
-        PerformanceStatistics& getPerformanceStatistics() { return stat_; }
+        IoRecorder& getRecorder() { return recorder_; }
+        CpuTime& getCpu() { return cpu_; }
+        std::queue<IoLog>& getLogQueue() { return recorder_.getLogQueue(); }
+        PerformanceStatistics& getPerformanceStatistics() { return recorder_.getStat(); }
 
     private:
         
@@ -254,15 +486,22 @@ public:
      * @param bs block size.
      * @param nBlocks disk size as number of blocks.
      * @param startBlockId 
+     * @param window block ids are relative to the window.
+     * @param dequeueBatchSize number of blocks a worker takes at once.
      */
     IoThroughputBench(const std::string& name, const Mode mode, size_t blockSize,
-                      unsigned int nThreads, unsigned queueSize, bool isShowEachResponse)
+                      unsigned int nThreads, unsigned queueSize, bool isShowEachResponse,
+                      bool isDirect, const IoWindow& window,
+                      unsigned int dequeueBatchSize = 1)
         : name_(name)
         , mode_(mode)
         , blockSize_(blockSize)
         , nThreads_(nThreads)
         , queueSize_(queueSize)
-        , isShowEachResponse_(isShowEachResponse) {
+        , isShowEachResponse_(isShowEachResponse)
+        , isDirect_(isDirect)
+        , window_(window)
+        , dequeueBatchSize_(dequeueBatchSize) {
 #if 0
         ::printf("blockSize %zu nThreads %u isShowEachResponse %d\n",
                  blockSize_, nThreads_, isShowEachResponse_);
@@ -270,13 +509,12 @@ public:
         assert(nThreads > 0);
         for (unsigned int i = 0; i < nThreads; i++) {
 
-            bool isDirect = true;
-            BlockDevice bd(name, mode, isDirect);
-            ThreadLocalData threadLocal(std::move(bd), blockSize);
+            BlockDevice bd(name, mode, isDirect_);
+            ThreadLocalData threadLocal(std::move(bd), blockSize, i, isShowEachResponse_);
             threadLocal_.push_back(std::move(threadLocal));
         }
         assert(threadLocal_.size() == nThreads);
-        maxBlockId_ = threadLocal_[0].getBlockDeviceSize();
+        maxBlockId_ = window_.getSize() / blockSize_;
     }
     ~IoThroughputBench() noexcept {}
 
@@ -286,16 +524,19 @@ public:
      */
     void execNtimes(size_t n, size_t startBlockId) {
 
-        ThreadPoolWithId<size_t> threadPool(
-            nThreads_, queueSize_,
-            [&](size_t blockId, unsigned int id) {
-                this->doWork(blockId, id);
-            });
+        auto worker = [this](size_t blockId, unsigned int id) {
+            this->doWork(blockId, id);
+        };
+        ThreadPoolWithId<size_t, thread_pool::ThreadPoolBase<size_t>, decltype(worker)>
+            threadPool(nThreads_, queueSize_, worker, dequeueBatchSize_);
 
         size_t endBlockId = std::min(maxBlockId_, startBlockId + n);
         
-        for (size_t i = startBlockId; i < endBlockId; i++) {
-            threadPool.submit(i);
+        BlockIdIterator it(startBlockId);
+        while (*it < endBlockId) {
+            const size_t k = std::min<size_t>(queueSize_, endBlockId - *it);
+            if (threadPool.submitN(it, k) < k) { break; }
+            it = BlockIdIterator(*it + k);
         }
         threadPool.flush(); threadPool.stop(); threadPool.join();
         threadPool.get(); //may throw an excpetion
@@ -308,23 +549,23 @@ public:
      */
     void execNsecs(size_t runPeriodInSec, size_t startBlockId) {
         
-        ThreadPoolWithId<size_t> threadPool(
-            nThreads_, queueSize_,
-            [&](size_t blockId, unsigned int id) {
-                this->doWork(blockId, id);
-            });
+        auto worker = [this](size_t blockId, unsigned int id) {
+            this->doWork(blockId, id);
+        };
+        ThreadPoolWithId<size_t, thread_pool::ThreadPoolBase<size_t>, decltype(worker)>
+            threadPool(nThreads_, queueSize_, worker, dequeueBatchSize_);
         
         std::atomic<bool> shouldStop(false);
         std::thread th([&] {
                 size_t blockId = startBlockId;
                 while (!shouldStop.load()) {
-                    threadPool.submit(blockId);
-                    blockId++;
                     if (blockId >= maxBlockId_) {
                         threadPool.flush();
                         threadPool.stop();
                         break;
                     }
+                    const size_t k = std::min<size_t>(queueSize_, maxBlockId_ - blockId);
+                    blockId += threadPool.submitN(BlockIdIterator(blockId), k);
                 }
             });
         threadPool.waitFor(std::chrono::seconds(runPeriodInSec));
@@ -335,11 +576,45 @@ public:
                           //if errors have been occurred.
     }
     
+    /**
+     * Count IOs in flight of the threads in a depth tracker, or nullptr.
+     */
+    void setDepthTracker(DepthTracker* depth) {
+
+        for (ThreadLocalData& tLocal : threadLocal_) {
+            tLocal.getRecorder().setDepthTracker(depth);
+        }
+    }
+
     PerformanceStatistics getStat(unsigned int id) {
 
         return threadLocal_[id].getPerformanceStatistics();
     }
 
+    LatencyHistogram getMergedHist() {
+
+        LatencyHistogram hist;
+        for (ThreadLocalData& tLocal : threadLocal_) {
+            hist.merge(tLocal.getRecorder().getHist());
+        }
+        return hist;
+    }
+
+    /**
+     * CPU usage and migrations of each thread.
+     */
+    std::vector<WorkerCpu> getWorkerCpus() {
+
+        std::vector<WorkerCpu> ret;
+        for (ThreadLocalData& tLocal : threadLocal_) {
+            WorkerCpu w;
+            w.cpu = tLocal.getCpu();
+            w.nMigrations = tLocal.getRecorder().getNMigrations();
+            ret.push_back(w);
+        }
+        return ret;
+    }
+
     PerformanceStatistics getMergedStat() {
         
         auto li = getStatsList();
@@ -356,43 +631,75 @@ public:
 
 private:
     /**
-     * Execute an IO.
-     *
-     * @blockId block id [block]
-     * @id Thread id (starting from 0).
+     * Iterator of sequential block ids to submit a batch.
      */
-    void doWork(size_t blockId, unsigned int id) {
+    class BlockIdIterator
+    {
+    private:
+        size_t blockId_;
+    public:
+        explicit BlockIdIterator(size_t blockId) : blockId_(blockId) {}
+        size_t operator*() const { return blockId_; }
+        BlockIdIterator& operator++() { blockId_++; return *this; }
+    };
+
+    /**
+     * Add CPU usage of a pool thread from its first IO until it exits.
+     * The pool threads exit before the pool is joined.
+     */
+    class ThreadCpuMeter
+    {
+    private:
+        CpuTime* cpu_;
+        CpuTime begin_;
 
-        bool isWrite = (mode_ == WRITE_MODE);
+    public:
+        ThreadCpuMeter() : cpu_(nullptr), begin_() {}
+        ~ThreadCpuMeter() noexcept { stop(); }
 
-        auto& tLocal = threadLocal_[id];
-        auto& bd = tLocal.getBlockDevice();
-        char* buf = tLocal.getBuffer();
-        auto& stat = tLocal.getPerformanceStatistics();
-        
-        IoLog log = execBlockIO(bd, id, isWrite, blockId, buf);
+        void start(CpuTime* cpu) {
 
-        if (isShowEachResponse_) { tLocal.getLogQueue().push(log); }
-        stat.updateRt(log.response);
-    }
+            if (cpu_ == cpu) { return; }
+            stop();
+            begin_ = CpuTime::get(RUSAGE_THREAD);
+            cpu_ = cpu;
+        }
+
+    private:
+        void stop() noexcept {
+
+            if (!cpu_) { return; }
+            try {
+                *cpu_ += CpuTime::get(RUSAGE_THREAD) - begin_;
+            } catch (...) {
+            }
+            cpu_ = nullptr;
+        }
+    };
 
     /**
-     * @return IO log.
+     * Execute an IO.
+     *
+     * @blockId block id [block]
+     * @id Thread id (starting from 0).
      */
-    IoLog execBlockIO(BlockDevice& bd, unsigned int threadId, bool isWrite, size_t blockId, char* buf) {
-        
-        double begin, end;
-        size_t oft = blockId * blockSize_;
-        begin = getTime();
-        
-        if (isWrite) {
-            bd.write(oft, blockSize_, buf);
-        } else {
-            bd.read(oft, blockSize_, buf);
-        }
-        end = getTime();
+    void doWork(size_t blockId, unsigned int id) {
 
-        return IoLog(threadId, isWrite, blockId, begin, end - begin);
+        auto& tLocal = threadLocal_[id];
+        static thread_local ThreadCpuMeter meter;
+        meter.start(&tLocal.getCpu());
+        SyncEngine<BlockDevice> engine(tLocal.getBlockDevice());
+
+        IoSpec spec;
+        spec.op = (mode_ == WRITE_MODE) ? WRITE_OP : READ_OP;
+        spec.oft = window_.getBase() + blockId * blockSize_;
+        spec.size = blockSize_;
+        spec.due = 0;
+        spec.depth = 1;
+        engine.prepare(spec, tLocal.getBuffer());
+        tLocal.getRecorder().issue(1);
+        engine.submit();
+        tLocal.getRecorder().complete(engine.reap());
     }
 
     /**
@@ -408,16 +715,54 @@ private:
     }
 };
 
+/**
+ * Make the result of a run,
+ * and append it to the results store if -Q is specified.
+ * @hist latency histogram.
+ * @response average response time [second].
+ * @period elapsed time [second].
+ */
+RunResult saveResult(const Options& opt, const LatencyHistogram& hist,
+                     size_t nio, double response, double period)
+{
+    RunResult r;
+    r.pattern = "seq";
+    r.mode = opt.getMode() == WRITE_MODE ? "write" : "read";
+    r.nThreads = opt.getNthreads();
+    r.queueSize = opt.getQueueSize();
+    r.blockSize = opt.getBlockSize();
+    r.time = static_cast<uint64_t>(getTime());
+    r.nio = nio;
+    r.totalSize = nio * opt.getBlockSize();
+    r.period = period;
+    r.response = response;
+    r.hist = hist;
+    if (!opt.getStoreDir().empty()) {
+        ResultStore(opt.getStoreDir()).append(r);
+    }
+    return r;
+}
+
 /**
  * Use thread for parallel IO execution.
  */
-void execThreadExperiment(const Options& opt)
+RunResult execThreadExperiment(const Options& opt)
 {
     IoThroughputBench bench(
         opt.getArgs()[0], opt.getMode(), opt.getBlockSize(),
-        opt.getNthreads(), opt.getQueueSize(), opt.isShowEachResponse());
+        opt.getNthreads(), opt.getQueueSize(), opt.isShowEachResponse(),
+        opt.isDirect(), opt.getWindow(), opt.getDequeueBatchSize());
+    std::unique_ptr<DepthTracker> depth;
+    if (opt.isDepthTracking()) {
+        depth.reset(new DepthTracker(opt.getNthreads(), opt.getDepthInterval()));
+        bench.setDepthTracker(depth.get());
+    }
     
     double begin, end;
+    CpuTime cpuBegin, cpuEnd;
+    checkPageCache(opt, "before");
+    if (depth) { depth->start(); }
+    cpuBegin = CpuTime::get();
     begin = getTime();
     try {
         if (opt.getPeriod() > 0) {
@@ -429,6 +774,9 @@ void execThreadExperiment(const Options& opt)
         ::printf("EofError.\n");
     }
     end = getTime();
+    cpuEnd = CpuTime::get();
+    if (depth) { depth->stop(); }
+    checkPageCache(opt, "after");
 
     /* print each IO log. */
     if (opt.isShowEachResponse()) {
@@ -453,214 +801,258 @@ void execThreadExperiment(const Options& opt)
              "all ");
     stat.print();
     printThroughput(opt.getBlockSize(), stat.getCount(), end - begin);
+    printWorkerCpuCost(bench.getWorkerCpus(), cpuEnd - cpuBegin, stat.getCount(),
+                       stat.getCount() * opt.getBlockSize(), end - begin);
+    if (depth) {
+        depth->print(stat.getCount(), stat.getCount() == 0 ? 0.0 : stat.getAverage(),
+                     end - begin, opt.getTargetDepth());
+    }
+    return saveResult(opt, bench.getMergedHist(), stat.getCount(),
+                      stat.getCount() == 0 ? 0.0 : stat.getAverage(), end - begin);
 }
 
 
 /**
- * Asynchronous IO throughptu benchmark.
- * This is single-thread.
+ * Use aio for parallel IO execution.
  */
-class AioThroughputBench
+RunResult execAioExperiment(const Options& opt)
 {
-private:
-
-    const std::string name_;
-    const Mode mode_;
-    const size_t blockSize_; /* [byte] */
-    const unsigned int nThreads_;
-    const unsigned int queueSize_;
-    const bool isShowEachResponse_;
-
-    std::queue<IoLog> logQ_;
-    PerformanceStatistics stat_;
-    BlockDevice bd_;
-    Aio aio_;
-    const size_t maxBlockId_;
-    BlockBuffer bb_;
-
-public:
-    /**
-     * @param dev block device.
-     * @param bs block size.
-     * @param nBlocks disk size as number of blocks.
-     * @param startBlockId 
-     */
-    AioThroughputBench(
-        const std::string& name, const Mode mode, size_t blockSize,
-        unsigned int nThreads, unsigned int queueSize, bool isShowEachResponse)
-        : name_(name)
-        , mode_(mode)
-        , blockSize_(blockSize)
-        , nThreads_(nThreads)
-        , queueSize_(queueSize)
-        , isShowEachResponse_(isShowEachResponse)
-        , bd_(name, mode, true)
-        , aio_(bd_.getFd(), queueSize)
-        , maxBlockId_(bd_.getDeviceSize() / blockSize)
-        , bb_(queueSize_ * 2, blockSize_) {
-#if 0
-        ::printf("blockSize %zu nThreads %u isShowEachResponse %d\n",
-                 blockSize_, nThreads_, isShowEachResponse_);
-#endif
-        assert(nThreads == 0);
-        assert(queueSize > 0);
+    assert(opt.getNthreads() == 0);
+    BlockDevice bd(opt.getArgs()[0], opt.getMode(), opt.isDirect());
+    AioEngine engine(bd, opt.getQueueSize());
+    if (opt.isPoll()) {
+        engine.getAio().setPolling(opt.getPollBudget());
+    }
+    SequentialPattern pattern(opt.getBlockSize(),
+                              opt.getMode() == WRITE_MODE ? WRITE_OP : READ_OP,
+                              opt.getStartBlockId(),
+                              opt.getWindow().getSize() / opt.getBlockSize());
+    WindowPattern<SequentialPattern> windowPattern(pattern, opt.getWindow());
+    IoRecorder recorder(0, opt.getBlockSize(), opt.isShowEachResponse());
+    IoWorkload<AioEngine, WindowPattern<SequentialPattern> > workload(
+        engine, windowPattern, recorder, opt.getBlockSize());
+    std::unique_ptr<DepthTracker> depth;
+    if (opt.isDepthTracking()) {
+        depth.reset(new DepthTracker(1, opt.getDepthInterval()));
+        recorder.setDepthTracker(depth.get());
     }
-    ~AioThroughputBench() noexcept {}
-
-    /**
-     * @n Number of blocks to issue.
-     * @startBlockId Start block id [block].
-     */
-    void execNtimes(size_t n, size_t startBlockId) {
-
-        size_t pending = 0;
-        size_t blockId = startBlockId;
-        size_t endBlockId = std::min(maxBlockId_, startBlockId + n);
 
-        /* Fill the queue. */
-        while (pending < queueSize_ && blockId < endBlockId) {
-            prepareIo(blockId++, bb_.next());
-            pending++;
+    double begin, end;
+    CpuTime cpuBegin, cpuEnd;
+    checkPageCache(opt, "before");
+    if (depth) { depth->start(); }
+    cpuBegin = CpuTime::get();
+    begin = getTime();
+    try {
+        if (opt.getPeriod() > 0) {
+            workload.execNsecs(opt.getPeriod());
+        } else {
+            workload.execNtimes(opt.getCount());
         }
-        aio_.submit();
-        /* Wait and fill. */
-        while (blockId < endBlockId) {
-
-            assert(pending == queueSize_);
-            
-            waitAnIo();
-            pending--;
+    } catch (const Aio::EofError& e) {
+        ::printf("EofError.\n");
+    }
+    end = getTime();
+    cpuEnd = CpuTime::get();
+    if (depth) { depth->stop(); }
+    checkPageCache(opt, "after");
 
-            prepareIo(blockId++, bb_.next());
-            pending++;
-            aio_.submit();
-        }
-        /* Wait remaining. */
-        while (pending > 0) {
-            waitAnIo();
-            pending--;
+    /* print each IO log. */
+    if (opt.isShowEachResponse()) {
+        auto& logQ = recorder.getLogQueue();
+        while (!logQ.empty()) {
+            logQ.front().print();
+            logQ.pop();
         }
     }
 
-    /**
-     * @runPeriodInSec Run period [second].
-     * @startBlockId Start block id [block].
-     */
-    void execNsecs(size_t runPeriodInSec, size_t startBlockId) {
-        
-        size_t pending = 0;
-        size_t blockId = startBlockId;
+    /* Statistics */
+    auto& stat = recorder.getStat();
+    ::printf("all ");
+    stat.print();
+    printThroughput(opt.getBlockSize(), stat.getCount(), end - begin);
+    printPollStatistics(engine.getAio());
+    printCpuTime(cpuEnd - cpuBegin, stat.getCount(),
+                 stat.getCount() * opt.getBlockSize(), end - begin);
+    if (depth) {
+        depth->print(stat.getCount(), stat.getCount() == 0 ? 0.0 : stat.getAverage(),
+                     end - begin, opt.getTargetDepth());
+    }
+    return saveResult(opt, recorder.getHist(), stat.getCount(),
+                      stat.getCount() == 0 ? 0.0 : stat.getAverage(), end - begin);
+}
 
-        double beginTime, endTime;
-        beginTime = getTime();
-        endTime = beginTime;
-        
-        /* Fill the queue. */
-        while (pending < queueSize_ && blockId < maxBlockId_) {
-            prepareIo(blockId++, bb_.next());
-            pending++;
-        }
-        aio_.submit();
-        /* Wait and fill. */
-        while (endTime - beginTime < static_cast<double>(runPeriodInSec)
-               && blockId < maxBlockId_) {
+/**
+ * Pattern counting bytes issued, to be read by another thread.
+ */
+template<typename Pattern>
+class CountingPattern
+{
+private:
+    Pattern& pattern_;
+    std::atomic<size_t>& issued_; /* [byte] */
 
-            assert(pending == queueSize_);
-            
-            endTime = waitAnIo();
-            pending--;
+public:
+    CountingPattern(Pattern& pattern, std::atomic<size_t>& issued)
+        : pattern_(pattern)
+        , issued_(issued) {}
 
-            prepareIo(blockId++, bb_.next());
-            pending++;
-            aio_.submit();
-        }
-        /* Wait remaining. */
-        while (pending > 0) {
-            waitAnIo();
-            pending--;
+    bool next(IoSpec& spec) {
+
+        if (!pattern_.next(spec)) {
+            return false;
         }
+        issued_.fetch_add(spec.size, std::memory_order_relaxed);
+        return true;
     }
+};
 
-    /**
-     * Get the performance statistics.
-     */
-    PerformanceStatistics& getStat() {
-
-        return stat_;
+/**
+ * Write a part of the target with aio until the pattern is exhausted.
+ */
+template<typename Pattern>
+void do_precondition_work(const Options& opt, BlockDevice& bd, Pattern& pattern,
+                          std::atomic<size_t>& issued, size_t blockSize)
+{
+    AioEngine engine(bd, opt.getQueueSize());
+    if (opt.isPoll()) {
+        engine.getAio().setPolling(opt.getPollBudget());
     }
+    WindowPattern<Pattern> windowPattern(pattern, opt.getWindow());
+    CountingPattern<WindowPattern<Pattern> > counting(windowPattern, issued);
+    IoRecorder recorder(0, blockSize, false);
+    IoWorkload<AioEngine, CountingPattern<WindowPattern<Pattern> > > workload(
+        engine, counting, recorder, blockSize);
+    workload.exec(0, 0);
+}
 
-    /**
-     * Get the log queue of the thread with 'id'.
-     */
-    std::queue<IoLog>& getLogQueue() {
-        
-        return logQ_;
+/**
+ * Execute a pass of preconditioning.
+ * @pass 0 for the sequential pass, and 1 or more for random passes.
+ * RETURN:
+ *   throughput of the pass [byte/second].
+ */
+double execPreconditionPass(const Options& opt, size_t pass, uint64_t seed)
+{
+    const size_t nthreads = std::max<size_t>(1, opt.getNthreads());
+    const size_t blockSize = (pass == 0) ? opt.getBlockSize() : opt.getRandomBlockSize();
+    std::vector<std::unique_ptr<BlockDevice> > bds;
+    for (size_t i = 0; i < nthreads; i++) {
+        bds.emplace_back(new BlockDevice(opt.getArgs()[0], WRITE_MODE, opt.isDirect()));
     }
-
-private:
-    void prepareIo(size_t blockId, char *buf) {
-
-        if (mode_ == WRITE_MODE) {
-            aio_.prepareWrite(blockId * blockSize_, blockSize_, buf);
-        } else {
-            aio_.prepareRead(blockId * blockSize_, blockSize_, buf);
-        }
+    const size_t nBlocks = opt.getWindow().getSize() / blockSize;
+    const size_t totalSize = nBlocks * blockSize;
+    std::unique_ptr<std::atomic<size_t>[]> issued(new std::atomic<size_t>[nthreads]);
+    for (size_t i = 0; i < nthreads; i++) {
+        issued[i].store(0);
     }
+    auto getIssued = [&]() {
+        size_t sum = 0;
+        for (size_t i = 0; i < nthreads; i++) {
+            sum += issued[i].load(std::memory_order_relaxed);
+        }
+        return sum;
+    };
 
-    double waitAnIo() {
+    const double begin = getTime();
+    std::vector<std::future<void> > workers;
+    for (size_t i = 0; i < nthreads; i++) {
+        workers.push_back(std::async(std::launch::async, [&, i] {
+                    if (pass == 0) {
+                        SequentialPattern pattern(blockSize, WRITE_OP,
+                                                  nBlocks * i / nthreads,
+                                                  nBlocks * (i + 1) / nthreads);
+                        do_precondition_work(opt, *bds[i], pattern, issued[i], blockSize);
+                    } else {
+                        PermutationPattern pattern(blockSize, nBlocks, totalSize,
+                                                   OpMix(WRITE_MODE), blockSize,
+                                                   seed + pass, i, nthreads);
+                        do_precondition_work(opt, *bds[i], pattern, issued[i], blockSize);
+                    }
+                }));
+    }
 
-        auto* ptr = aio_.waitOne();
-        auto log = toIoLog(ptr);
-        stat_.updateRt(log.response);
-        if (isShowEachResponse_) { 
-            logQ_.push(log);
+    /* Print progress every second until all workers end. */
+    const double interval = 1.0;
+    double prevTime = begin;
+    size_t prevIssued = 0;
+    size_t i = 0;
+    while (i < workers.size()) {
+        const double wait = std::max(0.0, prevTime + interval - getTime());
+        if (workers[i].wait_for(std::chrono::duration<double>(wait))
+            == std::future_status::ready) {
+            i++;
+            continue;
         }
-        return ptr->endTime;
+        const double now = getTime();
+        const size_t cur = getIssued();
+        const double throughput = static_cast<double>(cur - prevIssued) / (now - prevTime);
+        ::printf("progress pass %zu written %zu of %zu %.1f%% throughput %.3f B/s %s\n",
+                 pass, cur, totalSize, 100.0 * cur / totalSize,
+                 throughput, getDataThroughputString(throughput).c_str());
+        ::fflush(stdout);
+        prevTime = now;
+        prevIssued = cur;
     }
+    std::for_each(workers.begin(), workers.end(),
+                  [](std::future<void>& f) { f.get(); });
+    const double end = getTime();
+
+    const double throughput = static_cast<double>(totalSize) / (end - begin);
+    ::printf("pass %zu %s blocksize %zu written %zu period %.3f throughput %.3f B/s %s\n",
+             pass, pass == 0 ? "sequential" : "random", blockSize, totalSize, end - begin,
+             throughput, getDataThroughputString(throughput).c_str());
+    ::fflush(stdout);
+    return throughput;
+}
 
-    IoLog toIoLog(AioData *ptr) {
-
-        return IoLog(0, ptr->isWrite, ptr->oft / ptr->size,
-                     ptr->beginTime, ptr->endTime - ptr->beginTime);
+/**
+ * Fill the whole window sequentially, then overwrite it by random passes
+ * until the throughput of a pass flattens.
+ */
+void execPrecondition(const Options& opt)
+{
+    const uint64_t seed = opt.getSeed();
+    if (opt.getNrandomPasses() > 0) {
+        ::printf("seed %llu\n", static_cast<unsigned long long>(seed));
     }
-};
+    execPreconditionPass(opt, 0, seed);
+
+    double prev = 0;
+    for (size_t pass = 1; pass <= opt.getNrandomPasses(); pass++) {
+        const double cur = execPreconditionPass(opt, pass, seed);
+        if (pass > 1 && opt.getFlatRatio() > 0 &&
+            std::fabs(cur - prev) < prev * opt.getFlatRatio()) {
+            ::printf("flattened at pass %zu\n", pass);
+            break;
+        }
+        prev = cur;
+    }
+}
 
 /**
- * Use aio for parallel IO execution.
+ * Run the experiment -n times with -g idle gaps.
  */
-void execAioExperiment(const Options& opt)
+void execRepetitions(const Options& opt)
 {
-    AioThroughputBench bench(
-        opt.getArgs()[0], opt.getMode(), opt.getBlockSize(),
-        opt.getNthreads(), opt.getQueueSize(), opt.isShowEachResponse());
-    
-    double begin, end;
-    begin = getTime();
-    try {
-        if (opt.getPeriod() > 0) {
-            bench.execNsecs(opt.getPeriod(), opt.getStartBlockId());
+    std::vector<RunResult> runs;
+    for (size_t i = 0; i < opt.getNrepeats(); i++) {
+        if (i > 0) {
+            sleepUntil(getTime() + opt.getRepeatGap());
+        }
+        if (opt.getNrepeats() > 1) {
+            ::printf("repetition %zu\n", i);
+        }
+        if (opt.getNthreads() == 0) {
+            runs.push_back(execAioExperiment(opt));
         } else {
-            bench.execNtimes(opt.getCount(), opt.getStartBlockId());
+            runs.push_back(execThreadExperiment(opt));
         }
-    } catch (const Aio::EofError& e) {
-        ::printf("EofError.\n");
     }
-    end = getTime();
-
-    /* print each IO log. */
-    if (opt.isShowEachResponse()) {
-        auto& logQ = bench.getLogQueue();
-        while (!logQ.empty()) {
-            logQ.front().print();
-            logQ.pop();
-        }
+    if (runs.size() > 1) {
+        ::printf("----------------\n");
+        printRepetitions(runs);
     }
-
-    /* Statistics */
-    auto& stat = bench.getStat();
-    ::printf("all ");
-    stat.print();
-    printThroughput(opt.getBlockSize(), stat.getCount(), end - begin);
 }
 
 int main(int argc, char* argv[])
@@ -675,10 +1067,15 @@ int main(int argc, char* argv[])
         } else if (opt.isShowHelp()) {
             opt.showHelp();
         } else {
-            if (opt.getNthreads() == 0) {
-                execAioExperiment(opt);
+            {
+                BlockDevice bd(opt.getArgs()[0], READ_MODE, opt.isDirect());
+                printBlockSizes(bd);
+                opt.resolveWindow(bd);
+            }
+            if (opt.isPrecondition()) {
+                execPrecondition(opt);
             } else {
-                execThreadExperiment(opt);
+                execRepetitions(opt);
             }
         }
     } catch (const std::runtime_error& e) {
@@ -2,7 +2,9 @@
 #define RAND_HPP
 
 #include <random>
+#include <cstddef>
 #include <cstdint>
+#include <cassert>
 
 template<class T1, class T2>
 class Rand
@@ -56,4 +58,150 @@ public:
     }
 };
 
+/**
+ * Counter-based 64-bit random generator.
+ * The n-th value is the SplitMix64 finalizer of a key and n,
+ * so a sequence is determined by the seed and the stream only.
+ * Give each thread the same seed and a different stream.
+ */
+class CounterRand64
+{
+private:
+    static const uint64_t GAMMA = 0x9e3779b97f4a7c15ULL;
+
+    uint64_t key_;
+    uint64_t ctr_;
+
+public:
+    CounterRand64(uint64_t seed, uint64_t stream)
+        : key_(mix(mix(seed) + stream))
+        , ctr_(0) {}
+
+    uint64_t get() { return mix(key_ + (ctr_++) * GAMMA); }
+
+    /**
+     * Uniform value in [0, max) without modulo bias.
+     */
+    uint64_t get(uint64_t max) {
+
+        uint64_t r;
+        while (!reduce(get(), max, r)) {}
+        return r;
+    }
+
+    /**
+     * Fill n uniform values in [0, max).
+     * Values are generated in a loop without dependency between iterations,
+     * which the compiler can vectorize.
+     */
+    void getBatch(uint64_t max, uint64_t* out, size_t n) {
+
+        const uint64_t base = key_ + ctr_ * GAMMA;
+        for (size_t i = 0; i < n; i++) {
+            out[i] = mix(base + i * GAMMA);
+        }
+        ctr_ += n;
+        for (size_t i = 0; i < n; i++) {
+            if (!reduce(out[i], max, out[i])) {
+                out[i] = get(max);
+            }
+        }
+    }
+
+    static uint64_t mix(uint64_t z) {
+
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+private:
+    /**
+     * Lemire's multiply-shift reduction.
+     * Returns false if x must be rejected to avoid bias.
+     */
+    static bool reduce(uint64_t x, uint64_t max, uint64_t& r) {
+
+        const unsigned __int128 m = static_cast<unsigned __int128>(x) * max;
+        const uint64_t low = static_cast<uint64_t>(m);
+        if (low < max && low < (-max) % max) {
+            return false;
+        }
+        r = static_cast<uint64_t>(m >> 64);
+        return true;
+    }
+};
+
+/**
+ * Pseudo-random permutation of [0, n) with constant memory.
+ * A balanced Feistel network over the smallest domain of even bits
+ * covering n is a bijection, and cycle walking keeps it in [0, n).
+ * The domain is less than 4n, so a walk takes less than 4 steps on average.
+ */
+class FeistelPermutation
+{
+private:
+    static const size_t N_ROUNDS = 4;
+
+    uint64_t n_;
+    unsigned int halfBits_;
+    uint64_t mask_;
+    uint64_t keys_[N_ROUNDS];
+
+public:
+    FeistelPermutation(uint64_t n, uint64_t seed)
+        : n_(n)
+        , halfBits_(1)
+        , mask_(0) {
+
+        assert(n_ > 0);
+        while (halfBits_ < 32 && (static_cast<uint64_t>(1) << (halfBits_ * 2)) < n_) {
+            halfBits_++;
+        }
+        mask_ = (static_cast<uint64_t>(1) << halfBits_) - 1;
+        CounterRand64 rand(seed, 0);
+        for (size_t i = 0; i < N_ROUNDS; i++) {
+            keys_[i] = rand.get();
+        }
+    }
+
+    uint64_t size() const { return n_; }
+
+    /**
+     * The i-th element of the permutation.
+     * @i in [0, n).
+     */
+    uint64_t get(uint64_t i) const {
+
+        assert(i < n_);
+        uint64_t x = i;
+        do {
+            x = encrypt(x);
+        } while (x >= n_);
+        return x;
+    }
+
+private:
+    uint64_t encrypt(uint64_t x) const {
+
+        uint64_t l = x >> halfBits_;
+        uint64_t r = x & mask_;
+        for (size_t i = 0; i < N_ROUNDS; i++) {
+            const uint64_t t = l ^ (CounterRand64::mix(r ^ keys_[i]) & mask_);
+            l = r;
+            r = t;
+        }
+        return (l << halfBits_) | r;
+    }
+};
+
+/**
+ * Seed from the system random device, used when no seed is given.
+ */
+static inline uint64_t getRandomSeed()
+{
+    std::random_device rd;
+    return (static_cast<uint64_t>(rd()) << 32) | rd();
+}
+
 #endif //RAND_HPP
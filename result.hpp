@@ -0,0 +1,283 @@
+/**
+ * @file
+ * @brief Structured run results saved by iores -R, and statistics over runs.
+ *
+ * A result file is a sequence of records appended by runs,
+ * so repeated runs with the same file make a result set.
+ * Each record consists of the following lines.
+ *
+ *   result pattern PATTERN mode MODE threads N queue N bs BYTES seed SEED time UNIXTIME
+ *   total nio N size BYTES period SECONDS response SECONDS
+ *   interval COUNT:BYTES ...
+ *   hist INDEX:COUNT ...
+ *   end
+ *
+ * seed is the random seed of offsets, or 0 if the offsets are not random.
+ * interval lists IOs and bytes of each whole second of the run.
+ * hist lists non-empty buckets of LatencyHistogram.
+ */
+#ifndef RESULT_HPP
+#define RESULT_HPP
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <cassert>
+
+#include "util.hpp"
+
+/**
+ * Result of a run.
+ */
+struct RunResult
+{
+    std::string pattern; /* rnd, seq, perm, or trace. */
+    std::string mode; /* read, write, or mix. */
+    size_t nThreads; /* 0 means aio. */
+    size_t queueSize;
+    size_t blockSize; /* [byte] */
+    uint64_t seed; /* of random offsets. 0 means not random. */
+    uint64_t time; /* unix time at the end of the run [second] */
+
+    size_t nio;
+    size_t totalSize; /* read and written [byte] */
+    double period; /* [second] */
+    double response; /* average response time [second] */
+    std::vector<IntervalSeries::Sample> intervals;
+    LatencyHistogram hist;
+
+    RunResult()
+        : pattern(), mode(), nThreads(0), queueSize(0), blockSize(0), seed(0), time(0)
+        , nio(0), totalSize(0), period(0), response(0), intervals(), hist() {}
+
+    double getIops() const { return period <= 0 ? 0.0 : nio / period; }
+    double getThroughput() const { return period <= 0 ? 0.0 : totalSize / period; }
+
+    /**
+     * Append the record to a file.
+     */
+    void append(const std::string& path) const {
+
+        FILE* fp = ::fopen(path.c_str(), "a");
+        if (fp == NULL) {
+            throw std::runtime_error("open failed: " + path + " " + ::strerror(errno));
+        }
+        ::fprintf(fp, "result pattern %s mode %s threads %zu queue %zu bs %zu "
+                  "seed %llu time %llu\n",
+                  pattern.c_str(), mode.c_str(), nThreads, queueSize, blockSize,
+                  static_cast<unsigned long long>(seed),
+                  static_cast<unsigned long long>(time));
+        ::fprintf(fp, "total nio %zu size %zu period %.06f response %.09f\n",
+                  nio, totalSize, period, response);
+        ::fprintf(fp, "interval");
+        for (const IntervalSeries::Sample& s : intervals) {
+            ::fprintf(fp, " %zu:%zu", s.count, s.size);
+        }
+        ::fprintf(fp, "\nhist");
+        for (size_t i = 0; i < LatencyHistogram::getNBuckets(); i++) {
+            const uint64_t c = hist.getBucketCount(i);
+            if (c > 0) {
+                ::fprintf(fp, " %zu:%llu", i, static_cast<unsigned long long>(c));
+            }
+        }
+        ::fprintf(fp, "\nend\n");
+        const bool isError = ::ferror(fp);
+        if (::fclose(fp) != 0 || isError) {
+            throw std::runtime_error("write failed: " + path);
+        }
+    }
+
+    /**
+     * Load all the records of a file.
+     */
+    static std::vector<RunResult> load(const std::string& path) {
+
+        std::ifstream is(path.c_str());
+        if (!is) {
+            throw std::runtime_error("open failed: " + path);
+        }
+        std::vector<RunResult> v;
+        std::string line;
+        bool isInRecord = false;
+        while (std::getline(is, line)) {
+            std::istringstream ss(line);
+            std::string tag;
+            ss >> tag;
+            if (tag.empty()) {
+                continue;
+            }
+            if (tag == "result") {
+                v.push_back(RunResult());
+                isInRecord = true;
+                std::string key;
+                RunResult& r = v.back();
+                while (ss >> key) {
+                    if (key == "pattern") { ss >> r.pattern; }
+                    else if (key == "mode") { ss >> r.mode; }
+                    else if (key == "threads") { ss >> r.nThreads; }
+                    else if (key == "queue") { ss >> r.queueSize; }
+                    else if (key == "bs") { ss >> r.blockSize; }
+                    else if (key == "seed") { ss >> r.seed; }
+                    else if (key == "time") { ss >> r.time; }
+                    else { std::string ignored; ss >> ignored; }
+                }
+                continue;
+            }
+            if (!isInRecord) {
+                throw std::runtime_error("invalid result line: " + line);
+            }
+            RunResult& r = v.back();
+            if (tag == "total") {
+                std::string key;
+                while (ss >> key) {
+                    if (key == "nio") { ss >> r.nio; }
+                    else if (key == "size") { ss >> r.totalSize; }
+                    else if (key == "period") { ss >> r.period; }
+                    else if (key == "response") { ss >> r.response; }
+                    else { std::string ignored; ss >> ignored; }
+                }
+            } else if (tag == "interval") {
+                IntervalSeries::Sample s;
+                char colon;
+                while (ss >> s.count >> colon >> s.size) {
+                    r.intervals.push_back(s);
+                }
+            } else if (tag == "hist") {
+                size_t idx;
+                unsigned long long c;
+                char colon;
+                while (ss >> idx >> colon >> c) {
+                    if (idx >= LatencyHistogram::getNBuckets()) {
+                        throw std::runtime_error("invalid histogram bucket: " + line);
+                    }
+                    r.hist.addBucketCount(idx, c);
+                }
+            } else if (tag == "end") {
+                isInRecord = false;
+            } else {
+                throw std::runtime_error("invalid result line: " + line);
+            }
+        }
+        if (isInRecord) {
+            throw std::runtime_error("truncated result file: " + path);
+        }
+        return v;
+    }
+};
+
+/**
+ * 97.5 percentile of Student's t distribution.
+ * @df degrees of freedom.
+ */
+static inline double getT975(size_t df)
+{
+    static const double table[] = {
+        0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    const size_t n = sizeof(table) / sizeof(table[0]);
+    assert(df > 0);
+    return df < n ? table[df] : 1.960;
+}
+
+/**
+ * Mean, sample standard deviation, and 95% confidence interval of the mean.
+ */
+struct Summary
+{
+    double mean;
+    double stddev;
+    double lower;
+    double upper;
+
+    explicit Summary(const std::vector<double>& v)
+        : mean(0), stddev(0), lower(0), upper(0) {
+
+        if (v.empty()) { return; }
+        double total = 0;
+        for (double x : v) { total += x; }
+        mean = total / v.size();
+        lower = upper = mean;
+        if (v.size() < 2) { return; }
+        double sq = 0;
+        for (double x : v) { sq += (x - mean) * (x - mean); }
+        stddev = ::sqrt(sq / (v.size() - 1));
+        const double half = getT975(v.size() - 1) * stddev / ::sqrt(v.size());
+        lower = mean - half;
+        upper = mean + half;
+    }
+};
+
+/**
+ * Indexes of outliers whose modified z-score,
+ * 0.6745 * |x - median| / MAD, exceeds 3.5.
+ * Nothing is flagged with less than 5 values or zero MAD,
+ * where MAD of a few values is too small to tell outliers.
+ */
+static inline std::vector<size_t> getOutliers(const std::vector<double>& v)
+{
+    std::vector<size_t> ret;
+    if (v.size() < 5) { return ret; }
+    auto median = [](std::vector<double> w) {
+        std::sort(w.begin(), w.end());
+        const size_t n = w.size();
+        return n % 2 == 1 ? w[n / 2] : (w[n / 2 - 1] + w[n / 2]) / 2;
+    };
+    const double med = median(v);
+    std::vector<double> dev;
+    for (double x : v) { dev.push_back(::fabs(x - med)); }
+    const double mad = median(dev);
+    if (mad <= 0) { return ret; }
+    for (size_t i = 0; i < v.size(); i++) {
+        if (0.6745 * dev[i] / mad > 3.5) {
+            ret.push_back(i);
+        }
+    }
+    return ret;
+}
+
+/**
+ * Print each repetition of a run and statistics over them.
+ * Percentiles are shown if the runs have latency histograms.
+ */
+static inline void printRepetitions(const std::vector<RunResult>& runs)
+{
+    const bool hasHist = !runs.empty() && runs[0].hist.getCount() > 0;
+    const char* names[] = {"iops", "throughput", "p50", "p99", "p99.9"};
+    const size_t nMetrics = hasHist ? 5 : 2;
+    std::vector<std::vector<double> > values(nMetrics);
+    for (size_t i = 0; i < runs.size(); i++) {
+        const RunResult& r = runs[i];
+        const double v[] = {
+            r.getIops(), r.getThroughput(),
+            r.hist.getPercentile(50), r.hist.getPercentile(99), r.hist.getPercentile(99.9),
+        };
+        ::printf("rep %zu", i);
+        for (size_t j = 0; j < nMetrics; j++) {
+            ::printf(j < 2 ? " %s %.3f" : " %s %.06f", names[j], v[j]);
+            values[j].push_back(v[j]);
+        }
+        ::printf("\n");
+    }
+    for (size_t j = 0; j < nMetrics; j++) {
+        const Summary s(values[j]);
+        const char* fmt = j < 2
+            ? "rep-summary %s mean %.3f stddev %.3f ci95 %.3f %.3f\n"
+            : "rep-summary %s mean %.06f stddev %.06f ci95 %.06f %.06f\n";
+        ::printf(fmt, names[j], s.mean, s.stddev, s.lower, s.upper);
+        for (size_t i : getOutliers(values[j])) {
+            ::printf("rep-outlier %zu %s\n", i, names[j]);
+        }
+    }
+}
+
+#endif /* RESULT_HPP */
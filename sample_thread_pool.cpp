@@ -1,5 +1,6 @@
 /**
  * Test code for thread_pool.hpp header.
+ * See bench_thread_pool.cpp for performance measurement.
  */
 #include "thread_pool.hpp"
 
@@ -56,44 +57,6 @@ void testThreadPoolWithTask()
     finalizer.join();
 }
 
-size_t testThreadPoolOverhead(
-    int nEnqueThreads, int nDequeueThreads, int workQueueSize, int runPeriodMs)
-{
-    std::atomic<size_t> count(0);
-
-    std::function<void(int)> counter([&](int i) {
-            size_t s;
-            do {
-                s = count;
-            } while(!count.compare_exchange_strong(s, s + 1));
-        });
-
-    ThreadPool<int> threadPool(nDequeueThreads, workQueueSize, counter);
-
-    std::vector<std::thread> workers;
-    std::atomic<bool> shouldStop(false);
-    for (int i = 0; i < nEnqueThreads; i ++) {
-
-        std::thread th([&]{
-                while (!shouldStop.load()) {
-                    threadPool.submit(0);
-                }
-            });
-        workers.push_back(std::move(th));
-    }
-
-    std::this_thread::sleep_for(std::chrono::milliseconds(runPeriodMs));
-    shouldStop.store(true);
-
-    std::for_each(workers.begin(), workers.end(), [](std::thread& th) {
-            th.join();
-        });
-
-    threadPool.flush();
-    size_t total = count;
-    return total;
-}
-
 void testThreadPoolWithId()
 {
 
@@ -112,93 +75,70 @@ void testThreadPoolWithId()
     threadPool.flush();
 }
 
-
-void testCounterWithCas(int nThreads, size_t runPeriod)
+/**
+ * Thread pool test with the worker function type given.
+ * The worker function is inlined without std::function.
+ */
+void testThreadPoolWithIdInlined()
 {
-    // Performance of counter with CAS.
-    std::atomic<size_t> count(0);
-    std::atomic<bool> shouldStop(false);
-    std::vector<std::thread> threads;
-    threads.reserve(nThreads);
-    threads.push_back(std::move(std::thread([&] {
-                    size_t s;
-                    while (!shouldStop.load()) {
-                        s = count;
-                        count.compare_exchange_strong(s, s + 1);
-                    }
-                })));
-    std::this_thread::sleep_for(std::chrono::seconds(runPeriod));
-    shouldStop.store(true);
-    
-    std::for_each(threads.begin(), threads.end(), [](std::thread& th) {
-            th.join();
-        });
-    size_t s = count;
-    printf("testCounterWithCas %zu in %zu secs with %d threads (%zu num/s)\n", s, runPeriod, nThreads, s / runPeriod);
-        
+    std::atomic<int> sum(0);
+    auto f = [&](int i, unsigned int id) {
+
+        printf("Thread %u working with item %d.\n", id, i);
+        sum += i;
+    };
+
+    ThreadPoolWithId<int, thread_pool::ThreadPoolBase<int>, decltype(f)> threadPool(4, 16, f);
+
+    for (int i = 0; i < 20; i ++) {
+        threadPool.submit(i);
+    }
+
+    threadPool.flush();
+    printf("testThreadPoolWithIdInlined sum %d.\n", sum.load());
 }
 
 /**
- * Performance with a normal counter.
+ * Work-stealing thread pool test.
+ * Tasks submitted by workers are pushed to their own deques
+ * and stolen by idle workers.
  */
-void testCounter(size_t runPeriod)
+void testWorkStealingThreadPoolWithId()
 {
-    std::atomic<bool> shouldStop(false);
-    size_t s = 0;
-    std::thread th([&] {
-            while (!shouldStop.load()) {
-                s ++;
+    const int nTasks = 20;
+    const int depth = 3;
+    const int nExpected = nTasks * ((1 << (depth + 1)) - 1);
+    std::atomic<int> count(0);
+    std::unique_ptr<WorkStealingThreadPoolWithId<int> > threadPool;
+
+    std::function<void(int, unsigned int)> f([&](int d, unsigned int id) {
+
+            printf("Thread %u working with depth %d.\n", id, d);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            if (d < depth) {
+                threadPool->submit(d + 1);
+                threadPool->submit(d + 1);
             }
+            count++;
         });
-    std::this_thread::sleep_for(std::chrono::seconds(runPeriod));
-    shouldStop.store(true);
-    th.join();
-    printf("testCounter %zu in %zu secs (%zu num/s)\n", s, runPeriod, s / runPeriod);
+
+    threadPool.reset(new WorkStealingThreadPoolWithId<int>(4, 64, f));
+    for (int i = 0; i < nTasks; i ++) {
+        threadPool->submit(0);
+    }
+    while (count.load() < nExpected) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    threadPool->flush();
+    printf("testWorkStealingThreadPoolWithId %d tasks done.\n", count.load());
 }
 
 
 int main()
 {
-#if 0
-    {
-        testCounter(3);
-        testCounterWithCas(1, 3);
-        testCounterWithCas(2, 3);
-        testCounterWithCas(3, 3);
-        testCounterWithCas(4, 3);
-    }
-    {
-        testThreadPoolWithTask();
-    }
-#endif
-#if 1
-    {
-        for (int i = 0; i < 1; i ++) {
-            for (int j = 0; j < 4; j ++) {
-                for (int k = 0; k < 4; k ++) {
-                    size_t nEnq = i + 1;
-                    size_t nDeq = j + 1;
-                    int queueSize = (k + 1) * 8;
-                    printf("%zu %zu %2d %10zu\n", nEnq, nDeq, queueSize,
-                           testThreadPoolOverhead(nEnq, nDeq, queueSize, 1000));
-                }
-            }
-        }
-    }
-#endif
-#if 0
-    {
-        int nEnq = 1;
-        int nDeq = 1;
-        int queueSize = 16;
-        int runPeriodMs = 5000;
-        size_t count = testThreadPoolOverhead(nEnq, nDeq, queueSize, runPeriodMs);
-        printf("nEnq %d nDeq %d qSize %2d count %10zu ops %10zu\n",
-               nEnq, nDeq, queueSize, count, count / (runPeriodMs / 1000));
-    }
-    {
-        testThreadPoolWithId();
-    }
-#endif
+    testThreadPoolWithTask();
+    testThreadPoolWithId();
+    testThreadPoolWithIdInlined();
+    testWorkStealingThreadPoolWithId();
     return 0;
 }
@@ -42,6 +42,19 @@ get_response()
   rm -f 1.$$ 2.$$
 }
 
+# The same tables from a results store of iores/ioth -Q.
+get_throughput_store()
+{
+  local store=$1 #results store directory.
+  ioq -g pattern,mode,nThreads,blockSize -c Bps,iops $store
+}
+
+get_response_store()
+{
+  local store=$1 #results store directory.
+  ioq -g pattern,mode,nThreads,blockSize -c response $store
+}
+
 get_histogram()
 {
   local d=$1 #directory
@@ -70,5 +83,6 @@ get_all_histograms()
 
 #get_throughput > throughput.plot
 #get_response > response.plot
+#get_throughput_store ./store > throughput.plot
 #get_all_histograms
 #get_histogram ./seq/read/4/32768 0.001
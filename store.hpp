@@ -0,0 +1,294 @@
+/**
+ * @file
+ * @brief Columnar results store appended by iores and ioth -Q, and queried by ioq.
+ *
+ * A store is a directory with a file per column.
+ * Each column file is an array of 8-byte values in host byte order,
+ * a value per run, so a query reads only the columns it needs.
+ * Appenders are serialized by flock() of the lock file in the directory.
+ * A row torn by a crash is ignored because the number of rows is
+ * the length of the shortest column.
+ */
+#ifndef STORE_HPP
+#define STORE_HPP
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "result.hpp"
+
+enum ColumnType
+{
+    UINT_COLUMN, DOUBLE_COLUMN, PATTERN_COLUMN, MODE_COLUMN
+};
+
+struct ColumnInfo
+{
+    const char* name;
+    ColumnType type;
+};
+
+/**
+ * Columns of a store.
+ * Names of the key columns and Bps, iops, and response are
+ * those of the tables made by scripts/analyze.sh.
+ */
+static const ColumnInfo STORE_COLUMNS[] = {
+    {"pattern", PATTERN_COLUMN},
+    {"mode", MODE_COLUMN},
+    {"nThreads", UINT_COLUMN},
+    {"queueSize", UINT_COLUMN},
+    {"blockSize", UINT_COLUMN},
+    {"loop", UINT_COLUMN},
+    {"time", UINT_COLUMN},
+    {"nio", UINT_COLUMN},
+    {"size", UINT_COLUMN},
+    {"period", DOUBLE_COLUMN},
+    {"Bps", DOUBLE_COLUMN},
+    {"iops", DOUBLE_COLUMN},
+    {"response", DOUBLE_COLUMN},
+    {"p50", DOUBLE_COLUMN},
+    {"p99", DOUBLE_COLUMN},
+    {"p999", DOUBLE_COLUMN},
+};
+
+static const size_t N_STORE_COLUMNS = sizeof(STORE_COLUMNS) / sizeof(STORE_COLUMNS[0]);
+
+/**
+ * Number of key columns: pattern, mode, nThreads, queueSize, and blockSize.
+ * queueSize tells aio runs, whose nThreads is 0, apart.
+ * loop is numbered for each key.
+ */
+static const size_t N_STORE_KEYS = 5;
+
+static const char* const STORE_PATTERNS[] = {"rnd", "seq", "perm", "trace"};
+static const size_t N_STORE_PATTERNS = sizeof(STORE_PATTERNS) / sizeof(STORE_PATTERNS[0]);
+static const char* const STORE_MODES[] = {"read", "write", "mix"};
+static const size_t N_STORE_MODES = sizeof(STORE_MODES) / sizeof(STORE_MODES[0]);
+
+/**
+ * Results store in a directory.
+ */
+class ResultStore
+{
+private:
+    const std::string dir_;
+
+public:
+    explicit ResultStore(const std::string& dir)
+        : dir_(dir) {}
+
+    /**
+     * @return index of a column, or N_STORE_COLUMNS if not found.
+     */
+    static size_t findColumn(const std::string& name) {
+
+        for (size_t i = 0; i < N_STORE_COLUMNS; i++) {
+            if (name == STORE_COLUMNS[i].name) { return i; }
+        }
+        return N_STORE_COLUMNS;
+    }
+
+    /**
+     * Encode a pattern or mode name, or a number.
+     */
+    static double encode(size_t col, const std::string& s) {
+
+        switch (STORE_COLUMNS[col].type) {
+        case PATTERN_COLUMN:
+            return encodeName(STORE_PATTERNS, N_STORE_PATTERNS, s);
+        case MODE_COLUMN:
+            return encodeName(STORE_MODES, N_STORE_MODES, s);
+        default:
+            return ::atof(s.c_str());
+        }
+    }
+
+    /**
+     * Format a value of a column.
+     */
+    static std::string format(size_t col, double v) {
+
+        char buf[64];
+        const size_t i = static_cast<size_t>(v);
+        switch (STORE_COLUMNS[col].type) {
+        case PATTERN_COLUMN:
+            return i < N_STORE_PATTERNS ? STORE_PATTERNS[i] : "unknown";
+        case MODE_COLUMN:
+            return i < N_STORE_MODES ? STORE_MODES[i] : "unknown";
+        case UINT_COLUMN:
+            ::snprintf(buf, sizeof(buf), "%.0f", v);
+            return buf;
+        default:
+            ::snprintf(buf, sizeof(buf), "%.06f", v);
+            return buf;
+        }
+    }
+
+    /**
+     * Append a run. The directory is created if it does not exist.
+     * loop is the number of runs with the same key in the store.
+     */
+    void append(const RunResult& r) {
+
+        if (::mkdir(dir_.c_str(), 0755) < 0 && errno != EEXIST) {
+            throwError("mkdir failed: " + dir_);
+        }
+        const std::string lockPath = dir_ + "/lock";
+        int lockFd = ::open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+        if (lockFd < 0) {
+            throwError("open failed: " + lockPath);
+        }
+        if (::flock(lockFd, LOCK_EX) < 0) {
+            ::close(lockFd);
+            throwError("flock failed: " + lockPath);
+        }
+        try {
+            appendLocked(r);
+        } catch (...) {
+            ::close(lockFd);
+            throw;
+        }
+        ::close(lockFd);
+    }
+
+    size_t getNrows() const {
+
+        size_t n = SIZE_MAX;
+        for (size_t i = 0; i < N_STORE_COLUMNS; i++) {
+            struct stat s;
+            if (::stat(getPath(i).c_str(), &s) < 0) {
+                return 0;
+            }
+            n = std::min(n, static_cast<size_t>(s.st_size) / sizeof(uint64_t));
+        }
+        return n;
+    }
+
+    /**
+     * Read the first nRows values of a column.
+     */
+    std::vector<double> readColumn(size_t col, size_t nRows) const {
+
+        std::vector<double> ret(nRows);
+        if (nRows == 0) { return ret; }
+        std::vector<uint64_t> raw(nRows);
+        const std::string path = getPath(col);
+        FILE* fp = ::fopen(path.c_str(), "r");
+        if (fp == NULL) {
+            throwError("open failed: " + path);
+        }
+        const size_t n = ::fread(&raw[0], sizeof(uint64_t), nRows, fp);
+        ::fclose(fp);
+        if (n != nRows) {
+            throw std::runtime_error("read failed: " + path);
+        }
+        for (size_t i = 0; i < nRows; i++) {
+            ret[i] = decode(col, raw[i]);
+        }
+        return ret;
+    }
+
+private:
+    std::string getPath(size_t col) const {
+
+        return dir_ + "/" + STORE_COLUMNS[col].name;
+    }
+
+    static void throwError(const std::string& msg) {
+
+        throw std::runtime_error(msg + " " + ::strerror(errno));
+    }
+
+    static double encodeName(const char* const names[], size_t n, const std::string& s) {
+
+        for (size_t i = 0; i < n; i++) {
+            if (s == names[i]) { return static_cast<double>(i); }
+        }
+        throw std::runtime_error("unknown value: " + s);
+    }
+
+    static uint64_t toRaw(size_t col, double v) {
+
+        if (STORE_COLUMNS[col].type == DOUBLE_COLUMN) {
+            uint64_t raw;
+            ::memcpy(&raw, &v, sizeof(raw));
+            return raw;
+        }
+        return static_cast<uint64_t>(v);
+    }
+
+    static double decode(size_t col, uint64_t raw) {
+
+        if (STORE_COLUMNS[col].type == DOUBLE_COLUMN) {
+            double v;
+            ::memcpy(&v, &raw, sizeof(v));
+            return v;
+        }
+        return static_cast<double>(raw);
+    }
+
+    void appendLocked(const RunResult& r) {
+
+        double row[N_STORE_COLUMNS]; /* in the order of STORE_COLUMNS. */
+        row[0] = encode(0, r.pattern);
+        row[1] = encode(1, r.mode);
+        row[2] = r.nThreads;
+        row[3] = r.queueSize;
+        row[4] = r.blockSize;
+        row[6] = r.time;
+        row[7] = r.nio;
+        row[8] = r.totalSize;
+        row[9] = r.period;
+        row[10] = r.getThroughput();
+        row[11] = r.getIops();
+        row[12] = r.response;
+        row[13] = r.hist.getPercentile(50);
+        row[14] = r.hist.getPercentile(99);
+        row[15] = r.hist.getPercentile(99.9);
+
+        const size_t nRows = getNrows();
+        std::vector<std::vector<double> > keys;
+        for (size_t i = 0; i < N_STORE_KEYS; i++) {
+            keys.push_back(readColumn(i, nRows));
+        }
+        size_t loop = 0;
+        for (size_t j = 0; j < nRows; j++) {
+            size_t i = 0;
+            while (i < N_STORE_KEYS && keys[i][j] == row[i]) { i++; }
+            if (i == N_STORE_KEYS) { loop++; }
+        }
+        row[5] = loop;
+
+        for (size_t i = 0; i < N_STORE_COLUMNS; i++) {
+            const std::string path = getPath(i);
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+            if (fd < 0) {
+                throwError("open failed: " + path);
+            }
+            /* Overwrite a torn value of a previous append. */
+            const uint64_t raw = toRaw(i, row[i]);
+            const ssize_t s = ::pwrite(fd, &raw, sizeof(raw), nRows * sizeof(raw));
+            if (s != sizeof(raw) || ::ftruncate(fd, (nRows + 1) * sizeof(raw)) < 0) {
+                ::close(fd);
+                throwError("write failed: " + path);
+            }
+            ::close(fd);
+        }
+    }
+};
+
+#endif /* STORE_HPP */
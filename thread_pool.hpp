@@ -12,12 +12,15 @@
 #include <future>
 #include <iterator>
 #include <list>
-#include <map>
 #include <queue>
+#include <deque>
+#include <vector>
+#include <atomic>
 #include <functional>
 #include <algorithm>
 #include <memory>
 #include <cstdio>
+#include <cstdint>
 #include <cassert>
 
 /**
@@ -79,6 +82,36 @@ public:
         }
     }
 
+    /**
+     * Submit tasks in [first, last).
+     * It is a forward iterator of T.
+     * RETURN:
+     * number of tasks submitted.
+     */
+    template<typename It>
+    size_t submitBatch(It first, It last) {
+
+        return submitN(first, std::distance(first, last));
+    }
+
+    /**
+     * Submit n tasks from first.
+     * The lock is taken once as long as the queue has room,
+     * and as many workers as the tasks are woken up.
+     * RETURN:
+     * number of tasks submitted.
+     * It is less than n if the pool is stopped or flushing.
+     */
+    template<typename It>
+    size_t submitN(It first, size_t n) {
+
+        if (canSubmit_.load()) {
+            return enqueueN(first, n);
+        } else {
+            return 0;
+        }
+    }
+
     /**
      * Flush all tasks pending/running.
      * submit() call is prehibited during flushing.
@@ -123,11 +156,14 @@ public:
 
 protected:
 
-    void init(const std::function<void()>& do_work) {
+    /**
+     * @do_work called by each worker thread with its id starting from 0.
+     */
+    void init(const std::function<void(unsigned int)>& do_work) {
 
         for (unsigned int i = 0; i < poolSize_; i++) {
 
-            std::thread th(do_work);
+            std::thread th(do_work, i);
             workers_.push_back(std::move(th));
         }
     }
@@ -165,31 +201,575 @@ protected:
             return task;
         }
     }
+
+    template<typename It>
+    size_t enqueueN(It first, size_t n) {
+
+        std::unique_lock<std::mutex> lk(mutex_);
+
+        size_t done = 0;
+        while (done < n) {
+            while (waitQ_.size() >= queueSize_ && !shouldStop_) {
+                cvFull_.wait(lk);
+            }
+            if (shouldStop_) {
+                break;
+            }
+            size_t k = 0;
+            while (done < n && waitQ_.size() < queueSize_) {
+                waitQ_.push(*first);
+                ++first;
+                done++;
+                k++;
+            }
+            notify(cvEmpty_, k);
+        }
+        return done;
+    }
+
+    /**
+     * Dequeue up to maxTasks tasks at once.
+     * @tasks will be filled with the tasks.
+     * RETURN:
+     * number of tasks.
+     */
+    size_t dequeueBatch(std::vector<T>& tasks, size_t maxTasks) {
+
+        std::unique_lock<std::mutex> lk(mutex_);
+
+        while (waitQ_.empty() && !shouldStop_) {
+            cvEmpty_.wait(lk);
+        }
+        if (shouldStop_) {
+            throw ShouldStopException();
+        }
+        tasks.clear();
+        while (!waitQ_.empty() && tasks.size() < maxTasks) {
+            tasks.push_back(waitQ_.front());
+            waitQ_.pop();
+        }
+        notify(cvFull_, tasks.size());
+        if (waitQ_.empty()) { cvFlush_.notify_all(); }
+        return tasks.size();
+    }
+
+    /**
+     * Wake up k waiters.
+     */
+    void notify(std::condition_variable& cv, size_t k) {
+
+        if (k >= poolSize_) {
+            cv.notify_all();
+            return;
+        }
+        for (size_t i = 0; i < k; i++) {
+            cv.notify_one();
+        }
+    }
+};
+
+} // namespace thread_pool
+
+namespace thread_pool {
+
+/**
+ * Worker thread context of WorkStealingThreadPoolBase.
+ */
+struct WorkerContext
+{
+    const void *pool; /* pool the calling thread belongs to, or nullptr. */
+    unsigned int id;
+};
+
+/**
+ * One context per thread across translation units.
+ */
+inline WorkerContext& workerContext()
+{
+    static thread_local WorkerContext ctx = {nullptr, 0};
+    return ctx;
+}
+
+/**
+ * Bounded Chase-Lev work-stealing deque of pointers.
+ * push() and pop() can be called by the owner thread only.
+ * steal() can be called by any thread.
+ */
+template<typename T>
+class ChaseLevDeque
+{
+private:
+    const int64_t mask_;
+    std::vector<std::atomic<T *> > buf_;
+    std::atomic<int64_t> top_;
+    std::atomic<int64_t> bottom_;
+
+public:
+    /**
+     * @capacity must be a power of 2.
+     */
+    explicit ChaseLevDeque(size_t capacity)
+        : mask_(static_cast<int64_t>(capacity) - 1)
+        , buf_(capacity)
+        , top_(0)
+        , bottom_(0) {
+
+        assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    }
+
+    /**
+     * RETURN:
+     *   false if the deque is full.
+     */
+    bool push(T *p) {
+
+        const int64_t b = bottom_.load(std::memory_order_relaxed);
+        const int64_t t = top_.load(std::memory_order_acquire);
+        if (b - t > mask_) {
+            return false;
+        }
+        buf_[b & mask_].store(p, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * Take the item pushed most recently.
+     * RETURN:
+     *   nullptr if empty.
+     */
+    T *pop() {
+
+        const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T *p = buf_[b & mask_].load(std::memory_order_relaxed);
+        if (t == b) {
+            /* The last item. Race with stealers. */
+            if (!top_.compare_exchange_strong(
+                    t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                p = nullptr;
+            }
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return p;
+    }
+
+    /**
+     * Take the oldest item.
+     * RETURN:
+     *   nullptr if empty or lost a race.
+     */
+    T *steal() {
+
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        T *p = buf_[t & mask_].load(std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(
+                t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return p;
+    }
+};
+
+/**
+ * Work-stealing variant of ThreadPoolBase.
+ *
+ * Each worker owns a Chase-Lev deque and a small locked inbox.
+ * Tasks submitted by a worker of the pool are pushed to its own deque,
+ * and tasks submitted by other threads are distributed to the inboxes
+ * in round-robin. A worker takes tasks from its deque, then its inbox,
+ * then steals from the others.
+ *
+ * queueSize is the limit of pending tasks,
+ * which may be exceeded slightly by concurrent submitters.
+ */
+template<typename T>
+class WorkStealingThreadPoolBase
+{
+protected:
+    const unsigned int poolSize_;
+    const unsigned int queueSize_;
+
+    struct Inbox
+    {
+        std::mutex mutex;
+        std::deque<T *> q; // protected by the mutex.
+    };
+    std::vector<std::unique_ptr<ChaseLevDeque<T> > > deques_;
+    std::vector<std::unique_ptr<Inbox> > inboxes_;
+    std::atomic<unsigned int> nextInbox_;
+    std::atomic<size_t> nPending_; // number of tasks submitted and not taken.
+
+    std::mutex mutex_;
+    std::condition_variable cvEmpty_; // wait for empty -> not empty.
+    std::condition_variable cvFull_;  // wait for full -> not full.
+    std::condition_variable cvFlush_; // wait for not empty -> empty.
+    std::atomic<size_t> nSleepers_;
+    std::atomic<size_t> nBlocked_;
+    std::atomic<bool> shouldStop_;
+
+    std::vector<std::thread> workers_;
+
+    std::atomic<bool> canSubmit_;
+    std::once_flag joinFlag_;
+
+public:
+    /**
+     * Constructor.
+     * @poolSize Number of worker threads.
+     * @queueSize Maximum number of pending tasks.
+     */
+    WorkStealingThreadPoolBase(unsigned int poolSize, unsigned int queueSize)
+        : poolSize_(poolSize)
+        , queueSize_(queueSize)
+        , nextInbox_(0)
+        , nPending_(0)
+        , nSleepers_(0)
+        , nBlocked_(0)
+        , shouldStop_(false)
+        , canSubmit_(true) {
+
+        assert(poolSize_ > 0);
+        size_t capacity = 2;
+        while (capacity < queueSize_) { capacity *= 2; }
+        for (unsigned int i = 0; i < poolSize_; i++) {
+            deques_.emplace_back(new ChaseLevDeque<T>(capacity));
+            inboxes_.emplace_back(new Inbox());
+        }
+    }
+
+    virtual ~WorkStealingThreadPoolBase() throw() {
+
+        stop();
+        join();
+        for (unsigned int i = 0; i < poolSize_; i++) {
+            T *p;
+            while ((p = deques_[i]->steal()) != nullptr) { delete p; }
+            std::for_each(inboxes_[i]->q.begin(), inboxes_[i]->q.end(),
+                          [](T *p) { delete p; });
+        }
+    }
+
+    /**
+     * Submit a task.
+     * RETURN:
+     * true in success, or false.
+     */
+    bool submit(T task) {
+
+        if (canSubmit_.load()) {
+            return enqueue(task);
+        } else {
+            return false;
+        }
+    }
+
+    /**
+     * Submit tasks in [first, last).
+     * It is a forward iterator of T.
+     * RETURN:
+     * number of tasks submitted.
+     */
+    template<typename It>
+    size_t submitBatch(It first, It last) {
+
+        return submitN(first, std::distance(first, last));
+    }
+
+    /**
+     * Submit n tasks from first.
+     * The lock is taken once as long as the queue has room,
+     * and as many workers as the tasks are woken up.
+     * RETURN:
+     * number of tasks submitted.
+     * It is less than n if the pool is stopped or flushing.
+     */
+    template<typename It>
+    size_t submitN(It first, size_t n) {
+
+        if (canSubmit_.load()) {
+            return enqueueN(first, n);
+        } else {
+            return 0;
+        }
+    }
+
+    /**
+     * Flush all tasks pending/running.
+     * submit() call is prehibited during flushing.
+     *
+     * RETURN:
+     * false when join() is called dring flushing.
+     */
+    bool flush() {
+
+        canSubmit_.store(false);
+        std::unique_lock<std::mutex> lk(mutex_);
+        while (nPending_.load() > 0 && !shouldStop_) {
+            cvFlush_.wait(lk);
+        }
+        canSubmit_.store(true);
+        return !shouldStop_;
+    }
+
+    /**
+     * Stop all threads as soon as possible.
+     */
+    void stop() {
+
+        std::unique_lock<std::mutex> lk(mutex_);
+        shouldStop_ = true;
+        cvEmpty_.notify_all();
+        cvFull_.notify_all();
+        cvFlush_.notify_all();
+    }
+
+    /**
+     * Join threads.
+     */
+    void join() {
+
+        std::call_once(joinFlag_, [&]() {
+                std::for_each(workers_.begin(), workers_.end(), [](std::thread& th) {
+                        th.join();
+                    });
+            });
+    }
+
+protected:
+
+    /**
+     * @do_work called by each worker thread with its id starting from 0.
+     */
+    void init(const std::function<void(unsigned int)>& do_work) {
+
+        for (unsigned int i = 0; i < poolSize_; i++) {
+
+            std::thread th([this, i, do_work] {
+                    workerContext().pool = this;
+                    workerContext().id = i;
+                    do_work(i);
+                });
+            workers_.push_back(std::move(th));
+        }
+    }
+
+    bool enqueue(T task) {
+
+        return enqueueN(&task, 1) == 1;
+    }
+
+    /**
+     * Tasks are pushed to the own deque if called by a worker,
+     * or to an inbox under one lock.
+     */
+    template<typename It>
+    size_t enqueueN(It first, size_t n) {
+
+        const WorkerContext& ctx = workerContext();
+        const bool isWorker = (ctx.pool == this);
+        size_t done = 0;
+        while (done < n) {
+            size_t nPending = nPending_.load();
+            if (nPending >= queueSize_) {
+                std::unique_lock<std::mutex> lk(mutex_);
+                nBlocked_++;
+                while ((nPending = nPending_.load()) >= queueSize_ && !shouldStop_) {
+                    cvFull_.wait(lk);
+                }
+                nBlocked_--;
+            }
+            if (shouldStop_) {
+                break;
+            }
+            const size_t k = std::min(n - done, queueSize_ - nPending);
+            nPending_ += k;
+            size_t i = 0;
+            if (isWorker) {
+                for (; i < k; i++) {
+                    if (!deques_[ctx.id]->push(new T(*first))) { break; }
+                    ++first;
+                }
+            }
+            if (i < k) {
+                Inbox& inbox = *inboxes_[nextInbox_++ % poolSize_];
+                std::lock_guard<std::mutex> lk(inbox.mutex);
+                for (; i < k; i++) {
+                    inbox.q.push_back(new T(*first));
+                    ++first;
+                }
+            }
+            done += k;
+            if (nSleepers_.load() > 0) {
+                std::lock_guard<std::mutex> lk(mutex_);
+                notify(cvEmpty_, k);
+            }
+        }
+        return done;
+    }
+
+    /**
+     * This must be called by a worker thread.
+     */
+    T dequeue() {
+
+        const WorkerContext& ctx = workerContext();
+        assert(ctx.pool == this);
+        while (!shouldStop_) {
+            T *p = tryTake(ctx.id);
+            if (p) {
+                return take(p);
+            }
+            if (nPending_.load() > 0) {
+                /* A task is being pushed. */
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(mutex_);
+            nSleepers_++;
+            while (nPending_.load() == 0 && !shouldStop_) {
+                cvEmpty_.wait(lk);
+            }
+            nSleepers_--;
+        }
+        throw ShouldStopException();
+    }
+
+    /**
+     * Dequeue up to maxTasks tasks at once.
+     * This must be called by a worker thread.
+     * @tasks will be filled with the tasks.
+     * RETURN:
+     * number of tasks.
+     */
+    size_t dequeueBatch(std::vector<T>& tasks, size_t maxTasks) {
+
+        tasks.clear();
+        tasks.push_back(dequeue());
+        const unsigned int id = workerContext().id;
+        while (tasks.size() < maxTasks) {
+            T *p = tryTake(id);
+            if (!p) { break; }
+            tasks.push_back(take(p));
+        }
+        return tasks.size();
+    }
+
+    /**
+     * Wake up k waiters.
+     */
+    void notify(std::condition_variable& cv, size_t k) {
+
+        if (k >= poolSize_) {
+            cv.notify_all();
+            return;
+        }
+        for (size_t i = 0; i < k; i++) {
+            cv.notify_one();
+        }
+    }
+
+private:
+    T *tryTake(unsigned int id) {
+
+        T *p = deques_[id]->pop();
+        if (p) { return p; }
+
+        /* Move the inbox to the own deque. */
+        {
+            Inbox& inbox = *inboxes_[id];
+            std::lock_guard<std::mutex> lk(inbox.mutex);
+            if (!inbox.q.empty()) {
+                p = inbox.q.front();
+                inbox.q.pop_front();
+                while (!inbox.q.empty() && deques_[id]->push(inbox.q.front())) {
+                    inbox.q.pop_front();
+                }
+                return p;
+            }
+        }
+
+        for (unsigned int i = 1; i < poolSize_; i++) {
+            p = deques_[(id + i) % poolSize_]->steal();
+            if (p) { return p; }
+        }
+        for (unsigned int i = 1; i < poolSize_; i++) {
+            Inbox& inbox = *inboxes_[(id + i) % poolSize_];
+            std::lock_guard<std::mutex> lk(inbox.mutex);
+            if (!inbox.q.empty()) {
+                p = inbox.q.front();
+                inbox.q.pop_front();
+                return p;
+            }
+        }
+        return nullptr;
+    }
+
+    T take(T *p) {
+
+        T task(std::move(*p));
+        delete p;
+        const size_t n = --nPending_;
+        if (nBlocked_.load() > 0 && n < queueSize_) {
+            std::lock_guard<std::mutex> lk(mutex_);
+            cvFull_.notify_one();
+        }
+        if (n == 0 && !canSubmit_.load()) {
+            std::lock_guard<std::mutex> lk(mutex_);
+            cvFlush_.notify_all();
+        }
+        return task;
+    }
 };
 
 } // namespace thread_pool
 
 /**
  * Simple thread pool with tasks of type T and
- * worker function of type std::function<void(T)>.
+ * worker function of type Func callable as void(T).
  *
  * Currently worker function could not throw exceptions.
  * Use ThreadPoolWithId instead.
+ *
+ * Base is thread_pool::ThreadPoolBase<T> or
+ * thread_pool::WorkStealingThreadPoolBase<T>.
+ * Func is std::function<void(T)> by default.
+ * Give the type of a lambda or a function object
+ * to inline the worker function into the dequeue loop.
  */
-template<typename T>
-class ThreadPool : public thread_pool::ThreadPoolBase<T>
+template<typename T, typename Base = thread_pool::ThreadPoolBase<T>,
+         typename Func = std::function<void(T)> >
+class ThreadPool : public Base
 {
 private:
-    typedef thread_pool::ThreadPoolBase<T> TPB;
-    std::function<void(T)> workerFunc_;
+    typedef Base TPB;
+    Func workerFunc_;
+    const unsigned int batchSize_;
 
 public:
+    /**
+     * @batchSize Maximum number of tasks a worker dequeues at once.
+     */
     ThreadPool(unsigned int poolSize, unsigned int queueSize,
-               const std::function<void(T)>& workerFunc)
+               const Func& workerFunc, unsigned int batchSize = 1)
         : TPB(poolSize, queueSize)
-        , workerFunc_(workerFunc) {
+        , workerFunc_(workerFunc)
+        , batchSize_(batchSize) {
 
-        TPB::init([&] { this->do_work(); });
+        assert(batchSize_ > 0);
+        TPB::init([this](unsigned int) { this->do_work(); });
     }
     
     ~ThreadPool() throw() {}
@@ -197,9 +777,17 @@ public:
 private:
     void do_work() throw() {
 
+        std::vector<T> tasks;
         while (!TPB::shouldStop_) {
             try {
-                workerFunc_(TPB::dequeue());
+                if (batchSize_ == 1) {
+                    workerFunc_(TPB::dequeue());
+                    continue;
+                }
+                TPB::dequeueBatch(tasks, batchSize_);
+                std::for_each(tasks.begin(), tasks.end(), [&](T& task) {
+                        workerFunc_(task);
+                    });
             } catch (thread_pool::ShouldStopException& e) {
                 break;
             }
@@ -211,44 +799,42 @@ private:
 /**
  * Simple thread pool with thread id and promise data.
  * Wroker function can throw an exception and you can get it by get().
+ *
+ * Base is the same as ThreadPool.
+ * Func is callable as void(T, unsigned int),
+ * std::function<void(T, unsigned int)> by default.
  */
-template<typename T>
-class ThreadPoolWithId : public thread_pool::ThreadPoolBase<T>
+template<typename T, typename Base = thread_pool::ThreadPoolBase<T>,
+         typename Func = std::function<void(T, unsigned int)> >
+class ThreadPoolWithId : public Base
 {
 private:
-    typedef thread_pool::ThreadPoolBase<T> TPB;
-
-    std::mutex mutex_;
-    std::condition_variable cv_;
-    bool isInitialized_;
+    typedef Base TPB;
 
     /* The second is thread id starting from 0. */
-    std::function<void(T, unsigned int)> workerFuncWithId_;
+    Func workerFuncWithId_;
 
-    std::map<std::thread::id, unsigned int> idMap_;
     std::vector<std::promise<void> > promises_;
     std::vector<std::future<void> > futures_;
+    const unsigned int batchSize_;
     
 public:
+    /**
+     * @batchSize Maximum number of tasks a worker dequeues at once.
+     */
     ThreadPoolWithId(unsigned int poolSize, unsigned int queueSize,
-                     const std::function<void(T, unsigned int)>& workerFuncWithId)
+                     const Func& workerFuncWithId, unsigned int batchSize = 1)
         : TPB(poolSize, queueSize)
-        , isInitialized_(false)
         , workerFuncWithId_(workerFuncWithId)
         , promises_(poolSize)
-        , futures_(poolSize) {
+        , futures_(poolSize)
+        , batchSize_(batchSize) {
 
-        TPB::init([&] { this->do_work(); });
+        assert(batchSize_ > 0);
         for (unsigned int i = 0; i < poolSize; i++) {
-            auto tid = TPB::workers_[i].get_id();
-            idMap_[tid] = i;
-            futures_[i] = std::move(promises_[i].get_future());
-        }
-        {
-            std::unique_lock<std::mutex> lk(mutex_);
-            isInitialized_ = true;
-            cv_.notify_all();
+            futures_[i] = promises_[i].get_future();
         }
+        TPB::init([this](unsigned int id) { this->do_work(id); });
     }
 
     ~ThreadPoolWithId() throw() {
@@ -294,24 +880,20 @@ public:
     }
 
 private:
-    void do_work() throw() {
-
-        auto tid = std::this_thread::get_id();
-        {
-            /* Wait for all threads created. */
-            std::unique_lock<std::mutex> lk(mutex_);
-            while (!isInitialized_) {
-                cv_.wait(lk);
-            }
-        }
-        /* Now idMap_, promises_, and futures_ is filled. */
-        unsigned int id = idMap_[tid];
+    void do_work(unsigned int id) throw() {
 
         try {
+            std::vector<T> tasks;
             while (!TPB::shouldStop_) {
                 try {
-                    workerFuncWithId_(TPB::dequeue(), id);
-                    
+                    if (batchSize_ == 1) {
+                        workerFuncWithId_(TPB::dequeue(), id);
+                        continue;
+                    }
+                    TPB::dequeueBatch(tasks, batchSize_);
+                    std::for_each(tasks.begin(), tasks.end(), [&](T& task) {
+                            workerFuncWithId_(task, id);
+                        });
                 } catch (thread_pool::ShouldStopException& e) {
                     break;
                 }
@@ -339,6 +921,17 @@ private:
     }
 };
 
+/**
+ * Work-stealing thread pools.
+ * These can be used instead of ThreadPool and ThreadPoolWithId.
+ */
+template<typename T, typename Func = std::function<void(T)> >
+using WorkStealingThreadPool =
+    ThreadPool<T, thread_pool::WorkStealingThreadPoolBase<T>, Func>;
+template<typename T, typename Func = std::function<void(T, unsigned int)> >
+using WorkStealingThreadPoolWithId =
+    ThreadPoolWithId<T, thread_pool::WorkStealingThreadPoolBase<T>, Func>;
+
 
 namespace thread_pool {
 
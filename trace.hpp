@@ -0,0 +1,328 @@
+/**
+ * @file
+ * @brief IO trace reader for replay.
+ */
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#define _FILE_OFFSET_BITS 64
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+
+#include <sys/types.h>
+
+/**
+ * Each IO of a trace.
+ */
+struct TraceRecord
+{
+    double time; /* relative to the first record [second] */
+    bool isWrite;
+    off_t oft; /* [byte] */
+    size_t size; /* [byte] */
+};
+
+/**
+ * Trace file formats.
+ *
+ * IOLOG_TRACE:  lines printed by IoLog::print() (iores/ioth -r).
+ * CSV_TRACE:    "time,op,offset,size" lines. op is R or W.
+ *               time is in seconds, offset and size are in bytes.
+ * BINARY_TRACE: sequence of BinaryTraceRecord in host byte order.
+ */
+enum TraceFormat
+{
+    IOLOG_TRACE, CSV_TRACE, BINARY_TRACE
+};
+
+/**
+ * On-disk record of BINARY_TRACE.
+ */
+struct BinaryTraceRecord
+{
+    double time; /* [second] */
+    uint64_t oft; /* [byte] */
+    uint32_t size; /* [byte] */
+    uint32_t isWrite; /* 0 or 1 */
+};
+
+/**
+ * Parse a trace format name.
+ */
+static inline TraceFormat parseTraceFormat(const std::string& name)
+{
+    if (name == "iolog") { return IOLOG_TRACE; }
+    if (name == "csv") { return CSV_TRACE; }
+    if (name == "bin") { return BINARY_TRACE; }
+    throw std::runtime_error("unknown trace format: " + name);
+}
+
+/**
+ * Guess a trace format from the file name.
+ */
+static inline TraceFormat guessTraceFormat(const std::string& path)
+{
+    auto hasSuffix = [&](const std::string& sfx) {
+        return path.size() >= sfx.size() &&
+            path.compare(path.size() - sfx.size(), sfx.size(), sfx) == 0;
+    };
+    if (hasSuffix(".csv")) { return CSV_TRACE; }
+    if (hasSuffix(".bin")) { return BINARY_TRACE; }
+    return IOLOG_TRACE;
+}
+
+/**
+ * Streaming trace reader.
+ *
+ * A background thread parses the trace file into chunks
+ * and keeps at most nChunks of them prefetched,
+ * so the whole trace never sits in memory.
+ * next() can be called by multiple threads.
+ * Records must be sorted by time.
+ */
+class TraceReader
+{
+private:
+    const std::string path_;
+    const TraceFormat format_;
+    const size_t blockSize_; /* used to convert blockId of IOLOG_TRACE. */
+    const size_t maxRecords_; /* 0 means unlimited. */
+    const size_t chunkSize_;
+    const size_t nChunks_;
+
+    std::mutex mutex_;
+    std::condition_variable cvEmpty_; // wait for empty -> not empty.
+    std::condition_variable cvFull_;  // wait for full -> not full.
+    std::deque<std::vector<TraceRecord> > chunkQ_; // protected by the mutex.
+    bool isEnd_; // protected by the mutex.
+    bool shouldStop_; // protected by the mutex.
+    std::exception_ptr ep_; // protected by the mutex.
+
+    std::vector<TraceRecord> cur_; // protected by the mutex.
+    size_t curIdx_; // protected by the mutex.
+
+    std::thread th_;
+
+public:
+    /**
+     * @path trace file path.
+     * @format trace file format.
+     * @blockSize block size for IOLOG_TRACE [byte].
+     * @maxRecords number of records to read at most. 0 means unlimited.
+     */
+    TraceReader(const std::string& path, TraceFormat format, size_t blockSize,
+                size_t maxRecords = 0, size_t chunkSize = 4096, size_t nChunks = 4)
+        : path_(path)
+        , format_(format)
+        , blockSize_(blockSize)
+        , maxRecords_(maxRecords)
+        , chunkSize_(chunkSize)
+        , nChunks_(nChunks)
+        , isEnd_(false)
+        , shouldStop_(false)
+        , curIdx_(0) {
+
+        assert(chunkSize_ > 0);
+        assert(nChunks_ > 0);
+        std::ifstream is(path_.c_str());
+        if (!is) {
+            throw std::runtime_error("open failed: " + path_);
+        }
+        th_ = std::thread([this] { this->prefetch(); });
+    }
+
+    ~TraceReader() noexcept {
+
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            shouldStop_ = true;
+            cvFull_.notify_all();
+        }
+        th_.join();
+    }
+
+    /**
+     * Get the next record.
+     * RETURN:
+     *   false if the trace reaches its end.
+     */
+    bool next(TraceRecord& rec) {
+
+        std::unique_lock<std::mutex> lk(mutex_);
+        while (curIdx_ == cur_.size()) {
+            while (chunkQ_.empty() && !isEnd_) {
+                cvEmpty_.wait(lk);
+            }
+            if (ep_) {
+                std::rethrow_exception(ep_);
+            }
+            if (chunkQ_.empty()) {
+                return false;
+            }
+            cur_.swap(chunkQ_.front());
+            chunkQ_.pop_front();
+            curIdx_ = 0;
+            cvFull_.notify_one();
+        }
+        rec = cur_[curIdx_++];
+        return true;
+    }
+
+private:
+    void prefetch() noexcept {
+
+        try {
+            std::ifstream is;
+            if (format_ == BINARY_TRACE) {
+                is.open(path_.c_str(), std::ios::in | std::ios::binary);
+            } else {
+                is.open(path_.c_str());
+            }
+            if (!is) {
+                throw std::runtime_error("open failed: " + path_);
+            }
+            size_t nRead = 0;
+            bool hasBase = false;
+            double baseTime = 0.0;
+            bool isEof = false;
+            while (!isEof) {
+                std::vector<TraceRecord> chunk;
+                chunk.reserve(chunkSize_);
+                TraceRecord rec;
+                while (chunk.size() < chunkSize_) {
+                    if (maxRecords_ > 0 && nRead >= maxRecords_) {
+                        isEof = true;
+                        break;
+                    }
+                    if (!readRecord(is, rec)) {
+                        isEof = true;
+                        break;
+                    }
+                    if (!hasBase) {
+                        baseTime = rec.time;
+                        hasBase = true;
+                    }
+                    rec.time -= baseTime;
+                    chunk.push_back(rec);
+                    nRead++;
+                }
+                if (!push(chunk)) {
+                    return;
+                }
+            }
+            std::lock_guard<std::mutex> lk(mutex_);
+            isEnd_ = true;
+            cvEmpty_.notify_all();
+        } catch (...) {
+            std::lock_guard<std::mutex> lk(mutex_);
+            ep_ = std::current_exception();
+            isEnd_ = true;
+            cvEmpty_.notify_all();
+        }
+    }
+
+    /**
+     * RETURN:
+     *   false if the reader is being destroyed.
+     */
+    bool push(std::vector<TraceRecord>& chunk) {
+
+        if (chunk.empty()) {
+            return true;
+        }
+        std::unique_lock<std::mutex> lk(mutex_);
+        while (chunkQ_.size() >= nChunks_ && !shouldStop_) {
+            cvFull_.wait(lk);
+        }
+        if (shouldStop_) {
+            return false;
+        }
+        chunkQ_.push_back(std::move(chunk));
+        cvEmpty_.notify_all();
+        return true;
+    }
+
+    bool readRecord(std::istream& is, TraceRecord& rec) {
+
+        switch (format_) {
+        case IOLOG_TRACE:  return readIoLogRecord(is, rec);
+        case CSV_TRACE:    return readCsvRecord(is, rec);
+        case BINARY_TRACE: return readBinaryRecord(is, rec);
+        }
+        return false;
+    }
+
+    bool readIoLogRecord(std::istream& is, TraceRecord& rec) {
+
+        std::string line;
+        while (std::getline(is, line)) {
+            unsigned int threadId;
+            int isWrite;
+            size_t blockId;
+            double startTime, response;
+            /* Lines other than IO logs such as statistics are skipped. */
+            if (::sscanf(line.c_str(),
+                         "threadId %u isWrite %d blockId %zu startTime %lf response %lf",
+                         &threadId, &isWrite, &blockId, &startTime, &response) != 5) {
+                continue;
+            }
+            rec.time = startTime;
+            rec.isWrite = (isWrite != 0);
+            rec.oft = blockId * blockSize_;
+            rec.size = blockSize_;
+            return true;
+        }
+        return false;
+    }
+
+    bool readCsvRecord(std::istream& is, TraceRecord& rec) {
+
+        std::string line;
+        while (std::getline(is, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            double time;
+            char op[16];
+            unsigned long long oft, size;
+            if (::sscanf(line.c_str(), "%lf , %15[^,] , %llu , %llu",
+                         &time, op, &oft, &size) != 4) {
+                throw std::runtime_error("invalid csv trace line: " + line);
+            }
+            rec.time = time;
+            rec.isWrite = (op[0] == 'W' || op[0] == 'w');
+            rec.oft = oft;
+            rec.size = size;
+            return true;
+        }
+        return false;
+    }
+
+    bool readBinaryRecord(std::istream& is, TraceRecord& rec) {
+
+        BinaryTraceRecord b;
+        if (!is.read(reinterpret_cast<char *>(&b), sizeof(b))) {
+            return false;
+        }
+        rec.time = b.time;
+        rec.isWrite = (b.isWrite != 0);
+        rec.oft = b.oft;
+        rec.size = b.size;
+        return true;
+    }
+};
+
+#endif /* TRACE_HPP */
@@ -10,23 +10,52 @@
 
 #include <vector>
 #include <queue>
+#include <deque>
+#include <memory>
 #include <unordered_map>
 #include <map>
 #include <string>
+#include <sstream>
 #include <algorithm>
 #include <exception>
 #include <cerrno>
 #include <cstdio>
+#include <cstdint>
+#include <cstring>
 
 #include <unistd.h>
 #include <time.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sched.h>
 #include <fcntl.h>
+#include <linux/perf_event.h>
 #include <linux/fs.h>
+#include <linux/falloc.h>
 #include <libaio.h>
+#include <x86intrin.h>
+
+/**
+ * IO operation types.
+ * DISCARD_OP and ZERO_OP are not supported by aio
+ * so they are always executed synchronously.
+ */
+enum IoOp
+{
+    READ_OP, WRITE_OP, DISCARD_OP, ZERO_OP, N_IO_OPS
+};
+
+static inline const char* getIoOpName(IoOp op)
+{
+    static const char* names[N_IO_OPS] = { "read", "write", "discard", "zero" };
+    return names[op];
+}
 
 /**
  * Each IO log.
@@ -38,6 +67,7 @@ struct IoLog
     const size_t blockId;
     const double startTime; /* unix time [second] */
     const double response; /* [second] */
+    const IoOp op;
 
     IoLog(unsigned int threadId_, bool isWrite_, size_t blockId_,
           double startTime_, double response_)
@@ -45,11 +75,21 @@ struct IoLog
         , isWrite(isWrite_)
         , blockId(blockId_)
         , startTime(startTime_)
-        , response(response_) {}
+        , response(response_)
+        , op(isWrite_ ? WRITE_OP : READ_OP) {}
+
+    IoLog(unsigned int threadId_, IoOp op_, size_t blockId_,
+          double startTime_, double response_)
+        : threadId(threadId_)
+        , isWrite(op_ != READ_OP)
+        , blockId(blockId_)
+        , startTime(startTime_)
+        , response(response_)
+        , op(op_) {}
 
     void print() {
-        ::printf("threadId %d isWrite %d blockId %10zu startTime %.06f response %.06f\n",
-                 threadId, isWrite, blockId, startTime, response);
+        ::printf("threadId %d isWrite %d blockId %10zu startTime %.06f response %.06f op %s\n",
+                 threadId, isWrite, blockId, startTime, response, getIoOpName(op));
     }
 };
 
@@ -65,6 +105,58 @@ static inline double getTime()
     return t;
 }
 
+/**
+ * Read the time stamp counter.
+ * This is much cheaper than getTime() to stamp phases of each IO.
+ */
+static inline uint64_t getTsc()
+{
+    return __rdtsc();
+}
+
+/**
+ * Measure the frequency of the time stamp counter [tick/second].
+ */
+static inline double calibrateTsc()
+{
+    struct timespec ts0, ts1, d = {0, 20000000};
+    ::clock_gettime(CLOCK_MONOTONIC, &ts0);
+    const uint64_t tsc0 = getTsc();
+    ::nanosleep(&d, NULL);
+    ::clock_gettime(CLOCK_MONOTONIC, &ts1);
+    const uint64_t tsc1 = getTsc();
+    const double sec = static_cast<double>(ts1.tv_sec - ts0.tv_sec) +
+        static_cast<double>(ts1.tv_nsec - ts0.tv_nsec) / 1000000000.0;
+    return static_cast<double>(tsc1 - tsc0) / sec;
+}
+
+/**
+ * Convert a difference of getTsc() to seconds.
+ * The counter is calibrated at the first call, which takes 20ms.
+ */
+static inline double tscToSec(uint64_t ticks)
+{
+    static const double freq = calibrateTsc();
+    return static_cast<double>(ticks) / freq;
+}
+
+/**
+ * Sleep until a time point.
+ * @t unix time [second].
+ */
+static inline void sleepUntil(double t)
+{
+    double now = getTime();
+    while (now < t) {
+        double d = t - now;
+        struct timespec ts;
+        ts.tv_sec = static_cast<time_t>(d);
+        ts.tv_nsec = static_cast<long>((d - static_cast<double>(ts.tv_sec)) * 1000000000.0);
+        ::nanosleep(&ts, NULL);
+        now = getTime();
+    }
+}
+
 enum Mode
 {
     READ_MODE, WRITE_MODE, MIX_MODE
@@ -76,24 +168,43 @@ private:
     std::string name_;
     Mode mode_;
     int fd_;
+    bool isBlockDevice_;
+    dev_t backingDevice_;
     size_t deviceSize_;
+    size_t logicalBlockSize_;
+    size_t physicalBlockSize_;
+    size_t dioMemAlign_;
+    size_t dioOffsetAlign_;
 
 public:
     BlockDevice(const std::string& name, const Mode mode, bool isDirect)
         : name_(name)
         , mode_(mode)
         , fd_(openDevice(name, mode, isDirect))
-        , deviceSize_(getDeviceSizeFirst()) {
+        , isBlockDevice_(isBlockDeviceFirst())
+        , backingDevice_(0)
+        , deviceSize_(getDeviceSizeFirst())
+        , logicalBlockSize_(512)
+        , physicalBlockSize_(512)
+        , dioMemAlign_(512)
+        , dioOffsetAlign_(512) {
 #if 0
         ::printf("device %s size %zu mode %d isDirect %d\n",
                  name_.c_str(), size_, mode_, isDirect_);
 #endif
+        detectBlockSizesFirst();
     }
     explicit BlockDevice(BlockDevice&& rhs)
         : name_(std::move(rhs.name_))
         , mode_(rhs.mode_)
         , fd_(rhs.fd_)
-        , deviceSize_(rhs.deviceSize_) {
+        , isBlockDevice_(rhs.isBlockDevice_)
+        , backingDevice_(rhs.backingDevice_)
+        , deviceSize_(rhs.deviceSize_)
+        , logicalBlockSize_(rhs.logicalBlockSize_)
+        , physicalBlockSize_(rhs.physicalBlockSize_)
+        , dioMemAlign_(rhs.dioMemAlign_)
+        , dioOffsetAlign_(rhs.dioOffsetAlign_) {
 
         rhs.fd_ = -1;
     }
@@ -102,7 +213,13 @@ public:
         name_ = std::move(rhs.name_);
         mode_ = rhs.mode_;
         fd_ = rhs.fd_; rhs.fd_ = -1;
+        isBlockDevice_ = rhs.isBlockDevice_;
+        backingDevice_ = rhs.backingDevice_;
         deviceSize_= rhs.deviceSize_;
+        logicalBlockSize_ = rhs.logicalBlockSize_;
+        physicalBlockSize_ = rhs.physicalBlockSize_;
+        dioMemAlign_ = rhs.dioMemAlign_;
+        dioOffsetAlign_ = rhs.dioOffsetAlign_;
         return *this;
     }
     
@@ -161,8 +278,96 @@ public:
             s += ret;
         }
     }
+    /**
+     * Discard a range.
+     * BLKDISCARD for a block device, or punching a hole for a regular file.
+     */
+    void discard(off_t oft, size_t size) {
+
+        if (deviceSize_ < oft + size) { throw EofError(); }
+        if (mode_ == READ_MODE) { throw std::runtime_error("discard is not permitted."); }
+        if (isBlockDevice_) {
+            uint64_t range[2] = { static_cast<uint64_t>(oft), size };
+            if (::ioctl(fd_, BLKDISCARD, &range) < 0) {
+                std::string e("BLKDISCARD failed: ");
+                e += ::strerror(errno);
+                throw std::runtime_error(e);
+            }
+        } else {
+            if (::fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, oft, size) < 0) {
+                std::string e("fallocate(PUNCH_HOLE) failed: ");
+                e += ::strerror(errno);
+                throw std::runtime_error(e);
+            }
+        }
+    }
+    /**
+     * Fill a range with zero.
+     * BLKZEROOUT for a block device, or zeroing a range for a regular file.
+     */
+    void zeroRange(off_t oft, size_t size) {
+
+        if (deviceSize_ < oft + size) { throw EofError(); }
+        if (mode_ == READ_MODE) { throw std::runtime_error("zero is not permitted."); }
+        if (isBlockDevice_) {
+            uint64_t range[2] = { static_cast<uint64_t>(oft), size };
+            if (::ioctl(fd_, BLKZEROOUT, &range) < 0) {
+                std::string e("BLKZEROOUT failed: ");
+                e += ::strerror(errno);
+                throw std::runtime_error(e);
+            }
+        } else {
+            if (::fallocate(fd_, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, oft, size) < 0) {
+                std::string e("fallocate(ZERO_RANGE) failed: ");
+                e += ::strerror(errno);
+                throw std::runtime_error(e);
+            }
+        }
+    }
+    /**
+     * Execute an IO of any operation type.
+     */
+    void execIo(IoOp op, off_t oft, size_t size, char* buf) {
+
+        switch (op) {
+        case READ_OP:    read(oft, size, buf); break;
+        case WRITE_OP:   write(oft, size, buf); break;
+        case DISCARD_OP: discard(oft, size); break;
+        case ZERO_OP:    zeroRange(oft, size); break;
+        default:         assert(false);
+        }
+    }
+    /**
+     * Drop the page cache of the whole file.
+     * Dirty pages are written back first.
+     */
+    void dropCache() {
+
+        ::fdatasync(fd_);
+        int err = ::posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+        if (err != 0) {
+            std::string e("posix_fadvise failed: ");
+            e += ::strerror(err);
+            throw std::runtime_error(e);
+        }
+    }
+    const std::string& getName() const { return name_; }
     const Mode getMode() const { return mode_; }
     int getFd() const { return fd_; }
+    bool isBlockDevice() const { return isBlockDevice_; }
+
+    /**
+     * Block device which serves IOs to the target:
+     * the device itself, or the one the file system of a file is on.
+     * 0 if the file system is not on a block device.
+     */
+    dev_t getBackingDevice() const { return backingDevice_; }
+    size_t getLogicalBlockSize() const { return logicalBlockSize_; }
+    size_t getPhysicalBlockSize() const { return physicalBlockSize_; }
+    /* Alignment of buffers for direct IO [byte]. */
+    size_t getDioMemAlign() const { return dioMemAlign_; }
+    /* Alignment of offsets and sizes for direct IO [byte]. */
+    size_t getDioOffsetAlign() const { return dioOffsetAlign_; }
 
 private:
 
@@ -192,9 +397,23 @@ private:
     
     /**
      * Helper function for constructor.
-     * Get device size in bytes.
      */
-    size_t getDeviceSizeFirst() const {
+    bool isBlockDeviceFirst() const {
+
+        struct stat s;
+        if (::fstat(fd_, &s) < 0) {
+            std::stringstream ss;
+            ss << "fstat failed: " << name_ << " " << ::strerror(errno) << ".";
+            throw std::runtime_error(ss.str());
+        }
+        return (s.st_mode & S_IFMT) == S_IFBLK;
+    }
+
+    /**
+     * Helper function for constructor.
+     * Get device size in bytes, and resolve the backing device.
+     */
+    size_t getDeviceSizeFirst() {
 
         size_t ret;
         struct stat s;
@@ -211,291 +430,1657 @@ private:
                 throw std::runtime_error(ss.str());
             }
             ret = size;
+            backingDevice_ = s.st_rdev;
         } else {
             ret = s.st_size;
+            backingDevice_ = major(s.st_dev) == 0 ? 0 : s.st_dev;
         }
 #if 0        
         std::cout << "devicesize: " << ret << std::endl; //debug
 #endif
         return ret;
     }
+
+    /**
+     * Helper function for constructor.
+     * Detect logical and physical block sizes by ioctl for a block device,
+     * or the preferred IO size for a regular file,
+     * and alignment of direct IO by statx if the kernel supports it.
+     * Direct IO is assumed to be aligned to the logical block size otherwise.
+     */
+    void detectBlockSizesFirst() {
+
+        if (isBlockDevice_) {
+            int lbs;
+            unsigned int pbs;
+            if (::ioctl(fd_, BLKSSZGET, &lbs) == 0 && lbs > 0) {
+                logicalBlockSize_ = lbs;
+            }
+            if (::ioctl(fd_, BLKPBSZGET, &pbs) == 0 && pbs > 0) {
+                physicalBlockSize_ = pbs;
+            }
+        } else {
+            struct stat s;
+            if (::fstat(fd_, &s) == 0 && s.st_blksize > 0) {
+                physicalBlockSize_ = s.st_blksize;
+            }
+        }
+        dioMemAlign_ = logicalBlockSize_;
+        dioOffsetAlign_ = logicalBlockSize_;
+#ifdef STATX_DIOALIGN
+        struct statx stx;
+        if (::statx(fd_, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+            (stx.stx_mask & STATX_DIOALIGN) != 0 && stx.stx_dio_offset_align > 0) {
+            dioMemAlign_ = stx.stx_dio_mem_align;
+            dioOffsetAlign_ = stx.stx_dio_offset_align;
+        }
+#endif
+    }
 };
 
 /**
- * Calculate access range.
+ * Print block sizes and direct IO alignment of a device.
  */
-static inline size_t calcAccessRange(
-    size_t accessRange, size_t blockSize, const BlockDevice& dev) {
-    
-    return (accessRange == 0) ? (dev.getDeviceSize() / blockSize) : accessRange;
+static inline void printBlockSizes(const BlockDevice& bd)
+{
+    ::printf("device logical %zu physical %zu dio-mem-align %zu dio-offset-align %zu\n",
+             bd.getLogicalBlockSize(), bd.getPhysicalBlockSize(),
+             bd.getDioMemAlign(), bd.getDioOffsetAlign());
 }
 
 /**
- * An aio data.
+ * Byte window of a target to access.
+ * IO offsets of a pattern in [0, getSize()) are shifted by getBase().
  */
-struct AioData
+class IoWindow
 {
-    struct iocb iocb;
-    bool isWrite;
-    off_t oft;
-    size_t size;
-    char *buf;
-    double beginTime;
-    double endTime;
-};
+private:
+    uint64_t begin_; /* [byte] */
+    uint64_t end_; /* [byte]. 0 means the end of the device. */
+    size_t misalign_; /* [byte] */
 
-/**
- * Pointer to AioData.
- */
-typedef std::shared_ptr<AioData> AioDataPtr;
+public:
+    /**
+     * @misalign added to each offset to issue misaligned IOs [byte].
+     */
+    IoWindow(uint64_t begin, uint64_t end, size_t misalign)
+        : begin_(begin)
+        , end_(end)
+        , misalign_(misalign) {}
+
+    /**
+     * Resolve the end and check the window for a device.
+     * @blockSize IO size [byte].
+     * @isDirect offsets and sizes must be aligned for direct IO.
+     */
+    void resolve(const BlockDevice& bd, size_t blockSize, bool isDirect) {
+
+        if (end_ == 0) {
+            end_ = bd.getDeviceSize();
+        }
+        if (end_ > bd.getDeviceSize() || begin_ + misalign_ + blockSize > end_) {
+            throw std::runtime_error("the window must be in the device and larger than a block.");
+        }
+        if (misalign_ >= blockSize) {
+            throw std::runtime_error("misalignment must be less than the blocksize.");
+        }
+        const size_t align = bd.getDioOffsetAlign();
+        if (isDirect && (getBase() % align != 0 || blockSize % align != 0)) {
+            std::stringstream ss;
+            ss << "direct IO requires offsets and sizes aligned to " << align << " bytes.";
+            throw std::runtime_error(ss.str());
+        }
+    }
+
+    uint64_t getBegin() const { return begin_; }
+    uint64_t getEnd() const { return end_; }
+    /* Offset of the first block [byte]. */
+    uint64_t getBase() const { return begin_ + misalign_; }
+    /* Size available for IOs from the base [byte]. */
+    uint64_t getSize() const { return end_ - getBase(); }
+};
 
 /**
- * Asynchronous IO wrapper.
+ * Page cache residency of a file or device.
+ * The file is mapped read-only and examined with mincore().
  */
-class Aio
+class PageCacheProbe
 {
 private:
+    const std::string name_;
     int fd_;
-    size_t queueSize_;
-    io_context_t ctx_;
-    std::queue<AioData *> aioQueue_;
-
-    class AioDataBuffer
-    {
-    private:
-        const size_t size_;
-        size_t idx_;
-        std::vector<AioData> aioVec_;
-
-    public:
-        AioDataBuffer(size_t size)
-            : size_(size)
-            , idx_(0)
-            , aioVec_(size) {}
+    size_t size_;
+    void* addr_;
+    const size_t pageSize_;
+    std::vector<unsigned char> vec_; /* temporal use for mincore. */
 
-        AioData* next() {
+    static const size_t MAX_PAGES_AT_ONCE = 1 << 18;
 
-            AioData *ret = &aioVec_[idx_];
-            idx_ = (idx_ + 1) % size_;
-            return ret;
+public:
+    explicit PageCacheProbe(const BlockDevice& dev)
+        : name_(dev.getName())
+        , fd_(-1)
+        , size_(dev.getDeviceSize())
+        , addr_(MAP_FAILED)
+        , pageSize_(::sysconf(_SC_PAGESIZE))
+        , vec_() {
+
+        /* The device may be opened write-only, so open it again. */
+        fd_ = ::open(name_.c_str(), O_RDONLY);
+        if (fd_ < 0) {
+            std::stringstream ss;
+            ss << "open failed: " << name_ << " " << ::strerror(errno) << ".";
+            throw std::runtime_error(ss.str());
         }
-    };
+        addr_ = ::mmap(NULL, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (addr_ == MAP_FAILED) {
+            std::stringstream ss;
+            ss << "mmap failed: " << name_ << " " << ::strerror(errno) << ".";
+            ::close(fd_);
+            throw std::runtime_error(ss.str());
+        }
+    }
 
-    AioDataBuffer aioDataBuf_;
-    std::vector<struct iocb *> iocbs_; /* temporal use for submit. */
-    std::vector<struct io_event> ioEvents_; /* temporal use for wait. */
+    ~PageCacheProbe() noexcept {
+
+        ::munmap(addr_, size_);
+        ::close(fd_);
+    }
 
-public:
     /**
-     * @fd Opened file descripter.
-     * @queueSize queue size for aio.
+     * Number of pages overlapping a range.
      */
-    Aio(int fd, size_t queueSize)
-        : fd_(fd)
-        , queueSize_(queueSize)
-        , aioDataBuf_(queueSize * 2)
-        , iocbs_(queueSize)
-        , ioEvents_(queueSize) {
+    size_t getNumPages(off_t oft, size_t size) const {
 
-        assert(fd_ > 0);
-        ::io_queue_init(queueSize_, &ctx_);
+        if (size == 0) { return 0; }
+        return (oft + size - 1) / pageSize_ - oft / pageSize_ + 1;
     }
 
-    ~Aio() noexcept {
+    /**
+     * Number of resident pages in a range.
+     */
+    size_t countResident(off_t oft, size_t size) {
 
-        ::io_queue_release(ctx_);
+        if (size_ < oft + size) {
+            size = (static_cast<size_t>(oft) < size_) ? size_ - oft : 0;
+        }
+        size_t pageId = oft / pageSize_;
+        size_t nPages = getNumPages(oft, size);
+        size_t ret = 0;
+        while (nPages > 0) {
+            size_t n = std::min(nPages, MAX_PAGES_AT_ONCE);
+            vec_.resize(n);
+            char* p = static_cast<char*>(addr_) + pageId * pageSize_;
+            if (::mincore(p, n * pageSize_, &vec_[0]) < 0) {
+                std::string e("mincore failed: ");
+                e += ::strerror(errno);
+                throw std::runtime_error(e);
+            }
+            for (size_t i = 0; i < n; i++) {
+                ret += vec_[i] & 1;
+            }
+            pageId += n;
+            nPages -= n;
+        }
+        return ret;
     }
 
-    class EofError : public std::exception {};
-
     /**
-     * Prepare a read IO.
+     * RETURN:
+     *   true if all the pages of a range are resident.
      */
-    bool prepareRead(off_t oft, size_t size, char* buf) noexcept {
+    bool isResident(off_t oft, size_t size) {
 
-        if (aioQueue_.size() > queueSize_) {
-            return false;
-        }
-        
-        auto* ptr = aioDataBuf_.next();
-        aioQueue_.push(ptr);
-        ptr->isWrite = false;
-        ptr->oft = oft;
-        ptr->size = size;
-        ptr->buf = buf;
-        ptr->beginTime = 0.0;
-        ptr->endTime = 0.0;
-        ::io_prep_pread(&ptr->iocb, fd_, buf, size, oft);
-        ptr->iocb.data = ptr;
-        return true;
+        return countResident(oft, size) == getNumPages(oft, size);
     }
 
     /**
-     * Prepare a write IO.
+     * Print page cache residency of a range.
+     * @when label like "before" or "after".
      */
-    bool prepareWrite(off_t oft, size_t size, char* buf) noexcept {
+    void print(const char* when, off_t oft, size_t size) {
 
-        if (aioQueue_.size() > queueSize_) {
-            return false;
-        }
-        
-        auto* ptr = aioDataBuf_.next();
-        aioQueue_.push(ptr);
-        ptr->isWrite = true;
-        ptr->oft = oft;
-        ptr->size = size;
-        ptr->buf = buf;
-        ptr->beginTime = 0.0;
-        ptr->endTime = 0.0;
-        ::io_prep_pwrite(&ptr->iocb, fd_, buf, size, oft);
-        ptr->iocb.data = ptr;
-        return true;
+        size_t nPages = getNumPages(oft, size);
+        size_t nResident = countResident(oft, size);
+        ::printf("pagecache %s resident %zu pages %zu ratio %.06f\n",
+                 when, nResident, nPages,
+                 nPages == 0 ? 0.0 : static_cast<double>(nResident) / nPages);
+    }
+};
+
+/**
+ * Drop page cache if required, and print page cache residency of a range.
+ * This is for buffered IO.
+ *
+ * @when label like "before" or "after".
+ * @oft start offset of the range [byte].
+ * @size size of the range [byte]. 0 means to the end.
+ */
+static inline void checkPageCache(const std::string& name, const char* when,
+                                  bool shouldDrop, off_t oft, size_t size)
+{
+    const bool isDirect = false;
+    BlockDevice bd(name, READ_MODE, isDirect);
+    if (shouldDrop) {
+        bd.dropCache();
+    }
+    if (size == 0) {
+        size = bd.getDeviceSize() - oft;
     }
+    PageCacheProbe probe(bd);
+    probe.print(when, oft, size);
+}
+
+/**
+ * Ratio of IO operation types.
+ */
+class OpMix
+{
+private:
+    unsigned int ratio_[N_IO_OPS];
+    unsigned int total_;
 
+public:
     /**
-     * Submit all prepared IO(s).
+     * Default ratio for a mode.
      */
-    void submit() {
+    explicit OpMix(Mode mode)
+        : total_(0) {
 
-        size_t nr = aioQueue_.size();
-        if (nr == 0) {
-            return;
+        std::fill(ratio_, ratio_ + N_IO_OPS, 0);
+        switch (mode) {
+        case READ_MODE:  ratio_[READ_OP] = 1; break;
+        case WRITE_MODE: ratio_[WRITE_OP] = 1; break;
+        case MIX_MODE:   ratio_[READ_OP] = 1; ratio_[WRITE_OP] = 1; break;
         }
-        assert(iocbs_.size() >= nr);
-        double beginTime = getTime();
-        for (size_t i = 0; i < nr; i++) {
-            auto* ptr = aioQueue_.front();
-            aioQueue_.pop();
-            iocbs_[i] = &ptr->iocb;
-            ptr->beginTime = beginTime;
+        calcTotal();
+    }
+
+    /**
+     * @spec "read:write:discard:zero" like "70:20:10:0".
+     *   Omitted trailing ratios are 0.
+     */
+    explicit OpMix(const std::string& spec)
+        : total_(0) {
+
+        std::fill(ratio_, ratio_ + N_IO_OPS, 0);
+        std::stringstream ss(spec);
+        std::string item;
+        size_t i = 0;
+        while (std::getline(ss, item, ':')) {
+            if (i >= N_IO_OPS) {
+                throw std::runtime_error("too many ratios in op mix: " + spec);
+            }
+            ratio_[i++] = ::atoi(item.c_str());
         }
-        assert(aioQueue_.empty());
-        int err = ::io_submit(ctx_, nr, &iocbs_[0]);
-        if (err != static_cast<int>(nr)) {
-            /* ::printf("submit error %d.\n", err); */
-            throw EofError();
+        calcTotal();
+        if (total_ == 0) {
+            throw std::runtime_error("invalid op mix: " + spec);
         }
     }
 
     /**
-     * Wait several IO(s) completed.
-     *
+     * Choose an operation type.
+     * @r a random value.
+     */
+    IoOp choose(size_t r) const {
+
+        unsigned int x = r % total_;
+        for (size_t i = 0; i < N_IO_OPS; i++) {
+            if (x < ratio_[i]) { return static_cast<IoOp>(i); }
+            x -= ratio_[i];
+        }
+        assert(false);
+        return READ_OP;
+    }
+
+    bool has(IoOp op) const { return ratio_[op] > 0; }
+    bool isReadOnly() const { return ratio_[READ_OP] == total_; }
+
+private:
+    void calcTotal() {
+
+        total_ = 0;
+        for (size_t i = 0; i < N_IO_OPS; i++) {
+            total_ += ratio_[i];
+        }
+    }
+};
+
+/**
+ * File or device accessed through a shared mapping.
+ * Read and write are memcpy from and into the mapping.
+ * This has the same IO interface as BlockDevice.
+ */
+class MmapDevice
+{
+private:
+    BlockDevice dev_;
+    const Mode mode_;
+    const bool isSync_;
+    const size_t pageSize_;
+    void* addr_;
+
+public:
+    /**
+     * @advice madvise() advice like MADV_RANDOM.
+     * @isPopulate map with MAP_POPULATE.
+     * @isSync call msync() after each write.
+     */
+    MmapDevice(const std::string& name, const Mode mode, int advice,
+               bool isPopulate, bool isSync)
+        : dev_(name, mode == READ_MODE ? READ_MODE : MIX_MODE, false)
+        , mode_(mode)
+        , isSync_(isSync)
+        , pageSize_(::sysconf(_SC_PAGESIZE))
+        , addr_(MAP_FAILED) {
+
+        int prot = PROT_READ;
+        if (mode_ != READ_MODE) { prot |= PROT_WRITE; }
+        int flags = MAP_SHARED;
+        if (isPopulate) { flags |= MAP_POPULATE; }
+        addr_ = ::mmap(NULL, dev_.getDeviceSize(), prot, flags, dev_.getFd(), 0);
+        if (addr_ == MAP_FAILED) {
+            std::stringstream ss;
+            ss << "mmap failed: " << name << " " << ::strerror(errno) << ".";
+            throw std::runtime_error(ss.str());
+        }
+        if (::madvise(addr_, dev_.getDeviceSize(), advice) < 0) {
+            std::string e("madvise failed: ");
+            e += ::strerror(errno);
+            throw std::runtime_error(e);
+        }
+    }
+
+    ~MmapDevice() noexcept {
+
+        ::munmap(addr_, dev_.getDeviceSize());
+    }
+
+    size_t getDeviceSize() const { return dev_.getDeviceSize(); }
+    Mode getMode() const { return mode_; }
+
+    /**
+     * Copy data from the mapping.
+     */
+    void read(off_t oft, size_t size, char* buf) {
+
+        if (getDeviceSize() < oft + size) { throw BlockDevice::EofError(); }
+        ::memcpy(buf, static_cast<char*>(addr_) + oft, size);
+    }
+
+    /**
+     * Copy data into the mapping.
+     */
+    void write(off_t oft, size_t size, char* buf) {
+
+        if (getDeviceSize() < oft + size) { throw BlockDevice::EofError(); }
+        if (mode_ == READ_MODE) { throw std::runtime_error("write is not permitted."); }
+        ::memcpy(static_cast<char*>(addr_) + oft, buf, size);
+        if (isSync_) {
+            size_t begin = oft / pageSize_ * pageSize_;
+            if (::msync(static_cast<char*>(addr_) + begin, oft + size - begin, MS_SYNC) < 0) {
+                std::string e("msync failed: ");
+                e += ::strerror(errno);
+                throw std::runtime_error(e);
+            }
+        }
+    }
+
+    /**
+     * Execute an IO of any operation type.
+     * Discard and zero are applied to the underlying file.
+     */
+    void execIo(IoOp op, off_t oft, size_t size, char* buf) {
+
+        switch (op) {
+        case READ_OP:    read(oft, size, buf); break;
+        case WRITE_OP:   write(oft, size, buf); break;
+        case DISCARD_OP: dev_.discard(oft, size); break;
+        case ZERO_OP:    dev_.zeroRange(oft, size); break;
+        default:         assert(false);
+        }
+    }
+};
+
+/**
+ * Parse a madvise() advice name.
+ */
+static inline int parseMadvise(const std::string& name)
+{
+    if (name == "normal") { return MADV_NORMAL; }
+    if (name == "random") { return MADV_RANDOM; }
+    if (name == "sequential") { return MADV_SEQUENTIAL; }
+    if (name == "willneed") { return MADV_WILLNEED; }
+    throw std::runtime_error("unknown madvise advice: " + name);
+}
+
+/**
+ * Calculate access range.
+ * Dev is BlockDevice or MmapDevice.
+ */
+template<typename Dev>
+static inline size_t calcAccessRange(
+    size_t accessRange, size_t blockSize, const Dev& dev) {
+    
+    return (accessRange == 0) ? (dev.getDeviceSize() / blockSize) : accessRange;
+}
+
+/**
+ * An aio data.
+ */
+struct AioData
+{
+    struct iocb iocb;
+    bool isWrite;
+    off_t oft;
+    size_t size;
+    char *buf;
+    size_t depth; /* given to prepareRead/prepareWrite. */
+    double beginTime;
+    double endTime;
+
+    /* getTsc() when io_submit() is called and returned,
+       the earliest time the IO can have completed, and when it is reaped. */
+    uint64_t submitBeginTsc;
+    uint64_t submitEndTsc;
+    uint64_t completeTsc;
+    uint64_t reapTsc;
+};
+
+/**
+ * Pointer to AioData.
+ */
+typedef std::shared_ptr<AioData> AioDataPtr;
+
+/**
+ * Asynchronous IO wrapper.
+ */
+class Aio
+{
+private:
+    int fd_;
+    size_t queueSize_;
+    io_context_t ctx_;
+    std::queue<AioData *> aioQueue_;
+
+    bool isPoll_;
+    size_t pollBudget_; /* 0 means unlimited. */
+    size_t nPolls_;
+    size_t nFallbacks_;
+
+    bool isPhaseTracking_;
+    uint64_t completeTsc_; /* estimated completion of the last getEvents(). */
+    uint64_t drainedTsc_; /* IOs in flight were not completed at this time. */
+
+    /**
+     * Free list of AioData.
+     * Completed data are appended to the tail and reused last,
+     * so IOs in flight are never overwritten
+     * even if they complete out of order.
+     */
+    class AioDataBuffer
+    {
+    private:
+        std::vector<AioData> aioVec_;
+        std::deque<AioData *> freeQ_;
+
+    public:
+        AioDataBuffer(size_t size)
+            : aioVec_(size)
+            , freeQ_() {
+
+            for (size_t i = 0; i < size; i++) {
+                freeQ_.push_back(&aioVec_[i]);
+            }
+        }
+
+        AioData* next() {
+
+            assert(!freeQ_.empty());
+            AioData *ret = freeQ_.front();
+            freeQ_.pop_front();
+            return ret;
+        }
+
+        void release(AioData *ptr) {
+
+            freeQ_.push_back(ptr);
+        }
+    };
+
+    AioDataBuffer aioDataBuf_;
+    std::vector<struct iocb *> iocbs_; /* temporal use for submit. */
+    std::vector<struct io_event> ioEvents_; /* temporal use for wait. */
+
+public:
+    /**
+     * @fd Opened file descripter.
+     * @queueSize queue size for aio.
+     */
+    Aio(int fd, size_t queueSize)
+        : fd_(fd)
+        , queueSize_(queueSize)
+        , isPoll_(false)
+        , pollBudget_(0)
+        , nPolls_(0)
+        , nFallbacks_(0)
+        , isPhaseTracking_(false)
+        , completeTsc_(0)
+        , drainedTsc_(0)
+        , aioDataBuf_(queueSize * 2)
+        , iocbs_(queueSize)
+        , ioEvents_(queueSize) {
+
+        assert(fd_ > 0);
+        ::io_queue_init(queueSize_, &ctx_);
+    }
+
+    ~Aio() noexcept {
+
+        ::io_queue_release(ctx_);
+    }
+
+    class EofError : public std::exception {};
+
+    /**
+     * Reap completions by busy polling instead of sleeping in io_getevents().
+     *
+     * @budget number of polls per wait before falling back to blocking.
+     *   0 means polling without falling back.
+     */
+    void setPolling(size_t budget) {
+
+        isPoll_ = true;
+        pollBudget_ = budget;
+    }
+
+    bool isPolling() const { return isPoll_; }
+    /* Total number of polls. */
+    size_t getNPolls() const { return nPolls_; }
+    /* Number of waits that exhausted the budget and blocked. */
+    size_t getNFallbacks() const { return nFallbacks_; }
+
+    /**
+     * Estimate completion time of each IO more precisely.
+     * A blocking wait is preceded by a non-blocking one,
+     * so IOs completed before the wait can be told from IOs the wait slept for.
+     * The former are regarded as completed just after the last
+     * io_getevents() that did not return them,
+     * so the device phase is a lower bound and the reap phase an upper bound.
+     * Without this, completion is assumed to be when io_getevents() returns.
+     */
+    void setPhaseTracking() { isPhaseTracking_ = true; }
+
+    /**
+     * Prepare a read IO.
+     * @depth any value returned with the completion.
+     */
+    bool prepareRead(off_t oft, size_t size, char* buf, size_t depth = 0) noexcept {
+
+        if (aioQueue_.size() > queueSize_) {
+            return false;
+        }
+        
+        auto* ptr = aioDataBuf_.next();
+        aioQueue_.push(ptr);
+        ptr->isWrite = false;
+        ptr->oft = oft;
+        ptr->size = size;
+        ptr->buf = buf;
+        ptr->depth = depth;
+        ptr->beginTime = 0.0;
+        ptr->endTime = 0.0;
+        ptr->submitBeginTsc = ptr->submitEndTsc = ptr->completeTsc = ptr->reapTsc = 0;
+        ::io_prep_pread(&ptr->iocb, fd_, buf, size, oft);
+        ptr->iocb.data = ptr;
+        return true;
+    }
+
+    /**
+     * Prepare a write IO.
+     * @depth any value returned with the completion.
+     */
+    bool prepareWrite(off_t oft, size_t size, char* buf, size_t depth = 0) noexcept {
+
+        if (aioQueue_.size() > queueSize_) {
+            return false;
+        }
+        
+        auto* ptr = aioDataBuf_.next();
+        aioQueue_.push(ptr);
+        ptr->isWrite = true;
+        ptr->oft = oft;
+        ptr->size = size;
+        ptr->buf = buf;
+        ptr->depth = depth;
+        ptr->beginTime = 0.0;
+        ptr->endTime = 0.0;
+        ptr->submitBeginTsc = ptr->submitEndTsc = ptr->completeTsc = ptr->reapTsc = 0;
+        ::io_prep_pwrite(&ptr->iocb, fd_, buf, size, oft);
+        ptr->iocb.data = ptr;
+        return true;
+    }
+
+    /**
+     * Submit all prepared IO(s).
+     */
+    void submit() {
+
+        size_t nr = aioQueue_.size();
+        if (nr == 0) {
+            return;
+        }
+        assert(iocbs_.size() >= nr);
+        double beginTime = getTime();
+        const uint64_t beginTsc = getTsc();
+        for (size_t i = 0; i < nr; i++) {
+            auto* ptr = aioQueue_.front();
+            aioQueue_.pop();
+            iocbs_[i] = &ptr->iocb;
+            ptr->beginTime = beginTime;
+            ptr->submitBeginTsc = beginTsc;
+        }
+        assert(aioQueue_.empty());
+        int err = ::io_submit(ctx_, nr, &iocbs_[0]);
+        if (err != static_cast<int>(nr)) {
+            /* ::printf("submit error %d.\n", err); */
+            throw EofError();
+        }
+        const uint64_t endTsc = getTsc();
+        for (size_t i = 0; i < nr; i++) {
+            static_cast<AioData *>(iocbs_[i]->data)->submitEndTsc = endTsc;
+        }
+    }
+
+    /**
+     * Wait several IO(s) completed.
+     *
      * @nr number of waiting IO(s).
      * @events event array for temporary use.
      * @aioQueue AioDataPtr of completed IO will be pushed into it.
      */
     void wait(size_t nr, std::queue<AioData>& aioDataQueue) {
 
-        size_t done = 0;
-        bool isError = false;
-        while (done < nr) {
-            int tmpNr = ::io_getevents(ctx_, 1, nr - done, &ioEvents_[done], NULL);
-            if (tmpNr < 1) {
-                throw std::runtime_error("io_getevents failed.");
-            }
-            double endTime = getTime();
-            for (size_t i = done; i < done + tmpNr; i++) {
-                auto* iocb = static_cast<struct iocb *>(ioEvents_[i].obj);
-                auto* ptr = static_cast<AioData *>(iocb->data);
-                if (ioEvents_[i].res != ptr->iocb.u.c.nbytes) {
-                    isError = true;
-                }
-                ptr->endTime = endTime;
-                aioDataQueue.push(*ptr);
-            }
-            done += tmpNr;
+        size_t done = 0;
+        bool isError = false;
+        while (done < nr) {
+            int tmpNr = getEvents(nr - done, &ioEvents_[done], -1.0);
+            if (tmpNr < 1) {
+                throw std::runtime_error("io_getevents failed.");
+            }
+            double endTime = getTime();
+            const uint64_t reapTsc = getTsc();
+            for (size_t i = done; i < done + tmpNr; i++) {
+                auto* iocb = static_cast<struct iocb *>(ioEvents_[i].obj);
+                auto* ptr = static_cast<AioData *>(iocb->data);
+                if (ioEvents_[i].res != ptr->iocb.u.c.nbytes) {
+                    isError = true;
+                }
+                ptr->endTime = endTime;
+                setReapTsc(ptr, reapTsc);
+                aioDataQueue.push(*ptr);
+                aioDataBuf_.release(ptr);
+            }
+            done += tmpNr;
+        }
+        if (isError) {
+            // ::printf("wait error.\n");
+            throw EofError();
+        }
+    }
+
+    /**
+     * Wait just one IO completed with a timeout.
+     *
+     * @timeout timeout period [second].
+     * @return aio data pointer, or nullptr if timeout.
+     */
+    AioData* waitOneFor(double timeout) {
+
+        auto& event = ioEvents_[0];
+        if (timeout < 0) { timeout = 0; }
+        int err = getEvents(1, &event, timeout);
+        double endTime = getTime();
+        if (err == 0) {
+            return nullptr;
+        }
+        if (err != 1) {
+            throw std::runtime_error("io_getevents failed.");
+        }
+        auto* iocb = static_cast<struct iocb *>(event.obj);
+        auto* ptr = static_cast<AioData *>(iocb->data);
+        aioDataBuf_.release(ptr);
+        if (event.res != ptr->iocb.u.c.nbytes) {
+            throw EofError();
+        }
+        ptr->endTime = endTime;
+        setReapTsc(ptr, getTsc());
+        return ptr;
+    }
+
+    /**
+     * Wait just one IO completed.
+     *
+     * @return aio data pointer.
+     *   This data is available at least before calling
+     *   queueSize_ times of prepareWrite/prepareRead.
+     */
+    AioData* waitOne() {
+
+        auto& event = ioEvents_[0];
+        int err = getEvents(1, &event, -1.0);
+        double endTime = getTime();
+        if (err != 1) {
+            throw std::runtime_error("io_getevents failed.");
+        }
+        auto* iocb = static_cast<struct iocb *>(event.obj);
+        auto* ptr = static_cast<AioData *>(iocb->data);
+        aioDataBuf_.release(ptr);
+        if (event.res != ptr->iocb.u.c.nbytes) {
+            // ::printf("waitOne error %lu\n", event.res);
+            throw EofError();
+        }
+        ptr->endTime = endTime;
+        setReapTsc(ptr, getTsc());
+        return ptr;
+    }
+
+private:
+    void setReapTsc(AioData* ptr, uint64_t reapTsc) const {
+
+        ptr->completeTsc = std::max(ptr->submitEndTsc, completeTsc_);
+        ptr->reapTsc = reapTsc;
+    }
+
+    /**
+     * io_getevents() returning fewer events than nr,
+     * which means IOs still in flight were not completed when it was called.
+     */
+    int getEventsOnce(size_t nr, struct io_event* events, struct timespec* ts) {
+
+        const uint64_t tsc = getTsc();
+        const int err = ::io_getevents(ctx_, 1, nr, events, ts);
+        if (err >= 0 && static_cast<size_t>(err) < nr) {
+            drainedTsc_ = tsc;
+        }
+        return err;
+    }
+
+    /**
+     * io_getevents() for at least one event.
+     * With polling, spin with zero timeout until an event arrives,
+     * the timeout expires, or the budget is exhausted.
+     * Events returned without sleeping may have been completed at any time
+     * after the last call that drained the completions,
+     * so that time is taken as their completion, the earliest possible.
+     * Events a blocking wait slept for are regarded as completed
+     * when they are returned.
+     * completeTsc_ is set to the estimated completion time.
+     *
+     * @timeout [second]. Negative means no timeout.
+     * @return number of events, or 0 if timeout.
+     */
+    int getEvents(size_t nr, struct io_event* events, double timeout) {
+
+        const double deadline = (timeout < 0) ? 0.0 : getTime() + timeout;
+        struct timespec zero = {0, 0};
+        if (isPoll_) {
+            size_t i = 0;
+            while (pollBudget_ == 0 || i < pollBudget_) {
+                const uint64_t drainedTsc = drainedTsc_;
+                int err = getEventsOnce(nr, events, &zero);
+                i++;
+                if (err != 0) {
+                    nPolls_ += i;
+                    completeTsc_ = drainedTsc;
+                    return err;
+                }
+                if (timeout >= 0 && getTime() >= deadline) {
+                    nPolls_ += i;
+                    return 0;
+                }
+            }
+            nPolls_ += i;
+            nFallbacks_++;
+            if (timeout >= 0) {
+                timeout = std::max(0.0, deadline - getTime());
+            }
+        } else if (isPhaseTracking_) {
+            const uint64_t drainedTsc = drainedTsc_;
+            int err = getEventsOnce(nr, events, &zero);
+            if (err != 0) {
+                completeTsc_ = drainedTsc;
+                return err;
+            }
+        }
+        int err;
+        if (timeout < 0) {
+            err = getEventsOnce(nr, events, NULL);
+        } else {
+            struct timespec ts;
+            ts.tv_sec = static_cast<time_t>(timeout);
+            ts.tv_nsec = static_cast<long>((timeout - static_cast<double>(ts.tv_sec)) * 1000000000.0);
+            err = getEventsOnce(nr, events, &ts);
+        }
+        completeTsc_ = getTsc();
+        return err;
+    }
+};
+
+/**
+ * Print polling statistics if enabled.
+ */
+static inline void printPollStatistics(const Aio& aio)
+{
+    if (!aio.isPolling()) { return; }
+    ::printf("poll polls %zu fallbacks %zu\n", aio.getNPolls(), aio.getNFallbacks());
+}
+
+
+class PerformanceStatistics
+{
+private:
+    double total_;
+    double max_;
+    double min_;
+    size_t count_;
+
+public:
+    PerformanceStatistics()
+        : total_(0), max_(-1.0), min_(-1.0), count_(0) {}
+    PerformanceStatistics(double total, double max, double min, size_t count)
+        : total_(total), max_(max), min_(min), count_(count) {}
+
+    void updateRt(double rt) {
+
+        if (max_ < 0 || min_ < 0) {
+            max_ = rt; min_ = rt;
+        } else if (max_ < rt) {
+            max_ = rt;
+        } else if (min_ > rt) {
+            min_ = rt;
+        }
+        total_ += rt;
+        count_++;
+    }
+    
+    double getMax() const { return max_; }
+    double getMin() const { return min_; }
+    double getTotal() const { return total_; }
+    size_t getCount() const { return count_; }
+
+    double getAverage() const { return total_ / (double)count_; }
+
+    void merge(const PerformanceStatistics& rhs) {
+
+        if (rhs.count_ == 0) { return; }
+        if (count_ == 0) { *this = rhs; return; }
+        total_ += rhs.total_;
+        max_ = std::max(max_, rhs.max_);
+        min_ = std::min(min_, rhs.min_);
+        count_ += rhs.count_;
+    }
+
+    void print() const {
+        ::printf("total %.06f count %zu avg %.06f max %.06f min %.06f\n",
+                 getTotal(), getCount(), getAverage(),
+                 getMax(), getMin());
+    }
+};
+
+template<typename T> //T is iterator type of PerformanceStatistics.
+static inline PerformanceStatistics mergeStats(const T begin, const T end)
+{
+    double total = 0;
+    double max = -1.0;
+    double min = -1.0;
+    size_t count = 0;
+
+    std::for_each(begin, end, [&](PerformanceStatistics& stat) {
+
+            total += stat.getTotal();
+            if (max < 0 || max < stat.getMax()) { max = stat.getMax(); }
+            if (min < 0 || min > stat.getMin()) { min = stat.getMin(); }
+            count += stat.getCount();
+        });
+    
+    return PerformanceStatistics(total, max, min, count);
+}
+
+/**
+ * Log-linear latency histogram.
+ * Values are recorded in nanoseconds with 1/16 relative precision.
+ * The size is fixed so that it can be copied and merged cheaply.
+ */
+class LatencyHistogram
+{
+private:
+    static const size_t SUB_BITS = 4;
+    static const size_t N_SUB = 1 << SUB_BITS;
+    static const size_t N_BUCKETS = (64 - SUB_BITS + 1) * N_SUB;
+
+    uint64_t counts_[N_BUCKETS];
+    uint64_t total_;
+
+public:
+    LatencyHistogram()
+        : total_(0) {
+
+        std::fill(counts_, counts_ + N_BUCKETS, 0);
+    }
+
+    /**
+     * @rt response time [second].
+     */
+    void add(double rt) {
+
+        uint64_t ns = (rt <= 0) ? 0 : static_cast<uint64_t>(rt * 1000000000.0);
+        counts_[getIndex(ns)]++;
+        total_++;
+    }
+
+    void merge(const LatencyHistogram& rhs) {
+
+        for (size_t i = 0; i < N_BUCKETS; i++) {
+            counts_[i] += rhs.counts_[i];
+        }
+        total_ += rhs.total_;
+    }
+
+    uint64_t getCount() const { return total_; }
+
+    /**
+     * @p percentile in [0, 100].
+     * RETURN:
+     *   response time [second].
+     */
+    double getPercentile(double p) const {
+
+        if (total_ == 0) { return 0.0; }
+        uint64_t target = static_cast<uint64_t>(p / 100.0 * static_cast<double>(total_) + 0.5);
+        if (target == 0) { target = 1; }
+        uint64_t c = 0;
+        for (size_t i = 0; i < N_BUCKETS; i++) {
+            c += counts_[i];
+            if (c >= target) {
+                return static_cast<double>(getValue(i)) / 1000000000.0;
+            }
+        }
+        return static_cast<double>(getValue(N_BUCKETS - 1)) / 1000000000.0;
+    }
+
+    /**
+     * @p percentile in [0, 100].
+     * RETURN:
+     *   upper end of the bucket of the percentile [second].
+     *   Response times above it are in slower buckets.
+     */
+    double getPercentileUpperEnd(double p) const {
+
+        if (total_ == 0) { return 0.0; }
+        uint64_t target = static_cast<uint64_t>(p / 100.0 * static_cast<double>(total_) + 0.5);
+        if (target == 0) { target = 1; }
+        uint64_t c = 0;
+        size_t i = 0;
+        while (i < N_BUCKETS - 1) {
+            c += counts_[i];
+            if (c >= target) { break; }
+            i++;
+        }
+        if (i == N_BUCKETS - 1) { return static_cast<double>(UINT64_MAX) / 1000000000.0; }
+        return static_cast<double>(getLowerEnd(i + 1)) / 1000000000.0;
+    }
+
+    /**
+     * @rank in [1, getCount()].
+     * RETURN:
+     *   response time of the rank-th fastest IO [second].
+     */
+    double getValueAtRank(uint64_t rank) const {
+
+        uint64_t c = 0;
+        for (size_t i = 0; i < N_BUCKETS; i++) {
+            c += counts_[i];
+            if (c >= rank) {
+                return static_cast<double>(getValue(i)) / 1000000000.0;
+            }
+        }
+        return static_cast<double>(getValue(N_BUCKETS - 1)) / 1000000000.0;
+    }
+
+    void print() const {
+        ::printf("p50 %.06f p90 %.06f p99 %.06f p99.9 %.06f p99.99 %.06f\n",
+                 getPercentile(50), getPercentile(90), getPercentile(99),
+                 getPercentile(99.9), getPercentile(99.99));
+    }
+
+    /*
+     * Raw buckets to save and load a histogram.
+     */
+    static size_t getNBuckets() { return N_BUCKETS; }
+    uint64_t getBucketCount(size_t idx) const { return counts_[idx]; }
+    void addBucketCount(size_t idx, uint64_t count) {
+
+        assert(idx < N_BUCKETS);
+        counts_[idx] += count;
+        total_ += count;
+    }
+
+private:
+    static size_t getIndex(uint64_t ns) {
+
+        if (ns < N_SUB) { return ns; }
+        size_t msb = 63 - __builtin_clzll(ns);
+        size_t group = msb - SUB_BITS + 1;
+        size_t sub = (ns >> (msb - SUB_BITS)) & (N_SUB - 1);
+        return group * N_SUB + sub;
+    }
+
+    /**
+     * Smallest value of a bucket [nanosecond].
+     */
+    static uint64_t getLowerEnd(size_t idx) {
+
+        size_t group = idx / N_SUB;
+        size_t sub = idx % N_SUB;
+        if (group == 0) { return sub; }
+        return (N_SUB + sub) << (group - 1);
+    }
+
+    /**
+     * Middle value of a bucket [nanosecond].
+     */
+    static uint64_t getValue(size_t idx) {
+
+        size_t group = idx / N_SUB;
+        size_t sub = idx % N_SUB;
+        if (group == 0) { return sub; }
+        uint64_t width = 1ULL << (group - 1);
+        return ((N_SUB + sub) << (group - 1)) + width / 2;
+    }
+};
+
+/**
+ * Number of IOs and bytes completed in each second of wall clock time.
+ * Series of workers are merged by aligning the seconds.
+ */
+class IntervalSeries
+{
+public:
+    struct Sample
+    {
+        size_t count;
+        size_t size; /* [byte] */
+    };
+
+private:
+    int64_t base_; /* unix time of the first sample [second] */
+    std::vector<Sample> samples_;
+
+public:
+    IntervalSeries()
+        : base_(0), samples_() {}
+
+    /**
+     * @time completion time [second].
+     * @size [byte].
+     */
+    void add(double time, size_t size) {
+
+        const int64_t sec = static_cast<int64_t>(time);
+        if (samples_.empty()) {
+            base_ = sec;
+        }
+        if (sec < base_) {
+            samples_.insert(samples_.begin(), base_ - sec, Sample());
+            base_ = sec;
+        }
+        const size_t idx = sec - base_;
+        if (idx >= samples_.size()) {
+            samples_.resize(idx + 1, Sample());
+        }
+        samples_[idx].count++;
+        samples_[idx].size += size;
+    }
+
+    void merge(const IntervalSeries& rhs) {
+
+        if (rhs.samples_.empty()) { return; }
+        if (samples_.empty()) {
+            *this = rhs;
+            return;
+        }
+        if (rhs.base_ < base_) {
+            samples_.insert(samples_.begin(), base_ - rhs.base_, Sample());
+            base_ = rhs.base_;
+        }
+        const size_t first = rhs.base_ - base_;
+        if (first + rhs.samples_.size() > samples_.size()) {
+            samples_.resize(first + rhs.samples_.size(), Sample());
+        }
+        for (size_t i = 0; i < rhs.samples_.size(); i++) {
+            samples_[first + i].count += rhs.samples_[i].count;
+            samples_[first + i].size += rhs.samples_[i].size;
+        }
+    }
+
+    /**
+     * Samples of whole seconds.
+     * The first and the last seconds are partial, so they are excluded.
+     */
+    std::vector<Sample> getWholeSamples() const {
+
+        if (samples_.size() <= 2) { return std::vector<Sample>(); }
+        return std::vector<Sample>(samples_.begin() + 1, samples_.end() - 1);
+    }
+};
+
+/**
+ * Read latency classified by page cache hit and miss.
+ */
+class CacheHitStatistics
+{
+private:
+    PerformanceStatistics stats_[2];
+    LatencyHistogram hists_[2];
+
+public:
+    void updateRt(bool isHit, double rt) {
+
+        stats_[isHit].updateRt(rt);
+        hists_[isHit].add(rt);
+    }
+
+    void merge(const CacheHitStatistics& rhs) {
+
+        for (size_t i = 0; i < 2; i++) {
+            stats_[i].merge(rhs.stats_[i]);
+            hists_[i].merge(rhs.hists_[i]);
+        }
+    }
+
+    void print() const {
+
+        static const char* names[2] = { "miss", "hit" };
+        for (size_t i = 0; i < 2; i++) {
+            if (stats_[i].getCount() == 0) { continue; }
+            ::printf("%s ", names[i]);
+            stats_[i].print();
+            ::printf("%s ", names[i]);
+            hists_[i].print();
+        }
+    }
+};
+
+/**
+ * Latency of each phase of aio: submit (io_submit() call),
+ * device (from submission to completion), and reap (from completion
+ * to io_getevents() returning the IO).
+ * Completion of an IO reaped without sleeping is not observed,
+ * so its device phase is a lower bound and its reap phase an upper bound.
+ * Tail latency of submit and reap is of the benchmark and the kernel,
+ * and that of device is mainly of the device.
+ */
+class IoPhaseStatistics
+{
+private:
+    enum { SUBMIT_PHASE, DEVICE_PHASE, REAP_PHASE, N_PHASES };
+
+    PerformanceStatistics stats_[N_PHASES];
+    LatencyHistogram hists_[N_PHASES];
+
+public:
+    /**
+     * @submit @device @reap [second].
+     */
+    void updateRt(double submit, double device, double reap) {
+
+        const double rts[N_PHASES] = { submit, device, reap };
+        for (size_t i = 0; i < N_PHASES; i++) {
+            stats_[i].updateRt(rts[i]);
+            hists_[i].add(rts[i]);
+        }
+    }
+
+    void merge(const IoPhaseStatistics& rhs) {
+
+        for (size_t i = 0; i < N_PHASES; i++) {
+            stats_[i].merge(rhs.stats_[i]);
+            hists_[i].merge(rhs.hists_[i]);
+        }
+    }
+
+    void print() const {
+
+        static const char* names[N_PHASES] = { "submit", "device", "reap" };
+        for (size_t i = 0; i < N_PHASES; i++) {
+            if (stats_[i].getCount() == 0) { continue; }
+            ::printf("%s ", names[i]);
+            stats_[i].print();
+            ::printf("%s ", names[i]);
+            hists_[i].print();
+        }
+    }
+};
+
+/**
+ * CPU time and context switches consumed
+ * by the process, the calling thread, or waited children.
+ */
+struct CpuTime
+{
+    double user; /* [second] */
+    double sys; /* [second] */
+    size_t nVcsw; /* voluntary context switches. */
+    size_t nIvcsw; /* involuntary context switches. */
+
+    CpuTime()
+        : user(0), sys(0), nVcsw(0), nIvcsw(0) {}
+
+    /**
+     * @who RUSAGE_SELF, RUSAGE_THREAD, or RUSAGE_CHILDREN.
+     */
+    static CpuTime get(int who = RUSAGE_SELF) {
+
+        struct rusage ru;
+        if (::getrusage(who, &ru) < 0) {
+            std::string e("getrusage failed: ");
+            e += ::strerror(errno);
+            throw std::runtime_error(e);
+        }
+        CpuTime ret;
+        ret.user = static_cast<double>(ru.ru_utime.tv_sec) +
+            static_cast<double>(ru.ru_utime.tv_usec) / 1000000.0;
+        ret.sys = static_cast<double>(ru.ru_stime.tv_sec) +
+            static_cast<double>(ru.ru_stime.tv_usec) / 1000000.0;
+        ret.nVcsw = ru.ru_nvcsw;
+        ret.nIvcsw = ru.ru_nivcsw;
+        return ret;
+    }
+
+    CpuTime operator-(const CpuTime& rhs) const {
+
+        CpuTime ret;
+        ret.user = user - rhs.user;
+        ret.sys = sys - rhs.sys;
+        ret.nVcsw = nVcsw - rhs.nVcsw;
+        ret.nIvcsw = nIvcsw - rhs.nIvcsw;
+        return ret;
+    }
+
+    CpuTime& operator+=(const CpuTime& rhs) {
+
+        user += rhs.user;
+        sys += rhs.sys;
+        nVcsw += rhs.nVcsw;
+        nIvcsw += rhs.nIvcsw;
+        return *this;
+    }
+
+    double getTotal() const { return user + sys; }
+};
+
+/**
+ * Print CPU cost of a run.
+ * @cpu consumed during the run.
+ * @nio number of IOs.
+ * @totalSize read and written [byte].
+ * @period elapsed time [second].
+ */
+static inline void printCpuTime(const CpuTime& cpu, size_t nio, size_t totalSize, double period)
+{
+    const double us = cpu.getTotal() * 1000000.0;
+    ::printf("cpu user %.06f sys %.06f util %.06f per-io-us %.3f per-mb-us %.3f "
+             "vcsw %zu ivcsw %zu\n",
+             cpu.user, cpu.sys, cpu.getTotal() / period,
+             nio == 0 ? 0.0 : us / static_cast<double>(nio),
+             totalSize == 0 ? 0.0 : us * 1000000.0 / static_cast<double>(totalSize),
+             cpu.nVcsw, cpu.nIvcsw);
+}
+
+/**
+ * CPU cycles of the calling thread counted by perf_event_open().
+ * Kernel cycles are excluded if they are not permitted,
+ * and the counter is not available if perf events are not permitted at all.
+ */
+class CycleCounter
+{
+private:
+    int fd_;
+
+public:
+    CycleCounter()
+        : fd_(-1) {
+
+        struct perf_event_attr attr;
+        ::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_hv = 1;
+        fd_ = ::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fd_ < 0) {
+            attr.exclude_kernel = 1;
+            fd_ = ::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
         }
-        if (isError) {
-            // ::printf("wait error.\n");
-            throw EofError();
+    }
+
+    ~CycleCounter() noexcept {
+
+        if (fd_ >= 0) { ::close(fd_); }
+    }
+
+    CycleCounter(const CycleCounter&) = delete;
+    CycleCounter& operator=(const CycleCounter&) = delete;
+
+    bool isAvailable() const { return fd_ >= 0; }
+
+    uint64_t get() const {
+
+        uint64_t v = 0;
+        if (fd_ < 0 || ::read(fd_, &v, sizeof(v)) != sizeof(v)) {
+            return 0;
+        }
+        return v;
+    }
+};
+
+/**
+ * CPU usage of a worker thread.
+ */
+struct WorkerCpu
+{
+    CpuTime cpu;
+    uint64_t cycles;
+    bool hasCycles;
+    size_t nMigrations;
+
+    WorkerCpu()
+        : cpu(), cycles(0), hasCycles(false), nMigrations(0) {}
+};
+
+/**
+ * Print CPU usage of each worker, CPU cost of a run, and CPU migrations.
+ * @cpu consumed by the run.
+ * @nio number of IOs.
+ * @totalSize read and written [byte].
+ * @period elapsed time [second].
+ */
+static inline void printWorkerCpuCost(const std::vector<WorkerCpu>& workers, const CpuTime& cpu,
+                                      size_t nio, size_t totalSize, double period)
+{
+    size_t nMigrations = 0;
+    for (size_t i = 0; i < workers.size(); i++) {
+        const WorkerCpu& w = workers[i];
+        ::printf("cpu-worker %zu user %.06f sys %.06f vcsw %zu ivcsw %zu migrations %zu",
+                 i, w.cpu.user, w.cpu.sys, w.cpu.nVcsw, w.cpu.nIvcsw, w.nMigrations);
+        if (w.hasCycles) {
+            ::printf(" cycles %llu", static_cast<unsigned long long>(w.cycles));
         }
+        ::printf("\n");
+        nMigrations += w.nMigrations;
     }
+    printCpuTime(cpu, nio, totalSize, period);
+    ::printf("migrations %zu per-io %.06f\n", nMigrations,
+             nio == 0 ? 0.0 : static_cast<double>(nMigrations) / nio);
+}
+
+/**
+ * Block-layer statistics of a device.
+ * See Documentation/block/stat.rst of the kernel.
+ */
+struct DiskStats
+{
+    size_t nReads;
+    size_t nReadMerges;
+    size_t nReadSectors;
+    size_t readMs; /* [millisecond] */
+    size_t nWrites;
+    size_t nWriteMerges;
+    size_t nWriteSectors;
+    size_t writeMs; /* [millisecond] */
+    size_t nInFlight; /* a gauge, not a counter. */
+    size_t ioMs; /* time the device is busy [millisecond] */
+    size_t queueMs; /* weighted time in queue [millisecond] */
+
+    DiskStats()
+        : nReads(0), nReadMerges(0), nReadSectors(0), readMs(0)
+        , nWrites(0), nWriteMerges(0), nWriteSectors(0), writeMs(0)
+        , nInFlight(0), ioMs(0), queueMs(0) {}
 
     /**
-     * Wait just one IO completed.
-     *
-     * @return aio data pointer.
-     *   This data is available at least before calling
-     *   queueSize_ times of prepareWrite/prepareRead.
+     * Read /sys/dev/block/MAJOR:MINOR/stat,
+     * or /proc/diskstats if sysfs is not available.
+     * @return false if the device has no statistics.
      */
-    AioData* waitOne() {
-
-        auto& event = ioEvents_[0];
-        int err = ::io_getevents(ctx_, 1, 1, &event, NULL);
-        double endTime = getTime();
-        if (err != 1) {
-            throw std::runtime_error("io_getevents failed.");
+    static bool get(dev_t dev, DiskStats& st) {
+
+        if (dev == 0) { return false; }
+        char path[64];
+        ::snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/stat", major(dev), minor(dev));
+        FILE* fp = ::fopen(path, "r");
+        if (fp != NULL) {
+            const bool ret = st.scan(fp);
+            ::fclose(fp);
+            if (ret) { return true; }
         }
-        auto* iocb = static_cast<struct iocb *>(event.obj);
-        auto* ptr = static_cast<AioData *>(iocb->data);
-        if (event.res != ptr->iocb.u.c.nbytes) {
-            // ::printf("waitOne error %lu\n", event.res);
-            throw EofError();
+        fp = ::fopen("/proc/diskstats", "r");
+        if (fp == NULL) { return false; }
+        bool ret = false;
+        unsigned int maj, min;
+        char name[64];
+        while (::fscanf(fp, "%u %u %63s", &maj, &min, name) == 3) {
+            if (maj == major(dev) && min == minor(dev)) {
+                ret = st.scan(fp);
+                break;
+            }
+            int c;
+            while ((c = ::fgetc(fp)) != EOF && c != '\n') {}
         }
-        ptr->endTime = endTime;
-        return ptr;
+        ::fclose(fp);
+        return ret;
+    }
+
+    /**
+     * Difference of counters.
+     * The in-flight count is taken from the left hand side.
+     */
+    DiskStats operator-(const DiskStats& rhs) const {
+
+        DiskStats ret;
+        ret.nReads = nReads - rhs.nReads;
+        ret.nReadMerges = nReadMerges - rhs.nReadMerges;
+        ret.nReadSectors = nReadSectors - rhs.nReadSectors;
+        ret.readMs = readMs - rhs.readMs;
+        ret.nWrites = nWrites - rhs.nWrites;
+        ret.nWriteMerges = nWriteMerges - rhs.nWriteMerges;
+        ret.nWriteSectors = nWriteSectors - rhs.nWriteSectors;
+        ret.writeMs = writeMs - rhs.writeMs;
+        ret.nInFlight = nInFlight;
+        ret.ioMs = ioMs - rhs.ioMs;
+        ret.queueMs = queueMs - rhs.queueMs;
+        return ret;
+    }
+
+    size_t getCount() const { return nReads + nWrites; }
+    size_t getMerges() const { return nReadMerges + nWriteMerges; }
+
+    /**
+     * Average time from queueing to completion of a request [second].
+     */
+    double getAwait() const {
+
+        const size_t n = getCount();
+        return n == 0 ? 0.0 : static_cast<double>(readMs + writeMs) / 1000.0 / n;
+    }
+
+private:
+    bool scan(FILE* fp) {
+
+        return ::fscanf(fp, "%zu %zu %zu %zu %zu %zu %zu %zu %zu %zu %zu",
+                        &nReads, &nReadMerges, &nReadSectors, &readMs,
+                        &nWrites, &nWriteMerges, &nWriteSectors, &writeMs,
+                        &nInFlight, &ioMs, &queueMs) == 11;
     }
 };
 
+/**
+ * Print difference of block-layer statistics.
+ * @prefix of the line.
+ * @period elapsed time [second].
+ */
+static inline void printDiskStats(const char* prefix, dev_t dev, const DiskStats& d, double period)
+{
+    const double ms = period * 1000.0;
+    ::printf("%s %u:%u iops %.3f read %zu write %zu merges %zu await %.06f "
+             "queue-depth %.3f in-flight %zu util %.06f\n",
+             prefix, major(dev), minor(dev),
+             period <= 0 ? 0.0 : d.getCount() / period,
+             d.nReads, d.nWrites, d.getMerges(), d.getAwait(),
+             ms <= 0 ? 0.0 : d.queueMs / ms, d.nInFlight,
+             ms <= 0 ? 0.0 : d.ioMs / ms);
+}
 
-class PerformanceStatistics
+/**
+ * Page faults of the calling thread.
+ */
+struct PageFaults
+{
+    size_t major;
+    size_t minor;
+
+    static PageFaults get() {
+
+        struct rusage ru;
+        if (::getrusage(RUSAGE_THREAD, &ru) < 0) {
+            std::string e("getrusage failed: ");
+            e += ::strerror(errno);
+            throw std::runtime_error(e);
+        }
+        PageFaults ret;
+        ret.major = ru.ru_majflt;
+        ret.minor = ru.ru_minflt;
+        return ret;
+    }
+};
+
+/**
+ * Page faults counted for each IO window,
+ * and latency classified by the worst fault during the IO.
+ */
+class FaultStatistics
 {
 private:
-    double total_;
-    double max_;
-    double min_;
-    size_t count_;
+    enum { NO_FAULT, MINOR_FAULT, MAJOR_FAULT, N_FAULT_TYPES };
 
-public:
-    PerformanceStatistics()
-        : total_(0), max_(-1.0), min_(-1.0), count_(0) {}
-    PerformanceStatistics(double total, double max, double min, size_t count)
-        : total_(total), max_(max), min_(min), count_(count) {}
+    size_t major_;
+    size_t minor_;
+    PerformanceStatistics stats_[N_FAULT_TYPES];
+    LatencyHistogram hists_[N_FAULT_TYPES];
 
-    void updateRt(double rt) {
+public:
+    FaultStatistics()
+        : major_(0), minor_(0) {}
 
-        if (max_ < 0 || min_ < 0) {
-            max_ = rt; min_ = rt;
-        } else if (max_ < rt) {
-            max_ = rt;
-        } else if (min_ > rt) {
-            min_ = rt;
+    /**
+     * @begin page faults before the IO.
+     * @end page faults after the IO.
+     */
+    void updateRt(const PageFaults& begin, const PageFaults& end, double rt) {
+
+        const size_t major = end.major - begin.major;
+        const size_t minor = end.minor - begin.minor;
+        major_ += major;
+        minor_ += minor;
+        size_t type = NO_FAULT;
+        if (major > 0) {
+            type = MAJOR_FAULT;
+        } else if (minor > 0) {
+            type = MINOR_FAULT;
         }
-        total_ += rt;
-        count_++;
+        stats_[type].updateRt(rt);
+        hists_[type].add(rt);
     }
-    
-    double getMax() const { return max_; }
-    double getMin() const { return min_; }
-    double getTotal() const { return total_; }
-    size_t getCount() const { return count_; }
 
-    double getAverage() const { return total_ / (double)count_; }
+    void merge(const FaultStatistics& rhs) {
+
+        major_ += rhs.major_;
+        minor_ += rhs.minor_;
+        for (size_t i = 0; i < N_FAULT_TYPES; i++) {
+            stats_[i].merge(rhs.stats_[i]);
+            hists_[i].merge(rhs.hists_[i]);
+        }
+    }
 
     void print() const {
-        ::printf("total %.06f count %zu avg %.06f max %.06f min %.06f\n",
-                 getTotal(), getCount(), getAverage(),
-                 getMax(), getMin());
+
+        static const char* names[N_FAULT_TYPES] = { "nofault", "minorfault", "majorfault" };
+        size_t nio = 0;
+        for (size_t i = 0; i < N_FAULT_TYPES; i++) {
+            nio += stats_[i].getCount();
+        }
+        ::printf("faults major %zu minor %zu major/io %.06f minor/io %.06f\n",
+                 major_, minor_,
+                 nio == 0 ? 0.0 : static_cast<double>(major_) / nio,
+                 nio == 0 ? 0.0 : static_cast<double>(minor_) / nio);
+        for (size_t i = 0; i < N_FAULT_TYPES; i++) {
+            if (stats_[i].getCount() == 0) { continue; }
+            ::printf("%s ", names[i]);
+            stats_[i].print();
+            ::printf("%s ", names[i]);
+            hists_[i].print();
+        }
     }
 };
 
-template<typename T> //T is iterator type of PerformanceStatistics.
-static inline PerformanceStatistics mergeStats(const T begin, const T end)
+/**
+ * Statistics for each IO operation type.
+ */
+class OpStatistics
 {
-    double total = 0;
-    double max = -1.0;
-    double min = -1.0;
-    size_t count = 0;
+private:
+    PerformanceStatistics stats_[N_IO_OPS];
 
-    std::for_each(begin, end, [&](PerformanceStatistics& stat) {
+public:
+    void updateRt(IoOp op, double rt) { stats_[op].updateRt(rt); }
+    PerformanceStatistics& get(IoOp op) { return stats_[op]; }
+    const PerformanceStatistics& get(IoOp op) const { return stats_[op]; }
 
-            total += stat.getTotal();
-            if (max < 0 || max < stat.getMax()) { max = stat.getMax(); }
-            if (min < 0 || min > stat.getMin()) { min = stat.getMin(); }
-            count += stat.getCount();
-        });
-    
-    return PerformanceStatistics(total, max, min, count);
+    /**
+     * Number of IOs transferring data (read and write).
+     */
+    size_t getDataCount() const {
+
+        return stats_[READ_OP].getCount() + stats_[WRITE_OP].getCount();
+    }
+
+    /**
+     * Print statistics of the operation types executed.
+     */
+    void print() const {
+
+        for (size_t i = 0; i < N_IO_OPS; i++) {
+            if (stats_[i].getCount() == 0) { continue; }
+            ::printf("%s ", getIoOpName(static_cast<IoOp>(i)));
+            stats_[i].print();
+        }
+    }
+};
+
+template<typename T> //T is iterator type of OpStatistics.
+static inline OpStatistics mergeOpStats(const T begin, const T end)
+{
+    OpStatistics ret;
+    for (size_t i = 0; i < N_IO_OPS; i++) {
+        const IoOp op = static_cast<IoOp>(i);
+        std::vector<PerformanceStatistics> v;
+        std::for_each(begin, end, [&](const OpStatistics& stats) {
+                if (stats.get(op).getCount() > 0) { v.push_back(stats.get(op)); }
+            });
+        ret.get(op) = mergeStats(v.begin(), v.end());
+    }
+    return ret;
 }
 
 /**
@@ -527,19 +2112,31 @@ std::string getDataThroughputString(double throughput)
 
 /**
  * Print throughput data.
- * @blockSize block size [bytes].
+ * @totalSize Total size of IO executed [bytes].
  * @nio Number of IO executed.
  * @periodInSec Elapsed time [second].
  */
 static inline
-void printThroughput(size_t blockSize, size_t nio, double periodInSec)
+void printThroughputInBytes(size_t totalSize, size_t nio, double periodInSec)
 {
-    double throughput = static_cast<double>(blockSize * nio) / periodInSec;
+    double throughput = static_cast<double>(totalSize) / periodInSec;
     double iops = static_cast<double>(nio) / periodInSec;
     ::printf("Throughput: %.3f B/s %s %.3f iops.\n",
              throughput, getDataThroughputString(throughput).c_str(), iops);
 }
 
+/**
+ * Print throughput data.
+ * @blockSize block size [bytes].
+ * @nio Number of IO executed.
+ * @periodInSec Elapsed time [second].
+ */
+static inline
+void printThroughput(size_t blockSize, size_t nio, double periodInSec)
+{
+    printThroughputInBytes(blockSize * nio, nio, periodInSec);
+}
+
 /**
  * Ring buffer for block data.
  */
@@ -551,15 +2148,19 @@ private:
     size_t idx_;
         
 public:
+    /**
+     * Buffers are aligned to a page, which satisfies
+     * the memory alignment of direct IO of any device.
+     */
     BlockBuffer(size_t nr, size_t blockSize)
         : nr_(nr)
         , bufArray_(nr)
         , idx_(0) {
 
-        assert(blockSize % 512 == 0);
+        const size_t align = ::sysconf(_SC_PAGESIZE);
         for (size_t i = 0; i < nr; i++) {
             char *p = nullptr;
-            int ret = ::posix_memalign((void **)&p, 512, blockSize);
+            int ret = ::posix_memalign((void **)&p, align, blockSize);
             assert(ret == 0);
             assert(p != nullptr);
             bufArray_[i] = p;
@@ -581,4 +2182,136 @@ public:
     }
 };
 
+/**
+ * Anonymous memory shared with child processes forked after allocation.
+ */
+class SharedMemory
+{
+private:
+    void *addr_;
+    size_t size_;
+
+public:
+    explicit SharedMemory(size_t size)
+        : addr_(MAP_FAILED)
+        , size_(size) {
+
+        addr_ = ::mmap(NULL, size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (addr_ == MAP_FAILED) {
+            std::string e("mmap failed: ");
+            e += ::strerror(errno);
+            throw std::runtime_error(e);
+        }
+    }
+
+    ~SharedMemory() noexcept {
+
+        ::munmap(addr_, size_);
+    }
+
+    SharedMemory(const SharedMemory&) = delete;
+    SharedMemory& operator=(const SharedMemory&) = delete;
+
+    void* get() const { return addr_; }
+};
+
+/**
+ * Start child processes at once.
+ * A child writes a byte to the ready pipe and waits until
+ * the parent closes the go pipe.
+ * Unlike a barrier, the parent sees EOF of the ready pipe
+ * if a child exits before it gets ready.
+ */
+class StartGate
+{
+private:
+    int readyFd_[2];
+    int goFd_[2];
+
+public:
+    StartGate() {
+
+        readyFd_[0] = readyFd_[1] = goFd_[0] = goFd_[1] = -1;
+        if (::pipe(readyFd_) != 0 || ::pipe(goFd_) != 0) {
+            std::string e("pipe failed: ");
+            e += ::strerror(errno);
+            closeAll();
+            throw std::runtime_error(e);
+        }
+    }
+
+    ~StartGate() noexcept { closeAll(); }
+
+    StartGate(const StartGate&) = delete;
+    StartGate& operator=(const StartGate&) = delete;
+
+    /**
+     * Call in a child just after fork.
+     */
+    void enterChild() {
+
+        closeFd(readyFd_[0]);
+        closeFd(goFd_[1]);
+    }
+
+    /**
+     * Call in a child. This does not wait.
+     */
+    void notifyReady() {
+
+        const char c = 0;
+        while (::write(readyFd_[1], &c, 1) < 0 && errno == EINTR);
+        closeFd(readyFd_[1]);
+    }
+
+    /**
+     * Call in a child after notifyReady().
+     */
+    void waitGo() {
+
+        char c;
+        while (::read(goFd_[0], &c, 1) < 0 && errno == EINTR);
+        closeFd(goFd_[0]);
+    }
+
+    /**
+     * Call in the parent after forking all the children.
+     * @nChildren number of forked children.
+     * RETURN: false if a child exited before it got ready.
+     */
+    bool waitReady(size_t nChildren) {
+
+        closeFd(readyFd_[1]);
+        size_t n = 0;
+        char buf[64];
+        while (n < nChildren) {
+            const ssize_t s = ::read(readyFd_[0], buf, sizeof(buf));
+            if (s < 0 && errno == EINTR) { continue; }
+            if (s <= 0) { break; }
+            n += s;
+        }
+        return n == nChildren;
+    }
+
+    /**
+     * Let all the waiting children go.
+     */
+    void release() { closeFd(goFd_[1]); }
+
+private:
+    static void closeFd(int& fd) {
+
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    void closeAll() {
+
+        closeFd(readyFd_[0]); closeFd(readyFd_[1]);
+        closeFd(goFd_[0]); closeFd(goFd_[1]);
+    }
+};
+
 #endif /* UTIL_HPP */
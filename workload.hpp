@@ -0,0 +1,1176 @@
+/**
+ * @file
+ * @brief Access patterns and the workload loop shared by iores and ioth.
+ *
+ * An access pattern is a class with the following member.
+ *
+ *   bool next(IoSpec& spec);
+ *     Generate the next IO. Returns false if the pattern is exhausted.
+ *
+ * IoWorkload and ClientReactor are templated over the engine and the pattern,
+ * so dispatch is resolved at compile time.
+ */
+#ifndef WORKLOAD_HPP
+#define WORKLOAD_HPP
+
+#define _FILE_OFFSET_BITS 64
+
+#include <queue>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <unordered_map>
+#include <functional>
+#include <algorithm>
+#include <utility>
+#include <random>
+#include <limits>
+#include <stdexcept>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "util.hpp"
+#include "rand.hpp"
+#include "trace.hpp"
+#include "io_engine.hpp"
+
+/**
+ * Shift offsets of a pattern into a window of the target.
+ * The inner pattern generates offsets in [0, window size).
+ */
+template<typename Pattern>
+class WindowPattern
+{
+private:
+    Pattern& pattern_;
+    const off_t base_; /* [byte] */
+
+public:
+    WindowPattern(Pattern& pattern, const IoWindow& window)
+        : pattern_(pattern)
+        , base_(window.getBase()) {}
+
+    bool next(IoSpec& spec) {
+
+        if (!pattern_.next(spec)) {
+            return false;
+        }
+        spec.oft += base_;
+        return true;
+    }
+};
+
+/**
+ * Capture of tail-latency outliers with the IOs completed just before them.
+ *
+ * An IO slower than a fixed threshold, or than a running percentile
+ * of its worker, is an outlier. Each worker writes the IOs it completes
+ * into its own ring, and an outlier is recorded with the latest IOs
+ * of all the rings, so workers never wait for each other.
+ * A ring slot is a seqlock written only by its owner,
+ * and a reader skips slots being overwritten.
+ */
+class TailCapture
+{
+public:
+    /**
+     * A completed IO.
+     */
+    struct Entry
+    {
+        unsigned int threadId;
+        IoOp op;
+        uint64_t oft; /* [byte] */
+        size_t size; /* [byte] */
+        size_t depth; /* IOs of the worker in flight when issued. */
+        double beginTime; /* unix time [second] */
+        double rt; /* response time [second] */
+
+        double getEndTime() const { return beginTime + rt; }
+    };
+
+    /**
+     * An outlier and the IOs of all workers completed before it.
+     */
+    struct Event
+    {
+        Entry io;
+        double threshold; /* [second] */
+        std::vector<Entry> context; /* in completion order. */
+    };
+
+private:
+    /* The running percentile is updated every this number of IOs of a worker. */
+    static const size_t UPDATE_INTERVAL = 1024;
+    /* The running percentile is not used until a worker completes this number of IOs. */
+    static const size_t MIN_IOS = 4096;
+    static const size_t N_WORDS = 6;
+
+    struct Slot
+    {
+        std::atomic<uint64_t> seq; /* 2k+1 while entry k is written, 2k+2 after. */
+        std::atomic<uint64_t> words[N_WORDS];
+    };
+
+    struct alignas(64) Worker
+    {
+        std::unique_ptr<Slot[]> ring;
+        std::atomic<uint64_t> nWritten;
+
+        /* The rest is accessed only by the owner until the run ends. */
+        double threshold; /* [second]. 0 means not yet available. */
+        size_t nEvents;
+        std::vector<Event> events; /* heap of the slowest events. */
+
+        Worker()
+            : ring(), nWritten(0), threshold(0), nEvents(0), events() {}
+    };
+
+    const double threshold_; /* [second] */
+    const double percentile_;
+    const size_t ringSize_;
+    const size_t maxEvents_;
+    std::vector<Worker> workers_;
+
+public:
+    /**
+     * @nWorkers workers with thread ids in [0, nWorkers).
+     * @threshold fixed threshold [second]. 0 means the running percentile.
+     * @percentile in (0, 100) used if threshold is 0.
+     * @ringSize number of IOs recorded before each outlier.
+     * @maxEvents outliers kept for each worker. The slowest ones are kept.
+     */
+    TailCapture(size_t nWorkers, double threshold, double percentile,
+                size_t ringSize, size_t maxEvents)
+        : threshold_(threshold)
+        , percentile_(percentile)
+        , ringSize_(ringSize)
+        , maxEvents_(maxEvents)
+        , workers_(nWorkers) {
+
+        assert(threshold_ > 0 || (0 < percentile_ && percentile_ < 100));
+        assert(ringSize_ > 0);
+        assert(maxEvents_ > 0);
+        for (Worker& w : workers_) {
+            w.ring.reset(new Slot[ringSize_]);
+            for (size_t i = 0; i < ringSize_; i++) {
+                w.ring[i].seq.store(0, std::memory_order_relaxed);
+            }
+            w.threshold = threshold_;
+        }
+    }
+
+    TailCapture(const TailCapture&) = delete;
+    TailCapture& operator=(const TailCapture&) = delete;
+
+    /**
+     * Called by the worker of threadId for each IO it completes.
+     * @hist latency of the worker including this IO.
+     */
+    void complete(unsigned int threadId, const IoResult& res, const LatencyHistogram& hist) {
+
+        assert(threadId < workers_.size());
+        Worker& w = workers_[threadId];
+        Entry e;
+        e.threadId = threadId;
+        e.op = res.op;
+        e.oft = res.oft;
+        e.size = res.size;
+        e.depth = res.depth;
+        e.beginTime = res.beginTime;
+        e.rt = res.endTime - res.beginTime;
+
+        if (threshold_ == 0) {
+            const uint64_t n = hist.getCount();
+            if (n >= MIN_IOS && n % UPDATE_INTERVAL == 0) {
+                w.threshold = hist.getPercentileUpperEnd(percentile_);
+            }
+        }
+        if (w.threshold > 0 && e.rt > w.threshold) {
+            w.nEvents++;
+            capture(w, e);
+        }
+        write(w, e);
+    }
+
+    size_t getRingSize() const { return ringSize_; }
+
+    /**
+     * Print the outliers of all workers in time order.
+     * Call this after the workers finish.
+     */
+    void print() const {
+
+        std::vector<const Event*> events;
+        size_t nEvents = 0;
+        for (const Worker& w : workers_) {
+            for (const Event& ev : w.events) { events.push_back(&ev); }
+            nEvents += w.nEvents;
+        }
+        std::sort(events.begin(), events.end(), [](const Event* a, const Event* b) {
+                return a->io.beginTime < b->io.beginTime;
+            });
+        if (threshold_ > 0) {
+            ::printf("tail trigger %.06f", threshold_);
+        } else {
+            ::printf("tail trigger p%g", percentile_);
+        }
+        ::printf(" context %zu events %zu kept %zu\n", ringSize_, nEvents, events.size());
+        for (size_t i = 0; i < events.size(); i++) {
+            const Event& ev = *events[i];
+            const Entry& e = ev.io;
+            ::printf("tail-event %zu time %.06f thread %u op %s oft %llu size %zu "
+                     "depth %zu latency %.06f threshold %.06f\n",
+                     i, e.beginTime, e.threadId, getIoOpName(e.op),
+                     static_cast<unsigned long long>(e.oft), e.size,
+                     e.depth, e.rt, ev.threshold);
+            for (const Entry& c : ev.context) {
+                ::printf("tail-context %zu thread %u op %s oft %llu size %zu "
+                         "depth %zu begin %+.06f latency %.06f\n",
+                         i, c.threadId, getIoOpName(c.op),
+                         static_cast<unsigned long long>(c.oft), c.size,
+                         c.depth, c.beginTime - e.beginTime, c.rt);
+            }
+        }
+    }
+
+private:
+    static bool isFaster(const Event& a, const Event& b) { return a.io.rt > b.io.rt; }
+
+    /**
+     * Record an outlier if it is one of the slowest maxEvents_ ones.
+     */
+    void capture(Worker& w, const Entry& e) {
+
+        if (w.events.size() == maxEvents_) {
+            if (e.rt <= w.events.front().io.rt) { return; }
+            std::pop_heap(w.events.begin(), w.events.end(), isFaster);
+            w.events.pop_back();
+        }
+        Event ev;
+        ev.io = e;
+        ev.threshold = w.threshold;
+        ev.context = getContext(e.getEndTime());
+        w.events.push_back(std::move(ev));
+        std::push_heap(w.events.begin(), w.events.end(), isFaster);
+    }
+
+    /**
+     * The latest ringSize_ IOs of all workers completed by endTime.
+     */
+    std::vector<Entry> getContext(double endTime) const {
+
+        std::vector<Entry> v;
+        for (const Worker& w : workers_) {
+            const uint64_t n = w.nWritten.load(std::memory_order_acquire);
+            for (uint64_t k = n; k > 0 && n - k < ringSize_; k--) {
+                Entry e;
+                if (read(w, k - 1, e) && e.getEndTime() <= endTime) {
+                    v.push_back(e);
+                }
+            }
+        }
+        std::sort(v.begin(), v.end(), [](const Entry& a, const Entry& b) {
+                return a.getEndTime() < b.getEndTime();
+            });
+        if (v.size() > ringSize_) {
+            v.erase(v.begin(), v.end() - ringSize_);
+        }
+        return v;
+    }
+
+    static uint64_t toWord(double d) {
+
+        uint64_t u;
+        ::memcpy(&u, &d, sizeof(u));
+        return u;
+    }
+
+    static double toDouble(uint64_t u) {
+
+        double d;
+        ::memcpy(&d, &u, sizeof(d));
+        return d;
+    }
+
+    void write(Worker& w, const Entry& e) {
+
+        const uint64_t k = w.nWritten.load(std::memory_order_relaxed);
+        Slot& s = w.ring[k % ringSize_];
+        const uint64_t words[N_WORDS] = {
+            (static_cast<uint64_t>(e.threadId) << 8) | e.op,
+            e.oft, e.size, e.depth, toWord(e.beginTime), toWord(e.rt),
+        };
+        s.seq.store(2 * k + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < N_WORDS; i++) {
+            s.words[i].store(words[i], std::memory_order_relaxed);
+        }
+        s.seq.store(2 * k + 2, std::memory_order_release);
+        w.nWritten.store(k + 1, std::memory_order_release);
+    }
+
+    /**
+     * Read entry k of a ring.
+     * RETURN:
+     *   false if the slot has been overwritten.
+     */
+    bool read(const Worker& w, uint64_t k, Entry& e) const {
+
+        const Slot& s = w.ring[k % ringSize_];
+        const uint64_t seq = s.seq.load(std::memory_order_acquire);
+        if (seq != 2 * k + 2) { return false; }
+        uint64_t words[N_WORDS];
+        for (size_t i = 0; i < N_WORDS; i++) {
+            words[i] = s.words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.seq.load(std::memory_order_relaxed) != seq) { return false; }
+        e.threadId = static_cast<unsigned int>(words[0] >> 8);
+        e.op = static_cast<IoOp>(words[0] & 0xff);
+        e.oft = words[1];
+        e.size = words[2];
+        e.depth = words[3];
+        e.beginTime = toDouble(words[4]);
+        e.rt = toDouble(words[5]);
+        return true;
+    }
+};
+
+/**
+ * IOs in flight of all workers sampled by a background thread.
+ *
+ * Each worker counts its own IOs in flight in a counter of its own,
+ * so counting costs no shared write. The sampler sums the counters
+ * at a fixed interval, so the distribution of the sums is
+ * a time-weighted distribution of the depth.
+ * The sampler must have a CPU of its own, or it runs only
+ * when workers sleep and the depth is underestimated.
+ */
+class DepthTracker
+{
+private:
+    struct alignas(64) Counter
+    {
+        std::atomic<size_t> n;
+
+        Counter() : n(0) {}
+    };
+
+    const size_t intervalUs_;
+    std::vector<Counter> counters_;
+    std::vector<uint64_t> samples_; /* number of samples of each depth. */
+    std::thread th_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool isStopped_;
+
+public:
+    /**
+     * @nWorkers workers with thread ids in [0, nWorkers).
+     * @intervalUs sampling interval [usec].
+     */
+    DepthTracker(size_t nWorkers, size_t intervalUs)
+        : intervalUs_(intervalUs)
+        , counters_(nWorkers)
+        , samples_()
+        , th_()
+        , mutex_()
+        , cv_()
+        , isStopped_(false) {
+
+        assert(intervalUs_ > 0);
+    }
+
+    ~DepthTracker() noexcept {
+
+        try {
+            stop();
+        } catch (...) {
+        }
+    }
+
+    DepthTracker(const DepthTracker&) = delete;
+    DepthTracker& operator=(const DepthTracker&) = delete;
+
+    /**
+     * Called by the worker of threadId only.
+     * @n IOs issued (positive) or completed (negative).
+     */
+    void add(unsigned int threadId, ptrdiff_t n) {
+
+        assert(threadId < counters_.size());
+        std::atomic<size_t>& c = counters_[threadId].n;
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void start() {
+
+        samples_.clear();
+        isStopped_ = false;
+        th_ = std::thread([this] { sampleEachInterval(); });
+    }
+
+    void stop() {
+
+        if (!th_.joinable()) { return; }
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            isStopped_ = true;
+        }
+        cv_.notify_one();
+        th_.join();
+    }
+
+    /**
+     * Print the depth distribution and compare the mean depth
+     * with the one given by Little's law, IOPS times mean latency.
+     * A measured depth above it is time IOs spend in the harness
+     * out of the latency, and a depth below the target is idle time.
+     * @nio number of IOs.
+     * @response average response time [second].
+     * @period elapsed time [second].
+     * @target configured number of IOs in flight.
+     */
+    void print(size_t nio, double response, double period, size_t target) const {
+
+        uint64_t n = 0;
+        double total = 0;
+        for (size_t d = 0; d < samples_.size(); d++) {
+            n += samples_[d];
+            total += static_cast<double>(d) * samples_[d];
+        }
+        const double mean = n == 0 ? 0.0 : total / n;
+        ::printf("depth mean %.3f p50 %zu p99 %zu max %zu target %zu samples %llu\n",
+                 mean, getPercentile(n, 50), getPercentile(n, 99),
+                 samples_.empty() ? 0 : samples_.size() - 1, target,
+                 static_cast<unsigned long long>(n));
+        ::printf("depth-hist");
+        for (size_t d = 0; d < samples_.size(); d++) {
+            if (samples_[d] > 0) {
+                ::printf(" %zu:%.06f", d, static_cast<double>(samples_[d]) / n);
+            }
+        }
+        ::printf("\n");
+        const double iops = period <= 0 ? 0.0 : nio / period;
+        const double expected = iops * response;
+        ::printf("little iops %.3f latency %.06f expected-depth %.3f measured-depth %.3f "
+                 "ratio %.3f utilization %.3f\n",
+                 iops, response, expected, mean,
+                 expected == 0 ? 0.0 : mean / expected,
+                 target == 0 ? 0.0 : mean / target);
+    }
+
+private:
+    size_t getPercentile(uint64_t n, double p) const {
+
+        uint64_t target = static_cast<uint64_t>(p / 100.0 * static_cast<double>(n) + 0.5);
+        if (target == 0) { target = 1; }
+        uint64_t c = 0;
+        for (size_t d = 0; d < samples_.size(); d++) {
+            c += samples_[d];
+            if (c >= target) { return d; }
+        }
+        return 0;
+    }
+
+    void sampleEachInterval() {
+
+        const std::chrono::microseconds interval(intervalUs_);
+        std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lk(mutex_);
+        while (true) {
+            next += interval;
+            if (cv_.wait_until(lk, next, [this] { return isStopped_; })) { break; }
+            size_t depth = 0;
+            for (const Counter& c : counters_) {
+                depth += c.n.load(std::memory_order_relaxed);
+            }
+            if (depth >= samples_.size()) {
+                samples_.resize(depth + 1, 0);
+            }
+            samples_[depth]++;
+        }
+    }
+};
+
+/**
+ * Record completed IOs of a worker.
+ */
+class IoRecorder
+{
+private:
+    unsigned int threadId_;
+    size_t blockSize_;
+    bool isShowEachResponse_;
+
+    std::queue<IoLog> logQ_;
+    PerformanceStatistics stat_;
+    LatencyHistogram hist_;
+    IntervalSeries intervals_;
+    OpStatistics opStats_;
+    PerformanceStatistics lagStat_;
+    size_t totalSize_; /* read and written [byte] */
+    int lastCpu_;
+    size_t nMigrations_;
+    TailCapture* tail_;
+    DepthTracker* depth_;
+
+public:
+    /**
+     * @blockSize to convert offset to blockId of IoLog [byte].
+     */
+    IoRecorder(unsigned int threadId, size_t blockSize, bool isShowEachResponse)
+        : threadId_(threadId)
+        , blockSize_(blockSize)
+        , isShowEachResponse_(isShowEachResponse)
+        , logQ_()
+        , stat_()
+        , hist_()
+        , intervals_()
+        , opStats_()
+        , lagStat_()
+        , totalSize_(0)
+        , lastCpu_(-1)
+        , nMigrations_(0)
+        , tail_(nullptr)
+        , depth_(nullptr) {}
+
+    /**
+     * Report each IO to a tail capture shared by the workers, or nullptr.
+     */
+    void setTailCapture(TailCapture* tail) { tail_ = tail; }
+
+    /**
+     * Count IOs in flight in a depth tracker shared by the workers, or nullptr.
+     */
+    void setDepthTracker(DepthTracker* depth) { depth_ = depth; }
+
+    /**
+     * Called before IOs are submitted.
+     * @n number of IOs.
+     */
+    void issue(size_t n) {
+
+        if (depth_) { depth_->add(threadId_, n); }
+    }
+
+    void complete(const IoResult& res) {
+
+        if (depth_) { depth_->add(threadId_, -1); }
+
+        const int cpu = ::sched_getcpu();
+        if (lastCpu_ >= 0 && cpu != lastCpu_) {
+            nMigrations_++;
+        }
+        lastCpu_ = cpu;
+
+        const double rt = res.endTime - res.beginTime;
+        stat_.updateRt(rt);
+        hist_.add(rt);
+        opStats_.updateRt(res.op, rt);
+        if (res.op == READ_OP || res.op == WRITE_OP) {
+            totalSize_ += res.size;
+            intervals_.add(res.endTime, res.size);
+        } else {
+            intervals_.add(res.endTime, 0);
+        }
+        if (isShowEachResponse_) {
+            logQ_.push(IoLog(threadId_, res.op, res.oft / blockSize_,
+                             res.beginTime, rt));
+        }
+        if (tail_) {
+            tail_->complete(threadId_, res, hist_);
+        }
+    }
+
+    /**
+     * @lag delay of issue from the scheduled time [second].
+     */
+    void updateLag(double lag) { lagStat_.updateRt(lag); }
+
+    unsigned int getThreadId() const { return threadId_; }
+    std::queue<IoLog>& getLogQueue() { return logQ_; }
+    PerformanceStatistics& getStat() { return stat_; }
+    const LatencyHistogram& getHist() const { return hist_; }
+    const IntervalSeries& getIntervals() const { return intervals_; }
+    OpStatistics& getOpStats() { return opStats_; }
+    PerformanceStatistics& getLagStat() { return lagStat_; }
+    size_t getTotalSize() const { return totalSize_; }
+    /* Number of CPU changes between IO completions. */
+    size_t getNMigrations() const { return nMigrations_; }
+};
+
+/**
+ * Uniformly random access in an access range.
+ * Block ids are generated in batches.
+ */
+class RandomPattern
+{
+private:
+    static const size_t BATCH_SIZE = 64;
+
+    const size_t blockSize_;
+    const size_t accessRange_; /* [block] */
+    const size_t deviceSize_; /* [byte] */
+    const OpMix opMix_;
+    const size_t discardSize_;
+    CounterRand64 rand_;
+    uint64_t blockIds_[BATCH_SIZE];
+    size_t idx_; /* next index of blockIds_. */
+
+public:
+    /**
+     * @accessRange [block].
+     * @deviceSize [byte].
+     * @discardSize size of discard and zero [byte].
+     * @seed @stream of the random generator.
+     *   Workers should have the same seed and different streams.
+     */
+    RandomPattern(size_t blockSize, size_t accessRange, size_t deviceSize,
+                  const OpMix& opMix, size_t discardSize,
+                  uint64_t seed, uint64_t stream)
+        : blockSize_(blockSize)
+        , accessRange_(accessRange)
+        , deviceSize_(deviceSize)
+        , opMix_(opMix)
+        , discardSize_(discardSize)
+        , rand_(seed, stream)
+        , idx_(BATCH_SIZE) {
+
+        assert(accessRange_ > 0);
+    }
+
+    bool next(IoSpec& spec) {
+
+        if (idx_ == BATCH_SIZE) {
+            rand_.getBatch(accessRange_, blockIds_, BATCH_SIZE);
+            idx_ = 0;
+        }
+        size_t blockId = blockIds_[idx_++];
+        spec.op = opMix_.choose(rand_.get());
+        spec.size = (spec.op == DISCARD_OP || spec.op == ZERO_OP) ? discardSize_ : blockSize_;
+        spec.oft = blockId * blockSize_;
+        assert(spec.oft + spec.size <= deviceSize_);
+        spec.due = 0;
+        return true;
+    }
+};
+
+/**
+ * Random access visiting every block in an access range exactly once.
+ * Workers share a permutation of the range and each takes
+ * a contiguous part of it, so they need no coordination.
+ * The pattern is exhausted when the part is visited.
+ */
+class PermutationPattern
+{
+private:
+    const size_t blockSize_;
+    const size_t deviceSize_; /* [byte] */
+    const OpMix opMix_;
+    const size_t discardSize_;
+    const FeistelPermutation perm_;
+    CounterRand64 rand_; /* to choose operations. */
+    size_t idx_; /* next index of the permutation. */
+    size_t endIdx_;
+
+public:
+    /**
+     * @accessRange [block].
+     * @deviceSize [byte].
+     * @discardSize size of discard and zero [byte].
+     * @seed of the permutation. Workers must have the same seed.
+     * @workerId in [0, nWorkers).
+     */
+    PermutationPattern(size_t blockSize, size_t accessRange, size_t deviceSize,
+                       const OpMix& opMix, size_t discardSize,
+                       uint64_t seed, size_t workerId, size_t nWorkers)
+        : blockSize_(blockSize)
+        , deviceSize_(deviceSize)
+        , opMix_(opMix)
+        , discardSize_(discardSize)
+        , perm_(accessRange, seed)
+        , rand_(seed, workerId)
+        , idx_(0)
+        , endIdx_(0) {
+
+        assert(accessRange > 0);
+        assert(workerId < nWorkers);
+        const size_t q = accessRange / nWorkers;
+        const size_t r = accessRange % nWorkers;
+        idx_ = q * workerId + std::min(workerId, r);
+        endIdx_ = idx_ + q + (workerId < r ? 1 : 0);
+    }
+
+    bool next(IoSpec& spec) {
+
+        if (idx_ >= endIdx_) {
+            return false;
+        }
+        size_t blockId = perm_.get(idx_++);
+        spec.op = opMix_.choose(rand_.get());
+        spec.size = (spec.op == DISCARD_OP || spec.op == ZERO_OP) ? discardSize_ : blockSize_;
+        spec.oft = blockId * blockSize_;
+        assert(spec.oft + spec.size <= deviceSize_);
+        spec.due = 0;
+        return true;
+    }
+};
+
+/**
+ * Sequential access from a start block to the end of the device.
+ */
+class SequentialPattern
+{
+private:
+    const size_t blockSize_;
+    const IoOp op_;
+    size_t blockId_;
+    const size_t maxBlockId_;
+
+public:
+    /**
+     * @startBlockId [block].
+     * @maxBlockId [block].
+     */
+    SequentialPattern(size_t blockSize, IoOp op, size_t startBlockId, size_t maxBlockId)
+        : blockSize_(blockSize)
+        , op_(op)
+        , blockId_(startBlockId)
+        , maxBlockId_(maxBlockId) {}
+
+    bool next(IoSpec& spec) {
+
+        if (blockId_ >= maxBlockId_) {
+            return false;
+        }
+        spec.op = op_;
+        spec.oft = blockId_ * blockSize_;
+        spec.size = blockSize_;
+        spec.due = 0;
+        blockId_++;
+        return true;
+    }
+};
+
+/**
+ * Access recorded in a trace.
+ * Patterns of several threads can share a TraceReader.
+ */
+class TracePattern
+{
+private:
+    TraceReader& reader_;
+    const size_t maxIoSize_;
+    const size_t deviceSize_;
+    const double beginTime_;
+    const double speed_;
+    size_t nSkipped_;
+
+public:
+    /**
+     * @maxIoSize [byte].
+     * @deviceSize [byte]. Records beyond it are skipped.
+     * @beginTime unix time when the first record is issued [second].
+     * @speed replay speed factor. 0 means as fast as possible.
+     */
+    TracePattern(TraceReader& reader, size_t maxIoSize, size_t deviceSize,
+                 double beginTime, double speed)
+        : reader_(reader)
+        , maxIoSize_(maxIoSize)
+        , deviceSize_(deviceSize)
+        , beginTime_(beginTime)
+        , speed_(speed)
+        , nSkipped_(0) {}
+
+    bool next(IoSpec& spec) {
+
+        TraceRecord rec;
+        while (reader_.next(rec)) {
+            if (rec.size > maxIoSize_) {
+                throw std::runtime_error("trace IO size exceeds the block size (-b).");
+            }
+            if (deviceSize_ < rec.oft + rec.size) {
+                nSkipped_++;
+                continue;
+            }
+            spec.op = rec.isWrite ? WRITE_OP : READ_OP;
+            spec.oft = rec.oft;
+            spec.size = rec.size;
+            spec.due = (speed_ == 0) ? 0 : beginTime_ + rec.time / speed_;
+            return true;
+        }
+        return false;
+    }
+
+    size_t getNSkipped() const { return nSkipped_; }
+};
+
+/**
+ * Closed-loop workload keeping up to engine.getQueueSize() IOs outstanding.
+ * IOs with a due time are not issued before it.
+ */
+template<typename Engine, typename Pattern>
+class IoWorkload
+{
+private:
+    Engine& engine_;
+    Pattern& pattern_;
+    IoRecorder& recorder_;
+    BlockBuffer bb_;
+
+public:
+    /**
+     * @blockSize maximum IO size [byte].
+     * @seed of the buffer contents. The stream is the thread id.
+     */
+    IoWorkload(Engine& engine, Pattern& pattern, IoRecorder& recorder, size_t blockSize,
+               uint64_t seed = 0)
+        : engine_(engine)
+        , pattern_(pattern)
+        , recorder_(recorder)
+        , bb_(engine.getQueueSize() * 2, blockSize) {
+
+        CounterRand64 rand(seed, recorder.getThreadId());
+        for (size_t i = 0; i < engine.getQueueSize() * 2; i++) {
+            char* buf = bb_.next();
+            for (size_t j = 0; j < blockSize; j++) {
+                buf[j] = static_cast<char>(rand.get(256));
+            }
+        }
+    }
+
+    void execNtimes(size_t nTimes) { exec(nTimes, 0); }
+    void execNsecs(size_t nSecs) { exec(0, nSecs); }
+
+    /**
+     * Execute until a limit is reached or the pattern is exhausted.
+     * @nTimes number of IOs to issue. 0 means unlimited.
+     * @nSecs period [second]. 0 means unlimited.
+     */
+    void exec(size_t nTimes, size_t nSecs) {
+
+        const size_t queueSize = engine_.getQueueSize();
+        const double beginTime = getTime();
+        double now = beginTime;
+        size_t pending = 0;
+        size_t c = 0;
+        IoSpec spec;
+        bool hasSpec = false;
+
+        while (true) {
+            /* Fill the queue with IOs due. */
+            size_t nPrepared = 0;
+            bool isEnd = false;
+            while (pending < queueSize) {
+                if ((nTimes > 0 && c >= nTimes) ||
+                    (nSecs > 0 && now - beginTime >= static_cast<double>(nSecs))) {
+                    isEnd = true;
+                    break;
+                }
+                if (!hasSpec) {
+                    hasSpec = pattern_.next(spec);
+                    if (!hasSpec) {
+                        isEnd = true;
+                        break;
+                    }
+                }
+                if (spec.due > now) {
+                    now = getTime();
+                    if (spec.due > now) { break; }
+                }
+                if (spec.due > 0) { recorder_.updateLag(now - spec.due); }
+                spec.depth = pending + 1;
+                engine_.prepare(spec, bb_.next());
+                hasSpec = false;
+                pending++;
+                c++;
+                nPrepared++;
+            }
+            if (nPrepared > 0) {
+                recorder_.issue(nPrepared);
+                engine_.submit();
+            }
+            if (pending == 0) {
+                if (isEnd) { break; }
+                /* The next IO is not due yet. */
+                sleepUntil(spec.due);
+                now = getTime();
+                continue;
+            }
+            /* Wait an IO. */
+            IoResult res;
+            if (!isEnd && hasSpec && pending < queueSize && spec.due > now) {
+                if (!engine_.reapFor(spec.due - now, res)) {
+                    now = getTime();
+                    continue;
+                }
+            } else {
+                res = engine_.reap();
+            }
+            pending--;
+            now = res.endTime;
+            recorder_.complete(res);
+        }
+    }
+};
+
+/**
+ * Statistics of a logical client.
+ */
+class ClientStatistics
+{
+private:
+    unsigned int clientId_;
+    PerformanceStatistics stat_;
+    PerformanceStatistics thinkStat_;
+
+public:
+    explicit ClientStatistics(unsigned int clientId)
+        : clientId_(clientId)
+        , stat_()
+        , thinkStat_() {}
+
+    /**
+     * @rt response time [second].
+     */
+    void updateRt(double rt) { stat_.updateRt(rt); }
+
+    /**
+     * @think period from a completion to the next issue [second].
+     */
+    void updateThink(double think) { thinkStat_.updateRt(think); }
+
+    unsigned int getClientId() const { return clientId_; }
+    const PerformanceStatistics& getStat() const { return stat_; }
+    const PerformanceStatistics& getThinkStat() const { return thinkStat_; }
+
+    void print() const {
+
+        ::printf("client %u ", clientId_);
+        stat_.print();
+    }
+};
+
+/**
+ * Print the distribution of IO counts and average response times
+ * over clients, and the merged think time.
+ * T is iterator type of ClientStatistics.
+ */
+template<typename T>
+static inline void printClientSummary(const T begin, const T end)
+{
+    size_t nClients = 0, nActive = 0;
+    size_t minCount = SIZE_MAX, maxCount = 0, totalCount = 0;
+    double minAvg = 0, maxAvg = 0, sumAvg = 0;
+    std::vector<PerformanceStatistics> thinkStats;
+    for (T it = begin; it != end; ++it) {
+        const size_t count = it->getStat().getCount();
+        minCount = std::min(minCount, count);
+        maxCount = std::max(maxCount, count);
+        totalCount += count;
+        nClients++;
+        if (count > 0) {
+            const double avg = it->getStat().getAverage();
+            if (nActive == 0 || avg < minAvg) { minAvg = avg; }
+            if (nActive == 0 || avg > maxAvg) { maxAvg = avg; }
+            sumAvg += avg;
+            nActive++;
+        }
+        if (it->getThinkStat().getCount() > 0) {
+            thinkStats.push_back(it->getThinkStat());
+        }
+    }
+    if (nClients == 0) { return; }
+    ::printf("clients %zu count min %zu avg %.03f max %zu "
+             "response-avg min %.06f avg %.06f max %.06f\n",
+             nClients, minCount,
+             static_cast<double>(totalCount) / static_cast<double>(nClients), maxCount,
+             minAvg, nActive == 0 ? 0.0 : sumAvg / static_cast<double>(nActive), maxAvg);
+    ::printf("think ");
+    mergeStats(thinkStats.begin(), thinkStats.end()).print();
+}
+
+/**
+ * Many closed-loop logical clients multiplexed on one thread.
+ *
+ * C++11 has no coroutines, so each client is an explicit state machine:
+ * it issues an IO, waits for its completion, thinks, and issues the next.
+ * Thinking clients wait in a timer queue ordered by wake-up time,
+ * and completions are matched to clients by their buffers.
+ * The engine must accept as many outstanding IOs as clients.
+ */
+template<typename Engine, typename Pattern>
+class ClientReactor
+{
+private:
+    typedef std::pair<double, size_t> Timer; /* wake-up time, client index */
+
+    Engine& engine_;
+    Pattern& pattern_;
+    IoRecorder& recorder_;
+    const double thinkTime_;
+    CounterRand64 rand_; /* think times and buffer contents. */
+    BlockBuffer bb_;
+
+    std::vector<ClientStatistics> clients_;
+    std::vector<char *> bufs_;
+    std::vector<double> lastEnd_;
+    std::unordered_map<char *, size_t> bufToClient_;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer> > timerQ_;
+
+public:
+    /**
+     * @firstClientId id of the first client of this reactor.
+     * @nClients number of clients.
+     * @thinkTime mean think time between IOs of a client [second].
+     *   Each think time is exponentially distributed. 0 means no think time.
+     * @blockSize maximum IO size [byte].
+     * @seed @stream of the random generator.
+     *   The stream should differ from the one of the pattern.
+     */
+    ClientReactor(Engine& engine, Pattern& pattern, IoRecorder& recorder,
+                  unsigned int firstClientId, size_t nClients,
+                  double thinkTime, size_t blockSize,
+                  uint64_t seed, uint64_t stream)
+        : engine_(engine)
+        , pattern_(pattern)
+        , recorder_(recorder)
+        , thinkTime_(thinkTime)
+        , rand_(seed, stream)
+        , bb_(nClients, blockSize) {
+
+        assert(nClients > 0);
+        assert(nClients <= engine.getQueueSize());
+        for (size_t i = 0; i < nClients; i++) {
+            clients_.push_back(ClientStatistics(firstClientId + i));
+            char *buf = bb_.next();
+            for (size_t j = 0; j < blockSize; j++) {
+                buf[j] = static_cast<char>(rand_.get(256));
+            }
+            bufs_.push_back(buf);
+            bufToClient_[buf] = i;
+        }
+        lastEnd_.resize(nClients, 0.0);
+    }
+
+    std::vector<ClientStatistics>& getClients() { return clients_; }
+
+    /**
+     * Execute until a limit is reached or the pattern is exhausted.
+     * Clients in flight are waited for before return.
+     * @nTimes number of IOs to issue. 0 means unlimited.
+     * @nSecs period [second]. 0 means unlimited.
+     */
+    void exec(size_t nTimes, size_t nSecs) {
+
+        const double beginTime = getTime();
+        for (size_t i = 0; i < clients_.size(); i++) {
+            timerQ_.push(Timer(beginTime, i));
+        }
+        size_t pending = 0;
+        size_t c = 0;
+        bool isEnd = false;
+
+        while (!isEnd || pending > 0) {
+            /* Issue IOs of clients whose think time has passed. */
+            double now = getTime();
+            size_t nPrepared = 0;
+            while (!isEnd && !timerQ_.empty() && timerQ_.top().first <= now) {
+                IoSpec spec;
+                if ((nTimes > 0 && c >= nTimes) ||
+                    (nSecs > 0 && now - beginTime >= static_cast<double>(nSecs)) ||
+                    !pattern_.next(spec)) {
+                    isEnd = true;
+                    break;
+                }
+                const size_t i = timerQ_.top().second;
+                timerQ_.pop();
+                if (lastEnd_[i] > 0) {
+                    clients_[i].updateThink(now - lastEnd_[i]);
+                }
+                spec.due = 0;
+                spec.depth = pending + 1;
+                engine_.prepare(spec, bufs_[i]);
+                pending++;
+                c++;
+                nPrepared++;
+            }
+            if (nPrepared > 0) {
+                recorder_.issue(nPrepared);
+                engine_.submit();
+            }
+            if (isEnd) {
+                while (!timerQ_.empty()) { timerQ_.pop(); }
+            }
+            if (pending == 0) {
+                if (isEnd) { break; }
+                /* All clients are thinking. */
+                sleepUntil(timerQ_.top().first);
+                continue;
+            }
+
+            /* Wait a completion. */
+            IoResult res;
+            if (!timerQ_.empty()) {
+                if (!engine_.reapFor(timerQ_.top().first - now, res)) {
+                    continue;
+                }
+            } else {
+                res = engine_.reap();
+            }
+            pending--;
+            recorder_.complete(res);
+            const size_t i = bufToClient_[res.buf];
+            clients_[i].updateRt(res.endTime - res.beginTime);
+            lastEnd_[i] = res.endTime;
+            if (!isEnd) {
+                timerQ_.push(Timer(res.endTime + getThinkTime(), i));
+            }
+        }
+    }
+
+private:
+    double getThinkTime() {
+
+        if (thinkTime_ == 0) { return 0; }
+        /* 53 bits in (0, 1). */
+        const double u = (static_cast<double>(rand_.get() >> 11) + 0.5) / 9007199254740992.0;
+        return -thinkTime_ * std::log(u);
+    }
+};
+
+/**
+ * Merge results of recorders.
+ * T is iterator type of IoRecorder.
+ */
+template<typename T>
+static inline void mergeRecorders(const T begin, const T end,
+                                  PerformanceStatistics& stat, OpStatistics& opStats,
+                                  PerformanceStatistics& lagStat, size_t& totalSize)
+{
+    std::vector<PerformanceStatistics> stats, lagStats;
+    std::vector<OpStatistics> opStatsV;
+    totalSize = 0;
+    for (T it = begin; it != end; ++it) {
+        stats.push_back(it->getStat());
+        opStatsV.push_back(it->getOpStats());
+        if (it->getLagStat().getCount() > 0) {
+            lagStats.push_back(it->getLagStat());
+        }
+        totalSize += it->getTotalSize();
+    }
+    stat = mergeStats(stats.begin(), stats.end());
+    opStats = mergeOpStats(opStatsV.begin(), opStatsV.end());
+    lagStat = mergeStats(lagStats.begin(), lagStats.end());
+}
+
+#endif /* WORKLOAD_HPP */